@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_bulk_write.h"
+
+int nsdp_bulk_write_init(nsdp_bulk_write_t *bulk, nsdp_client_t *client,
+                         nsdp_bulk_write_on_result_f on_result,
+                         nsdp_bulk_write_on_done_f on_done, void *context)
+{
+  if (!bulk || !client)
+    return -EINVAL;
+
+  memset(bulk, 0, sizeof(*bulk));
+  bulk->client = client;
+  bulk->max_inflight = NSDP_BULK_WRITE_DEFAULT_INFLIGHT;
+  INIT_LIST_HEAD(&bulk->properties);
+  INIT_LIST_HEAD(&bulk->queued);
+  INIT_LIST_HEAD(&bulk->inflight);
+  INIT_LIST_HEAD(&bulk->done);
+  bulk->on_result = on_result;
+  bulk->on_done = on_done;
+  bulk->context = context;
+  return 0;
+}
+
+void nsdp_bulk_write_uninit(nsdp_bulk_write_t *bulk)
+{
+  nsdp_bulk_write_target_t *target, *next;
+  nsdp_property_t *prop, *next_prop;
+
+  if (!bulk)
+    return;
+
+  // The response callback frees them
+  list_for_each_entry_safe(target, next, &bulk->inflight, list) {
+    list_del_init(&target->list);
+    target->bulk = NULL;
+  }
+
+  list_splice_init(&bulk->queued, &bulk->done);
+  list_for_each_entry_safe(target, next, &bulk->done, list) {
+    list_del(&target->list);
+    free(target);
+  }
+
+  list_for_each_entry_safe(prop, next_prop, &bulk->properties, list)
+    nsdp_property_free(prop);
+
+  bulk->inflight_count = 0;
+  bulk->started = 0;
+}
+
+int nsdp_bulk_write_set_inflight(nsdp_bulk_write_t *bulk,
+                                 unsigned max_inflight)
+{
+  if (!bulk || max_inflight == 0)
+    return -EINVAL;
+  bulk->max_inflight = max_inflight;
+  return 0;
+}
+
+void nsdp_bulk_write_set_confirm(nsdp_bulk_write_t *bulk, int confirm)
+{
+  if (bulk)
+    bulk->confirm = confirm;
+}
+
+void nsdp_bulk_write_set_diff(nsdp_bulk_write_t *bulk, int diff)
+{
+  if (bulk)
+    bulk->diff = diff;
+}
+
+int nsdp_bulk_write_add_property(nsdp_bulk_write_t *bulk,
+                                 nsdp_property_t *prop)
+{
+  if (!bulk || !prop)
+    return -EINVAL;
+  list_add_tail(&prop->list, &bulk->properties);
+  return 0;
+}
+
+static void nsdp_bulk_write_next(nsdp_bulk_write_t *bulk);
+
+static void nsdp_bulk_write_finish(nsdp_bulk_write_target_t *target,
+                                   int err)
+{
+  nsdp_bulk_write_t *bulk = target->bulk;
+
+  target->state = NSDP_BULK_WRITE_DONE;
+  target->err = err;
+  bulk->inflight_count -= 1;
+  bulk->completed += 1;
+  if (err)
+    bulk->failed += 1;
+  list_move_tail(&target->list, &bulk->done);
+
+  if (bulk->on_result)
+    bulk->on_result(bulk, target, bulk->context);
+}
+
+// Check that the device reports the written values, the properties
+// that have several values only need one of them to match
+static int nsdp_bulk_write_check(nsdp_bulk_write_t *bulk,
+                                 const nsdp_packet_t *response)
+{
+  const nsdp_property_t *prop;
+
+  list_for_each_entry(prop, &bulk->properties, list)
+    // The password is write only
+    if (prop->tag != NSDP_PROPERTY_PASSWORD &&
+        !nsdp_packet_find_value(response, prop))
+      return -EIO;
+
+  return 0;
+}
+
+static int nsdp_bulk_write_on_response(nsdp_packet_t *response,
+                                       void *context);
+
+static int nsdp_bulk_write_send(nsdp_bulk_write_target_t *target, int op)
+{
+  nsdp_bulk_write_t *bulk = target->bulk;
+  const nsdp_property_t *prop;
+  nsdp_client_request_t *req;
+  nsdp_property_t *copy;
+  int err;
+
+  req = nsdp_client_request_new(op, target->mac, NULL,
+                                nsdp_bulk_write_on_response, target);
+  if (!req)
+    return -ENOMEM;
+
+  if (op == NSDP_OP_WRITE_REQUEST)
+    target->written = 0;
+  list_for_each_entry(prop, &bulk->properties, list) {
+    if (op == NSDP_OP_READ_REQUEST) {
+      if (prop->tag == NSDP_PROPERTY_PASSWORD)
+        continue;
+      copy = nsdp_property_new(prop->tag, 0);
+    } else
+      copy = nsdp_property_from_data(prop->tag, prop->length, prop->data);
+    if (!copy) {
+      nsdp_client_request_free(req);
+      return -ENOMEM;
+    }
+    nsdp_packet_add_property(&req->packet, copy);
+    if (op == NSDP_OP_WRITE_REQUEST && prop->tag != NSDP_PROPERTY_PASSWORD)
+      target->written += 1;
+  }
+  nsdp_packet_add_properties_terminator(&req->packet);
+
+  err = nsdp_client_add_request(bulk->client, req);
+  if (err)
+    nsdp_client_request_free(req);
+  return err;
+}
+
+static int nsdp_bulk_write_on_response(nsdp_packet_t *response,
+                                       void *context)
+{
+  nsdp_bulk_write_target_t *target = context;
+  nsdp_bulk_write_t *bulk = target->bulk;
+  int err;
+
+  // The bulk write was freed
+  if (!bulk) {
+    free(target);
+    return 1;
+  }
+
+  // The devices that refuse a write, or the password, say so in the
+  // result code of their response
+  err = response ? nsdp_packet_result_error(response) : -ETIMEDOUT;
+  if (!err && target->state == NSDP_BULK_WRITE_CONFIRMING)
+    err = nsdp_bulk_write_check(bulk, response);
+  else if (!err && bulk->confirm) {
+    target->state = NSDP_BULK_WRITE_CONFIRMING;
+    err = nsdp_bulk_write_send(target, NSDP_OP_READ_REQUEST);
+    if (!err)
+      return 1;
+  }
+
+  nsdp_bulk_write_finish(target, err);
+  nsdp_bulk_write_next(bulk);
+  return 1;
+}
+
+static void nsdp_bulk_write_on_apply(nsdp_client_t *client,
+                                     const nsdp_mac_t mac, int err,
+                                     unsigned written, void *context)
+{
+  nsdp_bulk_write_target_t *target = context;
+  nsdp_bulk_write_t *bulk = target->bulk;
+
+  if (!bulk) {
+    free(target);
+    return;
+  }
+
+  target->written = written;
+  // Nothing to confirm when the read already matched
+  if (!err && written > 0 && bulk->confirm) {
+    target->state = NSDP_BULK_WRITE_CONFIRMING;
+    err = nsdp_bulk_write_send(target, NSDP_OP_READ_REQUEST);
+    if (!err)
+      return;
+  }
+
+  nsdp_bulk_write_finish(target, err);
+  nsdp_bulk_write_next(bulk);
+}
+
+// Start the queued devices while there is room, and report the end
+static void nsdp_bulk_write_next(nsdp_bulk_write_t *bulk)
+{
+  nsdp_bulk_write_target_t *target;
+  int err;
+
+  if (!bulk->started)
+    return;
+
+  while (!list_empty(&bulk->queued) &&
+         bulk->inflight_count < bulk->max_inflight) {
+    target = list_first_entry(&bulk->queued, nsdp_bulk_write_target_t, list);
+    list_move_tail(&target->list, &bulk->inflight);
+    bulk->inflight_count += 1;
+
+    target->state = NSDP_BULK_WRITE_WRITING;
+    if (bulk->diff)
+      err = nsdp_client_apply(bulk->client, target->mac, &bulk->properties,
+                              nsdp_bulk_write_on_apply, target);
+    else
+      err = nsdp_bulk_write_send(target, NSDP_OP_WRITE_REQUEST);
+    if (err)
+      nsdp_bulk_write_finish(target, err);
+  }
+
+  if (list_empty(&bulk->queued) && bulk->inflight_count == 0) {
+    bulk->started = 0;
+    if (bulk->on_done)
+      bulk->on_done(bulk, bulk->context);
+  }
+}
+
+int nsdp_bulk_write_add_device(nsdp_bulk_write_t *bulk,
+                               const nsdp_mac_t mac)
+{
+  nsdp_bulk_write_target_t *target;
+
+  if (!bulk || !mac)
+    return -EINVAL;
+
+  target = calloc(1, sizeof(*target));
+  if (!target)
+    return -ENOMEM;
+
+  target->bulk = bulk;
+  memcpy(target->mac, mac, sizeof(nsdp_mac_t));
+  list_add_tail(&target->list, &bulk->queued);
+  bulk->total += 1;
+
+  nsdp_bulk_write_next(bulk);
+  return 0;
+}
+
+int nsdp_bulk_write_start(nsdp_bulk_write_t *bulk)
+{
+  if (!bulk || list_empty(&bulk->properties))
+    return -EINVAL;
+
+  bulk->started = 1;
+  nsdp_bulk_write_next(bulk);
+  return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef NSDP_BULK_WRITE_H
+#define NSDP_BULK_WRITE_H
+
+#include "nsdp_client.h"
+
+// Writes in flight at once by default
+#define NSDP_BULK_WRITE_DEFAULT_INFLIGHT	32
+
+#define NSDP_BULK_WRITE_QUEUED		0
+#define NSDP_BULK_WRITE_WRITING		1
+#define NSDP_BULK_WRITE_CONFIRMING	2
+#define NSDP_BULK_WRITE_DONE		3
+
+struct nsdp_bulk_write;
+
+// A device to write, err is 0 on success, -ETIMEDOUT if the device
+// didn't answer and -EIO if the confirm read gave other values
+typedef struct nsdp_bulk_write_target {
+  struct list_head			list;
+  struct nsdp_bulk_write		*bulk;
+  nsdp_mac_t				mac;
+  int					state;
+  int					err;
+  // Properties written, the password excluded
+  unsigned				written;
+} nsdp_bulk_write_target_t;
+
+typedef void (*nsdp_bulk_write_on_result_f)(
+  struct nsdp_bulk_write *bulk, const nsdp_bulk_write_target_t *target,
+  void *context);
+
+typedef void (*nsdp_bulk_write_on_done_f)(struct nsdp_bulk_write *bulk,
+                                          void *context);
+
+// Write the same properties to a list of devices, with a bounded
+// number of devices in flight. The client is bound to one interface,
+// so the bound applies to each interface with one bulk write per
+// client.
+typedef struct nsdp_bulk_write {
+  nsdp_client_t				*client;
+  // Properties written to every device
+  struct list_head			properties;
+  // Re-read the properties after the write
+  int					confirm;
+  // Only write the properties that differ from the current values
+  int					diff;
+  unsigned				max_inflight;
+  int					started;
+
+  struct list_head			queued;
+  struct list_head			inflight;
+  unsigned				inflight_count;
+  struct list_head			done;
+
+  // Progress
+  unsigned				total;
+  unsigned				completed;
+  unsigned				failed;
+
+  nsdp_bulk_write_on_result_f		on_result;
+  nsdp_bulk_write_on_done_f		on_done;
+  void					*context;
+} nsdp_bulk_write_t;
+
+int nsdp_bulk_write_init(nsdp_bulk_write_t *bulk, nsdp_client_t *client,
+                         nsdp_bulk_write_on_result_f on_result,
+                         nsdp_bulk_write_on_done_f on_done, void *context);
+
+// Free the bulk write, the writes in flight are still completed but
+// not reported anymore
+void nsdp_bulk_write_uninit(nsdp_bulk_write_t *bulk);
+
+// Set the number of devices written at the same time
+int nsdp_bulk_write_set_inflight(nsdp_bulk_write_t *bulk,
+                                 unsigned max_inflight);
+
+// Re-read the written properties to check them
+void nsdp_bulk_write_set_confirm(nsdp_bulk_write_t *bulk, int confirm);
+
+// Read the devices first and only write the properties that differ,
+// the devices that already have the values get no write
+void nsdp_bulk_write_set_diff(nsdp_bulk_write_t *bulk, int diff);
+
+// Add a property to write, the bulk write takes ownership of it
+int nsdp_bulk_write_add_property(nsdp_bulk_write_t *bulk,
+                                 nsdp_property_t *prop);
+
+// Add a device to write, it can be added while the writes are running
+int nsdp_bulk_write_add_device(nsdp_bulk_write_t *bulk,
+                               const nsdp_mac_t mac);
+
+// Start the writes, on_done is called once all the devices are done
+int nsdp_bulk_write_start(nsdp_bulk_write_t *bulk);
+
+#endif /* NSDP_BULK_WRITE_H */
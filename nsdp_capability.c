@@ -0,0 +1,589 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_capability.h"
+
+// Someone waiting for the end of a probe
+typedef struct nsdp_capability_waiter {
+  struct list_head			list;
+  nsdp_capability_on_done_f		on_done;
+  void					*context;
+} nsdp_capability_waiter_t;
+
+// Read of the model and firmware of a device missing from the inventory
+typedef struct nsdp_capability_identify {
+  struct list_head			list;
+  // NULL once the cache is gone, the answer frees it
+  struct nsdp_capability_cache		*cache;
+  nsdp_mac_t				mac;
+} nsdp_capability_identify_t;
+
+// Blocks of tags probed, in increasing order: size tags are read from
+// the start of each block, from first to last. The snapshots save the
+// supported tags, bump NSDP_SNAPSHOT_VERSION when they change.
+static const struct nsdp_capability_range {
+  nsdp_tag_t				first;
+  nsdp_tag_t				last;
+  nsdp_tag_t				step;
+  nsdp_tag_t				size;
+} nsdp_capability_ranges[] = {
+  // Device information
+  { 0x0001, 0x0001, 0x0001, 0x0014 },
+  // Port and switch features
+  { 0x0400, 0x9000, 0x0400, NSDP_CAPABILITY_BLOCK_TAGS },
+};
+
+static void nsdp_capability_filter(nsdp_client_t *client,
+                                   nsdp_client_request_t *req,
+                                   void *context);
+
+int nsdp_capability_cache_init(nsdp_capability_cache_t *cache,
+                               nsdp_client_t *client,
+                               nsdp_inventory_t *inventory)
+{
+  const struct nsdp_capability_range *range;
+  unsigned i, block, tag;
+
+  if (!cache || !client || !inventory)
+    return -EINVAL;
+
+  memset(cache, 0, sizeof(*cache));
+  cache->client = client;
+  cache->inventory = inventory;
+  for (i = 0 ; i < NSDP_CAPABILITY_HASH_SIZE ; i += 1)
+    INIT_HLIST_HEAD(&cache->hash[i]);
+  INIT_LIST_HEAD(&cache->identifying);
+
+  for (i = 0 ; i < ARRAY_SIZE(nsdp_capability_ranges) ; i += 1) {
+    range = &nsdp_capability_ranges[i];
+    for (block = range->first ; block <= range->last ; block += range->step)
+      for (tag = block ; tag < block + range->size ; tag += 1) {
+        // Never ask for the password
+        if (tag == NSDP_PROPERTY_PASSWORD)
+          continue;
+        if (cache->candidate_count >= NSDP_CAPABILITY_MAX_CANDIDATES)
+          return -E2BIG;
+        cache->candidate[cache->candidate_count++] = tag;
+      }
+  }
+
+  nsdp_client_set_request_filter(client, nsdp_capability_filter, cache);
+  return 0;
+}
+
+static void nsdp_capability_notify(nsdp_capability_t *cap, int err)
+{
+  nsdp_capability_waiter_t *waiter;
+  LIST_HEAD(waiters);
+
+  // The callbacks can add new waiters
+  list_splice_init(&cap->waiters, &waiters);
+  while (!list_empty(&waiters)) {
+    waiter = list_first_entry(&waiters, nsdp_capability_waiter_t, list);
+    list_del(&waiter->list);
+    if (waiter->on_done)
+      waiter->on_done(cap->cache, cap, err, waiter->context);
+    free(waiter);
+  }
+}
+
+static void nsdp_capability_free(nsdp_capability_t *cap)
+{
+  nsdp_capability_cache_t *cache = cap->cache;
+
+  hlist_del(&cap->hash);
+  nsdp_capability_notify(cap, -ECANCELED);
+  nsdp_intern_put(cache->inventory->strings, cap->model);
+  nsdp_intern_put(cache->inventory->strings, cap->firmware);
+  cap->model = cap->firmware = NULL;
+
+  // The probe callback frees it
+  if (cap->pending)
+    cap->removed = 1;
+  else
+    free(cap);
+}
+
+void nsdp_capability_cache_uninit(nsdp_capability_cache_t *cache)
+{
+  nsdp_capability_identify_t *identify, *next;
+  unsigned i;
+
+  if (!cache)
+    return;
+
+  if (cache->client &&
+      cache->client->request_filter == nsdp_capability_filter &&
+      cache->client->request_filter_context == cache)
+    nsdp_client_set_request_filter(cache->client, NULL, NULL);
+
+  // The answers free them
+  list_for_each_entry_safe(identify, next, &cache->identifying, list) {
+    list_del_init(&identify->list);
+    identify->cache = NULL;
+  }
+
+  for (i = 0 ; i < NSDP_CAPABILITY_HASH_SIZE ; i += 1)
+    while (!hlist_empty(&cache->hash[i]))
+      nsdp_capability_free(hlist_entry(cache->hash[i].first,
+                                       nsdp_capability_t, hash));
+}
+
+static unsigned nsdp_capability_hash(const char *model, const char *firmware)
+{
+  uintptr_t hash = (uintptr_t)model * 31 + (uintptr_t)firmware;
+
+  // The handles are at least 8 bytes aligned
+  return (hash >> 3) % NSDP_CAPABILITY_HASH_SIZE;
+}
+
+static nsdp_capability_t *nsdp_capability_lookup(
+  nsdp_capability_cache_t *cache, const char *model, const char *firmware)
+{
+  unsigned hash = nsdp_capability_hash(model, firmware);
+  nsdp_capability_t *cap;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(cap, pos, &cache->hash[hash], hash)
+    if (cap->model == model && cap->firmware == firmware)
+      return cap;
+
+  return NULL;
+}
+
+nsdp_capability_t *nsdp_capability_find(nsdp_capability_cache_t *cache,
+                                        const nsdp_device_t *device)
+{
+  const char *model;
+
+  if (!cache || !device)
+    return NULL;
+
+  model = nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL);
+  if (!model)
+    return NULL;
+
+  return nsdp_capability_lookup(cache, model,
+                                nsdp_device_get_index(
+                                  device, NSDP_INVENTORY_INDEX_FIRMWARE));
+}
+
+nsdp_capability_t *nsdp_capability_find_model(nsdp_capability_cache_t *cache,
+                                              const char *model,
+                                              const char *firmware)
+{
+  nsdp_intern_pool_t *strings;
+
+  if (!cache || !model)
+    return NULL;
+
+  // The pool has no handle for a value no capability uses
+  strings = cache->inventory->strings;
+  model = nsdp_intern_lookup(strings, model, strlen(model));
+  if (!model)
+    return NULL;
+  if (firmware) {
+    firmware = nsdp_intern_lookup(strings, firmware, strlen(firmware));
+    if (!firmware)
+      return NULL;
+  }
+
+  return nsdp_capability_lookup(cache, model, firmware);
+}
+
+static nsdp_capability_t *nsdp_capability_get(nsdp_capability_cache_t *cache,
+                                              const nsdp_device_t *device)
+{
+  nsdp_capability_t *cap;
+  const char *model, *firmware;
+
+  cap = nsdp_capability_find(cache, device);
+  if (cap)
+    return cap;
+
+  model = nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL);
+  if (!model)
+    return NULL;
+  firmware = nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_FIRMWARE);
+
+  cap = calloc(1, sizeof(*cap));
+  if (!cap)
+    return NULL;
+
+  cap->cache = cache;
+  cap->model = nsdp_intern_ref(model);
+  cap->firmware = nsdp_intern_ref(firmware);
+  INIT_LIST_HEAD(&cap->waiters);
+  hlist_add_head(&cap->hash,
+                 &cache->hash[nsdp_capability_hash(model, firmware)]);
+  return cap;
+}
+
+// Index of a tag in the candidates, or -1
+static int nsdp_capability_candidate(const nsdp_capability_cache_t *cache,
+                                     nsdp_tag_t tag)
+{
+  unsigned low = 0, high = cache->candidate_count, mid;
+
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (cache->candidate[mid] == tag)
+      return mid;
+    if (cache->candidate[mid] < tag)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return -1;
+}
+
+int nsdp_capability_supports(const nsdp_capability_cache_t *cache,
+                             const nsdp_capability_t *cap, nsdp_tag_t tag)
+{
+  int i;
+
+  if (!cache || !cap || cap->state != NSDP_CAPABILITY_KNOWN)
+    return 1;
+
+  i = nsdp_capability_candidate(cache, tag);
+  if (i < 0)
+    return 1;
+
+  return !!(cap->supported[i / 64] & (1ull << (i % 64)));
+}
+
+int nsdp_capability_get_supported(const nsdp_capability_cache_t *cache,
+                                  const nsdp_capability_t *cap,
+                                  nsdp_tag_t *tags, unsigned size)
+{
+  unsigned i, count = 0;
+
+  if (!cache || !cap)
+    return -EINVAL;
+  if (cap->state != NSDP_CAPABILITY_KNOWN)
+    return -ENOENT;
+
+  for (i = 0 ; i < cache->candidate_count ; i += 1) {
+    if (!(cap->supported[i / 64] & (1ull << (i % 64))))
+      continue;
+    if (count >= size)
+      return -E2BIG;
+    tags[count++] = cache->candidate[i];
+  }
+
+  return count;
+}
+
+int nsdp_capability_set_supported(nsdp_capability_cache_t *cache,
+                                  const nsdp_device_t *device,
+                                  const nsdp_tag_t *tags, unsigned count)
+{
+  nsdp_capability_t *cap;
+  unsigned i;
+  int j;
+
+  if (!cache || !device || (count && !tags))
+    return -EINVAL;
+
+  if (!nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL))
+    return -ENOENT;
+
+  cap = nsdp_capability_get(cache, device);
+  if (!cap)
+    return -ENOMEM;
+  if (cap->state == NSDP_CAPABILITY_PROBING)
+    return -EBUSY;
+
+  memset(cap->supported, 0, sizeof(cap->supported));
+  for (i = 0 ; i < count ; i += 1) {
+    j = nsdp_capability_candidate(cache, tags[i]);
+    if (j >= 0)
+      cap->supported[j / 64] |= 1ull << (j % 64);
+  }
+
+  cap->state = NSDP_CAPABILITY_KNOWN;
+  cache->generation += 1;
+  nsdp_capability_notify(cap, 0);
+  return 0;
+}
+
+static int nsdp_capability_on_probe_response(nsdp_packet_t *response,
+                                             void *context)
+{
+  nsdp_capability_t *cap = context;
+  const nsdp_property_t *prop;
+  int i;
+
+  if (!response)
+    cap->failed = 1;
+  else if (!cap->removed)
+    // Unsupported tags are answered without a value
+    list_for_each_entry(prop, &response->properties, list) {
+      if (prop->length == 0)
+        continue;
+      i = nsdp_capability_candidate(cap->cache, prop->tag);
+      if (i >= 0)
+        cap->supported[i / 64] |= 1ull << (i % 64);
+    }
+
+  cap->pending -= 1;
+  if (cap->pending)
+    return 1;
+
+  if (cap->removed) {
+    free(cap);
+    return 1;
+  }
+
+  if (cap->failed) {
+    cap->state = NSDP_CAPABILITY_UNKNOWN;
+    cap->retry_after = time(NULL) + NSDP_CAPABILITY_RETRY_DELAY;
+    nsdp_capability_notify(cap, -ETIMEDOUT);
+  } else {
+    cap->state = NSDP_CAPABILITY_KNOWN;
+    cap->cache->generation += 1;
+    nsdp_capability_notify(cap, 0);
+  }
+
+  return 1;
+}
+
+// Read a batch of candidates from the device
+static int nsdp_capability_send_probe(nsdp_capability_t *cap,
+                                      const nsdp_device_t *device,
+                                      unsigned first, unsigned count)
+{
+  nsdp_capability_cache_t *cache = cap->cache;
+  nsdp_client_request_t *req;
+  nsdp_property_t *prop;
+  unsigned i;
+  int err;
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST,
+                                (uint8_t*)device->mac, NULL,
+                                nsdp_capability_on_probe_response, cap);
+  if (!req)
+    return -ENOMEM;
+  req->priority = NSDP_CLIENT_PRIORITY_BULK;
+
+  for (i = first ; i < first + count ; i += 1) {
+    prop = nsdp_property_new(cache->candidate[i], 0);
+    if (!prop) {
+      nsdp_client_request_free(req);
+      return -ENOMEM;
+    }
+    nsdp_packet_add_property(&req->packet, prop);
+  }
+  nsdp_packet_add_properties_terminator(&req->packet);
+
+  err = nsdp_client_add_request(cache->client, req);
+  if (err)
+    nsdp_client_request_free(req);
+  return err;
+}
+
+static int nsdp_capability_start_probe(nsdp_capability_t *cap,
+                                       const nsdp_device_t *device)
+{
+  nsdp_capability_cache_t *cache = cap->cache;
+  unsigned i, count;
+  int err = 0;
+
+  memset(cap->supported, 0, sizeof(cap->supported));
+  cap->state = NSDP_CAPABILITY_PROBING;
+  cap->failed = 0;
+
+  // Count the probe being sent so a quick answer doesn't end it early
+  cap->pending = 1;
+  for (i = 0 ; i < cache->candidate_count && !err ; i += count) {
+    count = cache->candidate_count - i;
+    if (count > NSDP_CAPABILITY_PROBE_BATCH)
+      count = NSDP_CAPABILITY_PROBE_BATCH;
+
+    cap->pending += 1;
+    err = nsdp_capability_send_probe(cap, device, i, count);
+    if (err)
+      cap->pending -= 1;
+  }
+
+  // Sent probes end the probe as a failure when they are done
+  if (err && cap->pending > 1) {
+    cap->failed = 1;
+    cap->pending -= 1;
+    return 0;
+  }
+
+  cap->pending -= 1;
+  if (err) {
+    cap->state = NSDP_CAPABILITY_UNKNOWN;
+    cap->retry_after = time(NULL) + NSDP_CAPABILITY_RETRY_DELAY;
+    nsdp_capability_notify(cap, err);
+  }
+
+  return err;
+}
+
+int nsdp_capability_probe(nsdp_capability_cache_t *cache,
+                          const nsdp_device_t *device,
+                          nsdp_capability_on_done_f on_done,
+                          void *context)
+{
+  nsdp_capability_waiter_t *waiter;
+  nsdp_capability_t *cap;
+
+  if (!cache || !device)
+    return -EINVAL;
+
+  if (!nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL))
+    return -ENOENT;
+
+  cap = nsdp_capability_get(cache, device);
+  if (!cap)
+    return -ENOMEM;
+
+  if (cap->state == NSDP_CAPABILITY_KNOWN) {
+    if (on_done)
+      on_done(cache, cap, 0, context);
+    return 0;
+  }
+
+  if (on_done) {
+    waiter = calloc(1, sizeof(*waiter));
+    if (!waiter)
+      return -ENOMEM;
+    waiter->on_done = on_done;
+    waiter->context = context;
+    list_add_tail(&waiter->list, &cap->waiters);
+  }
+
+  if (cap->state == NSDP_CAPABILITY_PROBING)
+    return 0;
+
+  return nsdp_capability_start_probe(cap, device);
+}
+
+static int nsdp_capability_on_identify(nsdp_packet_t *response,
+                                       void *context)
+{
+  nsdp_capability_identify_t *identify = context;
+  nsdp_capability_cache_t *cache = identify->cache;
+  nsdp_device_t *device;
+
+  if (cache) {
+    list_del(&identify->list);
+    if (response && !nsdp_packet_result_error(response) &&
+        nsdp_inventory_update_iface(cache->inventory, response,
+                                    cache->client->iface) >= 0) {
+      device = nsdp_inventory_find(cache->inventory, identify->mac);
+      if (device && !nsdp_capability_find(cache, device))
+        nsdp_capability_probe(cache, device, NULL, NULL);
+    }
+  }
+
+  free(identify);
+  return 1;
+}
+
+// Read the model and firmware of a device, its model is probed once
+// they are known
+static int nsdp_capability_identify(nsdp_capability_cache_t *cache,
+                                    const nsdp_mac_t mac)
+{
+  static const nsdp_tag_t tags[] = {
+    NSDP_PROPERTY_MODEL,
+    NSDP_PROPERTY_FIRMWARE_VERSION,
+    NSDP_PROPERTY_TERMINATOR,
+  };
+  nsdp_capability_identify_t *identify;
+  nsdp_client_request_t *req;
+  nsdp_property_t *prop;
+  unsigned i;
+  int err;
+
+  list_for_each_entry(identify, &cache->identifying, list)
+    if (!memcmp(identify->mac, mac, sizeof(nsdp_mac_t)))
+      return 0;
+
+  identify = calloc(1, sizeof(*identify));
+  if (!identify)
+    return -ENOMEM;
+  identify->cache = cache;
+  memcpy(identify->mac, mac, sizeof(nsdp_mac_t));
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, identify->mac, NULL,
+                                nsdp_capability_on_identify, identify);
+  if (!req) {
+    free(identify);
+    return -ENOMEM;
+  }
+  req->priority = NSDP_CLIENT_PRIORITY_BULK;
+
+  for (i = 0 ; i < ARRAY_SIZE(tags) ; i += 1) {
+    prop = nsdp_property_new(tags[i], 0);
+    if (!prop) {
+      nsdp_client_request_free(req);
+      free(identify);
+      return -ENOMEM;
+    }
+    nsdp_packet_add_property(&req->packet, prop);
+  }
+
+  list_add_tail(&identify->list, &cache->identifying);
+  err = nsdp_client_add_request(cache->client, req);
+  if (err) {
+    list_del(&identify->list);
+    nsdp_client_request_free(req);
+    free(identify);
+  }
+  return err;
+}
+
+static void nsdp_capability_filter(nsdp_client_t *client,
+                                   nsdp_client_request_t *req,
+                                   void *context)
+{
+  nsdp_capability_cache_t *cache = context;
+  nsdp_property_t *prop, *next;
+  nsdp_mac_t zero_mac = {};
+  nsdp_capability_t *cap;
+  nsdp_device_t *device;
+  unsigned kept = 0;
+
+  if (req->packet.op != NSDP_OP_READ_REQUEST ||
+      req->on_response == nsdp_capability_on_identify ||
+      !memcmp(req->packet.server_mac, zero_mac, sizeof(nsdp_mac_t)))
+    return;
+
+  // Learn the model in the background, this read goes out as is
+  device = nsdp_inventory_find(cache->inventory, req->packet.server_mac);
+  if (!device ||
+      !nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL)) {
+    nsdp_capability_identify(cache, req->packet.server_mac);
+    return;
+  }
+
+  cap = nsdp_capability_find(cache, device);
+  if (!cap || cap->state == NSDP_CAPABILITY_UNKNOWN) {
+    if (!cap || cap->retry_after <= time(NULL))
+      nsdp_capability_probe(cache, device, NULL, NULL);
+    return;
+  }
+
+  if (cap->state != NSDP_CAPABILITY_KNOWN)
+    return;
+
+  list_for_each_entry(prop, &req->packet.properties, list)
+    if (prop->tag != NSDP_PROPERTY_TERMINATOR &&
+        nsdp_capability_supports(cache, cap, prop->tag))
+      kept += 1;
+
+  // Let the device answer a read of only unsupported tags
+  if (kept == 0)
+    return;
+
+  list_for_each_entry_safe(prop, next, &req->packet.properties, list)
+    if (!nsdp_capability_supports(cache, cap, prop->tag))
+      nsdp_property_free(prop);
+}
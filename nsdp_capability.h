@@ -0,0 +1,106 @@
+#ifndef NSDP_CAPABILITY_H
+#define NSDP_CAPABILITY_H
+
+#include "nsdp_client.h"
+
+#define NSDP_CAPABILITY_HASH_SIZE	64
+#define NSDP_CAPABILITY_MAX_CANDIDATES	1024
+// Tags probed at the start of each feature block
+#define NSDP_CAPABILITY_BLOCK_TAGS	16
+// Tags read by each probe request
+#define NSDP_CAPABILITY_PROBE_BATCH	32
+// Seconds before probing again a model whose probe failed
+#define NSDP_CAPABILITY_RETRY_DELAY	60
+
+#define NSDP_CAPABILITY_UNKNOWN		0
+#define NSDP_CAPABILITY_PROBING		1
+#define NSDP_CAPABILITY_KNOWN		2
+
+struct nsdp_capability_cache;
+struct nsdp_capability;
+
+typedef void (*nsdp_capability_on_done_f)(
+  struct nsdp_capability_cache *cache, struct nsdp_capability *cap,
+  int err, void *context);
+
+// Tags supported by a model with a given firmware
+typedef struct nsdp_capability {
+  struct hlist_node			hash;
+  struct nsdp_capability_cache		*cache;
+  // Interned in the inventory string pool
+  const char				*model;
+  const char				*firmware;
+  int					state;
+  // Probe requests in flight and if one of them timed out
+  unsigned				pending;
+  int					failed;
+  // Dropped from the cache, freed by the last probe answer
+  int					removed;
+  time_t				retry_after;
+  // One bit per candidate tag of the cache
+  uint64_t				supported[NSDP_CAPABILITY_MAX_CANDIDATES
+                                                  / 64];
+  struct list_head			waiters;
+} nsdp_capability_t;
+
+// Cache of the capabilities of the models found in an inventory. Once
+// set on a client the reads for a known model only ask for the tags
+// it supports, and the reads for a new model start probing it. The
+// reads for a device missing from the inventory first read its model
+// and firmware in the background.
+typedef struct nsdp_capability_cache {
+  nsdp_client_t				*client;
+  nsdp_inventory_t			*inventory;
+  struct hlist_head			hash[NSDP_CAPABILITY_HASH_SIZE];
+  // Reads of the model of the unknown devices in flight
+  struct list_head			identifying;
+  // Tags probed on every model
+  nsdp_tag_t				candidate[NSDP_CAPABILITY_MAX_CANDIDATES];
+  unsigned				candidate_count;
+  // Bumped each time the tags of a model get known
+  unsigned				generation;
+} nsdp_capability_cache_t;
+
+// Init the cache and install it as the request filter of the client.
+// The client doesn't filter its requests by default, the programs opt
+// in by setting up a cache.
+int nsdp_capability_cache_init(nsdp_capability_cache_t *cache,
+                               nsdp_client_t *client,
+                               nsdp_inventory_t *inventory);
+
+void nsdp_capability_cache_uninit(nsdp_capability_cache_t *cache);
+
+// Find the capabilities of a device model, NULL if it was never probed
+nsdp_capability_t *nsdp_capability_find(nsdp_capability_cache_t *cache,
+                                        const nsdp_device_t *device);
+
+// Same with the model and firmware strings, from any pool
+nsdp_capability_t *nsdp_capability_find_model(nsdp_capability_cache_t *cache,
+                                              const char *model,
+                                              const char *firmware);
+
+// Copy the tags supported by a known model, return their count,
+// -ENOENT if the model is not known yet or -E2BIG if size is too small
+int nsdp_capability_get_supported(const nsdp_capability_cache_t *cache,
+                                  const nsdp_capability_t *cap,
+                                  nsdp_tag_t *tags, unsigned size);
+
+// Set the tags supported by the model of a device of the cache
+// inventory, as saved by nsdp_capability_get_supported(). Return
+// -EBUSY if the model is being probed.
+int nsdp_capability_set_supported(nsdp_capability_cache_t *cache,
+                                  const nsdp_device_t *device,
+                                  const nsdp_tag_t *tags, unsigned count);
+
+// Probe the tags supported by the model of a device, on_done is called
+// right away if they are already known
+int nsdp_capability_probe(nsdp_capability_cache_t *cache,
+                          const nsdp_device_t *device,
+                          nsdp_capability_on_done_f on_done,
+                          void *context);
+
+// Check if a tag is supported, the tags that are not probed always are
+int nsdp_capability_supports(const nsdp_capability_cache_t *cache,
+                             const nsdp_capability_t *cap, nsdp_tag_t tag);
+
+#endif /* NSDP_CAPABILITY_H */
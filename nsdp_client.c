@@ -7,41 +7,7 @@
 #include <time.h>
 #include <event.h>
 
-#include "nsdp_socket.h"
-#include "nsdp_packet.h"
-
-typedef int (*nsdp_client_on_response_f)(nsdp_packet_t *response,
-                                         void *context);
-
-typedef struct nsdp_client_request {
-  struct list_head			list;
-  unsigned				timeout;
-  unsigned				retry_count;
-  unsigned				send_count;
-  nsdp_socket_addr_t			in_addr;
-  nsdp_packet_t				packet;
-
-  nsdp_client_on_response_f		on_response;
-  void					*context;
-} nsdp_client_request_t;
-
-typedef struct nsdp_client {
-  struct event_base			*ev_base;
-
-  nsdp_socket_t				socket;
-  nsdp_mac_t				mac;
-
-  unsigned				client_port;
-  unsigned				server_port;
-
-  nsdp_seq_no_t				seq_no;
-
-  struct event				*recv_event;
-  struct event				*request_timeout_event;
-
-  struct list_head			request;
-} nsdp_client_t;
-
+#include "nsdp_client.h"
 
 nsdp_client_request_t*
 nsdp_client_request_new(nsdp_op_t op, nsdp_mac_t server_mac,
@@ -51,173 +17,1460 @@ nsdp_client_request_new(nsdp_op_t op, nsdp_mac_t server_mac,
 {
   nsdp_client_request_t* req;
 
-  if (!on_response)
-    return NULL;
-
   req = calloc(1, sizeof(*req));
   if (!req)
     return NULL;
 
   INIT_LIST_HEAD(&req->list);
+  INIT_LIST_HEAD(&req->batch);
+  INIT_HLIST_NODE(&req->id_hash);
   req->timeout = 5;
   req->retry_count = 3;
+  req->priority = op == NSDP_OP_WRITE_REQUEST ?
+    NSDP_CLIENT_PRIORITY_WRITE : NSDP_CLIENT_PRIORITY_INTERACTIVE;
   if (in_addr)
     memcpy(&req->in_addr, in_addr, sizeof(*in_addr));
   else {
     nsdp_socket_addr_set_broadcast(&req->in_addr);
     nsdp_socket_addr_set_port(&req->in_addr, 63322);
+    req->auto_addr = 1;
   }
 
   nsdp_packet_init(&req->packet);
+  nsdp_packet_init(&req->response);
   req->packet.op = op;
   memcpy(req->packet.server_mac, server_mac, sizeof(nsdp_mac_t));
   req->on_response = on_response;
   req->context = context;
 
-  return req;
-}
+  return req;
+}
+
+void nsdp_client_request_free(nsdp_client_request_t* req)
+{
+  if (!req)
+    return;
+  list_del(&req->list);
+  hlist_del_init(&req->id_hash);
+  if (req->client)
+    evtimer_del(&req->timeout_event);
+  nsdp_packet_uninit(&req->packet);
+  nsdp_packet_uninit(&req->response);
+  free(req->chunk);
+  free(req->sent);
+  free(req);
+}
+
+void nsdp_client_request_set_deadline(nsdp_client_request_t* req,
+                                      const struct timeval *deadline)
+{
+  if (!req)
+    return;
+  req->has_deadline = deadline != NULL;
+  if (deadline)
+    req->deadline = *deadline;
+}
+
+// Prepare a request to be sent again
+static void nsdp_client_request_reset(nsdp_client_request_t* req)
+{
+  unsigned i;
+
+  req->send_count = 0;
+  req->sent_count = 0;
+  for (i = 0 ; i < req->chunk_count ; i += 1)
+    req->chunk[i].done = 0;
+  req->chunk_pending = req->chunk_count;
+  nsdp_packet_uninit(&req->response);
+  req->response.result = 0;
+}
+
+static nsdp_seq_no_t nsdp_client_next_seq_no(nsdp_client_t *client,
+                                             nsdp_client_request_t* req)
+{
+  nsdp_seq_no_t seq_no = client->seq_no++;
+
+  // Skip the seq no still used by slow requests
+  while (client->seq_owner[seq_no])
+    seq_no = client->seq_no++;
+
+  client->retired[seq_no / 8] &= ~(1 << (seq_no % 8));
+  client->seq_owner[seq_no] = req;
+  return seq_no;
+}
+
+static int nsdp_client_seq_no_retired(const nsdp_client_t *client,
+                                      nsdp_seq_no_t seq_no)
+{
+  return client->retired[seq_no / 8] & (1 << (seq_no % 8));
+}
+
+// Mark all the seq no used by a request as done
+static void nsdp_client_request_retire(nsdp_client_t *client,
+                                       nsdp_client_request_t* req)
+{
+  unsigned i;
+
+  for (i = 0 ; i < req->sent_count ; i += 1) {
+    nsdp_seq_no_t seq_no = req->sent[i].seq_no;
+    client->retired[seq_no / 8] |= 1 << (seq_no % 8);
+    if (client->seq_owner[seq_no] == req)
+      client->seq_owner[seq_no] = NULL;
+  }
+}
+
+static nsdp_client_send_t* nsdp_client_request_find_send(
+  nsdp_client_request_t* req, nsdp_seq_no_t seq_no)
+{
+  unsigned i;
+
+  for (i = 0 ; i < req->sent_count ; i += 1)
+    if (req->sent[i].seq_no == seq_no)
+      return &req->sent[i];
+
+  return NULL;
+}
+
+static int nsdp_client_request_add_send(nsdp_client_request_t* req,
+                                        nsdp_seq_no_t seq_no,
+                                        unsigned chunk)
+{
+  nsdp_client_send_t *send;
+
+  if (req->sent_count >= req->sent_size) {
+    unsigned size = req->sent_size ? req->sent_size * 2 : 4;
+    nsdp_client_send_t *sent = realloc(req->sent, size * sizeof(*sent));
+    if (!sent)
+      return -ENOMEM;
+    req->sent = sent;
+    req->sent_size = size;
+  }
+
+  send = &req->sent[req->sent_count++];
+  send->seq_no = seq_no;
+  send->chunk = chunk;
+  send->attempt = req->send_count;
+  return 0;
+}
+
+static nsdp_client_device_t* nsdp_client_get_device(nsdp_client_t *client,
+                                                    const nsdp_mac_t mac)
+{
+  struct hlist_head *head =
+    &client->device[nsdp_mac_hash(mac) % NSDP_CLIENT_DEVICE_HASH_SIZE];
+  nsdp_client_device_t *dev;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(dev, pos, head, hash)
+    if (!memcmp(dev->mac, mac, sizeof(nsdp_mac_t)))
+      return dev;
+
+  dev = calloc(1, sizeof(*dev));
+  if (!dev)
+    return NULL;
+
+  memcpy(dev->mac, mac, sizeof(nsdp_mac_t));
+  dev->window = NSDP_CLIENT_INITIAL_WINDOW;
+  hlist_add_head(&dev->hash, head);
+  return dev;
+}
+
+static const nsdp_property_t nsdp_client_terminator = {
+  .tag = NSDP_PROPERTY_TERMINATOR,
+};
+
+// Size of the request properties, without the terminator
+static int nsdp_client_request_payload(nsdp_client_request_t* req)
+{
+  return nsdp_packet_length(&req->packet) - NSDP_PKT_HEADER_SIZE -
+    (nsdp_packet_has_terminator(&req->packet) > 0 ?
+     NSDP_PROPERTY_HEADER_SIZE : 0);
+}
+
+static int nsdp_client_request_has_tag(const nsdp_client_request_t* req,
+                                       nsdp_tag_t tag)
+{
+  nsdp_property_t *prop;
+
+  nsdp_packet_for_each_property(&req->packet, prop)
+    if (prop->tag == tag)
+      return 1;
+
+  return 0;
+}
+
+static int nsdp_client_can_merge(const nsdp_client_request_t* req,
+                                 const nsdp_client_request_t* other)
+{
+  return other->packet.op == NSDP_OP_READ_REQUEST &&
+    other->send_count == 0 &&
+    !memcmp(other->packet.server_mac, req->packet.server_mac,
+            sizeof(nsdp_mac_t)) &&
+    other->auto_addr == req->auto_addr &&
+    (req->auto_addr || nsdp_socket_addr_equal(&other->in_addr, &req->in_addr));
+}
+
+// Move the queued reads for the same device in the request batch,
+// as long as they fit in a single packet.
+static void nsdp_client_coalesce(nsdp_client_t *client,
+                                 nsdp_client_request_t* req,
+                                 struct list_head *queue,
+                                 unsigned max_size)
+{
+  nsdp_client_request_t *other, *next;
+  int length, extra;
+
+  // Broadcast reads get answers from many devices, don't mix them
+  if (req->packet.op != NSDP_OP_READ_REQUEST || req->send_count > 0 ||
+      nsdp_mac_is_zero(req->packet.server_mac) || !list_empty(&req->batch))
+    return;
+
+  length = NSDP_PKT_HEADER_SIZE + nsdp_client_request_payload(req) +
+    NSDP_PROPERTY_HEADER_SIZE;
+
+  other = req;
+  list_for_each_entry_safe_continue(other, next, queue, list) {
+    if (!nsdp_client_can_merge(req, other))
+      continue;
+    extra = nsdp_client_request_payload(other);
+    if (length + extra > max_size)
+      continue;
+    length += extra;
+    list_move_tail(&other->list, &req->batch);
+  }
+}
+
+// Check if a tag has already been added by a previous request of the batch
+static int nsdp_client_batch_has_tag(nsdp_client_request_t* req,
+                                     nsdp_client_request_t* until,
+                                     nsdp_tag_t tag)
+{
+  nsdp_client_request_t *part;
+
+  if (nsdp_client_request_has_tag(req, tag))
+    return 1;
+
+  list_for_each_entry(part, &req->batch, list) {
+    if (part == until)
+      break;
+    if (nsdp_client_request_has_tag(part, tag))
+      return 1;
+  }
+
+  return 0;
+}
+
+static int nsdp_client_request_write(nsdp_client_request_t* req,
+                                     void *buffer, unsigned max_size)
+{
+  nsdp_client_request_t *part;
+  nsdp_property_t *prop;
+  uint8_t *data = buffer;
+  int pos, len;
+
+  if (list_empty(&req->batch))
+    return nsdp_packet_write(&req->packet, buffer, max_size);
+
+  pos = nsdp_packet_write_header(&req->packet, data, max_size);
+  if (pos < 0)
+    return pos;
+
+  nsdp_packet_for_each_property(&req->packet, prop) {
+    if (prop->tag == NSDP_PROPERTY_TERMINATOR)
+      continue;
+    len = nsdp_property_write(prop, data+pos, max_size-pos);
+    if (len < 0)
+      return len;
+    pos += len;
+  }
+
+  // Only ask once for the tags wanted by several requests
+  list_for_each_entry(part, &req->batch, list) {
+    nsdp_packet_for_each_property(&part->packet, prop) {
+      if (prop->tag == NSDP_PROPERTY_TERMINATOR ||
+          nsdp_client_batch_has_tag(req, part, prop->tag))
+        continue;
+      len = nsdp_property_write(prop, data+pos, max_size-pos);
+      if (len < 0)
+        return len;
+      pos += len;
+    }
+  }
+
+  len = nsdp_property_write(&nsdp_client_terminator,
+                            data+pos, max_size-pos);
+  if (len < 0)
+    return len;
+
+  return pos + len;
+}
+
+// The password must lead every packet of a write
+static nsdp_property_t* nsdp_client_request_password(nsdp_client_request_t* req)
+{
+  nsdp_property_t *first;
+
+  if (req->packet.op != NSDP_OP_WRITE_REQUEST ||
+      list_empty(&req->packet.properties))
+    return NULL;
+
+  first = list_first_entry(&req->packet.properties, nsdp_property_t, list);
+  return first->tag == NSDP_PROPERTY_PASSWORD ? first : NULL;
+}
+
+// Split the request properties in packets that fit in max_size
+static int nsdp_client_split(nsdp_client_request_t* req, unsigned max_size)
+{
+  nsdp_property_t *prop, *password = nsdp_client_request_password(req);
+  nsdp_client_chunk_t *chunk;
+  unsigned fixed, length = 0, size;
+
+  if (req->chunk_count > 0 || nsdp_packet_length(&req->packet) <= max_size)
+    return 0;
+
+  fixed = NSDP_PKT_HEADER_SIZE + NSDP_PROPERTY_HEADER_SIZE;
+  if (password)
+    fixed += NSDP_PROPERTY_HEADER_SIZE + password->length;
+
+  nsdp_packet_for_each_property(&req->packet, prop) {
+    if (prop == password || prop->tag == NSDP_PROPERTY_TERMINATOR)
+      continue;
+
+    size = NSDP_PROPERTY_HEADER_SIZE + prop->length;
+    if (fixed + size > max_size)
+      goto too_big;
+
+    if (req->chunk_count == 0 || length + size > max_size) {
+      chunk = realloc(req->chunk, (req->chunk_count + 1) * sizeof(*chunk));
+      if (!chunk)
+        goto no_mem;
+      req->chunk = chunk;
+      chunk += req->chunk_count;
+      req->chunk_count += 1;
+      chunk->first = prop;
+      chunk->count = 0;
+      chunk->done = 0;
+      length = fixed;
+    }
+
+    req->chunk[req->chunk_count - 1].count += 1;
+    length += size;
+  }
+
+  req->chunk_pending = req->chunk_count;
+  return 0;
+
+ too_big:
+  free(req->chunk);
+  req->chunk = NULL;
+  req->chunk_count = 0;
+  return -E2BIG;
+
+ no_mem:
+  free(req->chunk);
+  req->chunk = NULL;
+  req->chunk_count = 0;
+  return -ENOMEM;
+}
+
+static int nsdp_client_chunk_write(nsdp_client_request_t* req,
+                                   const nsdp_client_chunk_t *chunk,
+                                   void *buffer, unsigned max_size)
+{
+  nsdp_property_t *prop, *password = nsdp_client_request_password(req);
+  uint8_t *data = buffer;
+  int pos, len;
+  unsigned i;
+
+  pos = nsdp_packet_write_header(&req->packet, data, max_size);
+  if (pos < 0)
+    return pos;
+
+  if (password) {
+    len = nsdp_property_write(password, data+pos, max_size-pos);
+    if (len < 0)
+      return len;
+    pos += len;
+  }
+
+  for (prop = chunk->first, i = 0 ; i < chunk->count ;
+       prop = list_entry(prop->list.next, nsdp_property_t, list), i += 1) {
+    len = nsdp_property_write(prop, data+pos, max_size-pos);
+    if (len < 0)
+      return len;
+    pos += len;
+  }
+
+  len = nsdp_property_write(&nsdp_client_terminator,
+                            data+pos, max_size-pos);
+  if (len < 0)
+    return len;
+
+  return pos + len;
+}
+
+// Largest NSDP packet that fit in the MTU
+static unsigned nsdp_client_max_size(const nsdp_client_t *client)
+{
+  return client->mtu - NSDP_CLIENT_MTU_OVERHEAD;
+}
+
+static double nsdp_client_now(nsdp_client_t *client)
+{
+  struct timeval tv;
+
+  event_base_gettimeofday_cached(client->ev_base, &tv);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static nsdp_client_pacer_t* nsdp_client_get_pacer(nsdp_client_t *client,
+                                                  nsdp_client_request_t* req)
+{
+  if (req->probe)
+    return &client->pacer[NSDP_CLIENT_PACE_PROBE];
+  return &client->pacer[nsdp_socket_addr_is_broadcast(&req->in_addr) ?
+                        NSDP_CLIENT_PACE_BROADCAST :
+                        NSDP_CLIENT_PACE_UNICAST];
+}
+
+// Return how long to wait until a packet can be sent, in seconds
+static double nsdp_client_pacer_delay(nsdp_client_t *client,
+                                      nsdp_client_pacer_t *pacer)
+{
+  double now;
+
+  if (pacer->rate <= 0)
+    return 0;
+
+  now = nsdp_client_now(client);
+  pacer->tokens += (now - pacer->last) * pacer->rate;
+  if (pacer->tokens > pacer->burst)
+    pacer->tokens = pacer->burst;
+  pacer->last = now;
+
+  return pacer->tokens >= 1 ? 0 : (1 - pacer->tokens) / pacer->rate;
+}
+
+static void nsdp_client_delay_to_timeval(double delay, struct timeval *tv)
+{
+  tv->tv_sec = delay;
+  tv->tv_usec = (delay - tv->tv_sec) * 1e6 + 1;
+}
+
+// Resume the dispatch once the pacer allows it
+static void nsdp_client_pace(nsdp_client_t *client, double delay)
+{
+  struct timeval tv;
+
+  client->stats.paced += 1;
+  if (evtimer_pending(client->pace_event, NULL))
+    return;
+  nsdp_client_delay_to_timeval(delay, &tv);
+  evtimer_add(client->pace_event, &tv);
+}
+
+static void nsdp_client_request_timeout(int sock, short what, void *arg);
+
+static void nsdp_client_request_bind(nsdp_client_t *client,
+                                     nsdp_client_request_t* req)
+{
+  if (req->client)
+    return;
+  req->client = client;
+  evtimer_assign(&req->timeout_event, client->ev_base,
+                 nsdp_client_request_timeout, req);
+}
+
+// Get the time left until the deadline of a request, return 0 if it
+// has none or if the deadline is ignored for its batch
+static int nsdp_client_request_time_left(nsdp_client_t *client,
+                                         const nsdp_client_request_t* req,
+                                         struct timeval *left)
+{
+  struct timeval now;
+
+  if (!req->has_deadline || req->cancelled)
+    return 0;
+
+  event_base_gettimeofday_cached(client->ev_base, &now);
+  if (timercmp(&now, &req->deadline, >=))
+    timerclear(left);
+  else
+    timersub(&req->deadline, &now, left);
+  return 1;
+}
+
+// Set the request timer, but never past the request deadline
+static void nsdp_client_request_arm(nsdp_client_t *client,
+                                    nsdp_client_request_t* req,
+                                    const struct timeval *tv)
+{
+  struct timeval left;
+
+  req->at_deadline = nsdp_client_request_time_left(client, req, &left) &&
+    (!tv || timercmp(&left, tv, <));
+  evtimer_add(&req->timeout_event, req->at_deadline ? &left : tv);
+}
+
+int nsdp_client_send_request(nsdp_client_t *client,
+                             nsdp_client_request_t* req)
+{
+  unsigned max_size, i;
+  struct timeval tout = {};
+  int len, err;
+
+  if (!client || !req)
+    return -EINVAL;
+
+  // Wait for the interface to come back
+  if (!client->iface_running)
+    return 0;
+
+  // Add the timeout first, so failed sends get retried
+  nsdp_client_request_bind(client, req);
+  tout.tv_sec = req->timeout;
+  nsdp_client_request_arm(client, req, &tout);
+
+  max_size = nsdp_client_max_size(client);
+  err = nsdp_client_split(req, max_size);
+  if (err)
+    return err;
+
+  memcpy(req->packet.client_mac, client->mac, sizeof(nsdp_mac_t));
+  req->send_count += 1;
+
+  // Send all the missing chunks back to back, each send get
+  // its own seq no to know which one got answered.
+  for (i = 0 ; i < (req->chunk_count ? req->chunk_count : 1) ; i += 1) {
+    if (req->chunk_count > 0 && req->chunk[i].done)
+      continue;
+
+    req->packet.seq_no = nsdp_client_next_seq_no(client, req);
+    err = nsdp_client_request_add_send(req, req->packet.seq_no, i);
+    if (err)
+      return err;
+
+    if (req->chunk_count == 0)
+      len = nsdp_client_request_write(req, client->send_buffer, max_size);
+    else
+      len = nsdp_client_chunk_write(req, &req->chunk[i],
+                                    client->send_buffer, max_size);
+    if (len < 0)
+      return len;
+
+    // Chunks and retries may put the pacer in debt
+    nsdp_client_get_pacer(client, req)->tokens -= 1;
+    err = nsdp_socket_sendto(client->socket, client->send_buffer, len,
+                             &req->in_addr);
+    if (err < 0)
+      return err;
+
+    client->stats.sent += 1;
+    if (req->send_count > 1)
+      client->stats.retransmits += 1;
+    else {
+      req->window_packets += 1;
+      req->window_bytes += len;
+    }
+  }
+
+  return 0;
+}
+
+// Pick the address of the requests that didn't get one
+static void nsdp_client_resolve(nsdp_client_t *client,
+                                nsdp_client_device_t *dev,
+                                nsdp_client_request_t* req)
+{
+  if (!req->auto_addr)
+    return;
+
+  if (dev && dev->has_addr && !req->fallback &&
+      !nsdp_mac_is_zero(dev->mac))
+    memcpy(&req->in_addr, &dev->addr, sizeof(req->in_addr));
+  else
+    nsdp_socket_addr_set_broadcast(&req->in_addr);
+  nsdp_socket_addr_set_port(&req->in_addr, client->server_port);
+}
+
+static void nsdp_client_learn_ip(nsdp_client_t *client, const nsdp_mac_t mac,
+                                 const nsdp_property_t *prop)
+{
+  static const uint8_t any_ip[4];
+  nsdp_client_device_t *dev;
+
+  if (prop->length != sizeof(any_ip) ||
+      !memcmp(prop->data, any_ip, sizeof(any_ip)))
+    return;
+
+  dev = nsdp_client_get_device(client, mac);
+  if (dev)
+    dev->has_addr = !nsdp_socket_addr_from_ip4(&dev->addr, prop->data);
+}
+
+// Remember the management address of the devices
+static void nsdp_client_learn(nsdp_client_t *client,
+                              const nsdp_packet_t *response)
+{
+  nsdp_property_t *prop;
+
+  if (nsdp_mac_is_zero(response->server_mac))
+    return;
+
+  nsdp_packet_for_each_property(response, prop) {
+    if (prop->tag == NSDP_PROPERTY_IP) {
+      nsdp_client_learn_ip(client, response->server_mac, prop);
+      return;
+    }
+  }
+}
+
+int nsdp_client_learn_addresses(nsdp_client_t *client,
+                                const nsdp_inventory_t *inventory)
+{
+  const nsdp_property_t *prop;
+  const nsdp_device_t *device;
+
+  if (!client || !inventory)
+    return -EINVAL;
+
+  list_for_each_entry(device, &inventory->devices, list) {
+    prop = nsdp_device_get_property(device, NSDP_PROPERTY_IP);
+    if (prop)
+      nsdp_client_learn_ip(client, device->mac, prop);
+  }
+
+  return 0;
+}
+
+// Check if the device window has room for a request
+static int nsdp_client_device_can_send(nsdp_client_t *client,
+                                       nsdp_client_device_t *dev,
+                                       nsdp_client_request_t* req)
+{
+  unsigned max_size = nsdp_client_max_size(client);
+  unsigned bytes = nsdp_packet_length(&req->packet);
+  unsigned packets = (bytes + max_size - 1) / max_size;
+
+  // Always allow one request to go
+  if (dev->inflight_packets == 0)
+    return 1;
+
+  // Writes are not reordered with anything else
+  if (dev->exclusive || req->packet.op == NSDP_OP_WRITE_REQUEST)
+    return 0;
+
+  return dev->inflight_packets + packets <= (unsigned)dev->window &&
+    dev->inflight_bytes + bytes <=
+    (unsigned)dev->window * NSDP_CLIENT_WINDOW_BYTES;
+}
+
+// Return the part of the device window used by a request
+static void nsdp_client_release(nsdp_client_request_t* req)
+{
+  nsdp_client_device_t *dev = req->device;
+
+  if (!dev)
+    return;
+
+  dev->inflight_packets -= req->window_packets;
+  dev->inflight_bytes -= req->window_bytes;
+  if (req->packet.op == NSDP_OP_WRITE_REQUEST)
+    dev->exclusive = 0;
+
+  req->device = NULL;
+  req->window_packets = 0;
+  req->window_bytes = 0;
+}
+
+// Keep a request that couldn't be sent to complete it with its error
+// once the dispatch is done, as its callback can queue or cancel the
+// other requests. Retrying wouldn't help, the send would fail again.
+static void nsdp_client_send_failed(nsdp_client_t *client,
+                                    nsdp_client_request_t* req, int err)
+{
+  fprintf(stderr, "Failed to send request: %s\n", strerror(-err));
+  client->stats.failed += 1;
+  req->error = err;
+  list_move_tail(&req->list, &client->failed);
+}
+
+static void nsdp_client_deliver(nsdp_client_t *client,
+                                nsdp_client_request_t* request,
+                                nsdp_packet_t *response);
+
+static void nsdp_client_deliver_failed(nsdp_client_t *client)
+{
+  nsdp_client_request_t *req;
+
+  while (!list_empty(&client->failed)) {
+    req = list_first_entry(&client->failed, nsdp_client_request_t, list);
+    nsdp_client_deliver(client, req, NULL);
+  }
+}
+
+// Send the queued probes as long as the pacer allows it, they all
+// go to different addresses so the device windows don't apply.
+static void nsdp_client_dispatch_probes(nsdp_client_t *client)
+{
+  nsdp_client_pacer_t *pacer = &client->pacer[NSDP_CLIENT_PACE_PROBE];
+  nsdp_client_request_t *req;
+  double delay;
+  int err;
+
+  while (!list_empty(&client->probe)) {
+    delay = nsdp_client_pacer_delay(client, pacer);
+    if (delay > 0) {
+      nsdp_client_pace(client, delay);
+      break;
+    }
+
+    req = list_first_entry(&client->probe, nsdp_client_request_t, list);
+    list_move_tail(&req->list, &client->inflight);
+    err = nsdp_client_send_request(client, req);
+    if (err)
+      nsdp_client_send_failed(client, req, err);
+  }
+}
+
+// Send the queued requests of a class as long as the device windows
+// allow it, return 1 if it stopped after sending quota requests
+static int nsdp_client_dispatch_class(nsdp_client_t *client,
+                                      struct list_head *queue,
+                                      unsigned quota)
+{
+  nsdp_client_request_t *req, *next;
+  nsdp_client_device_t *dev;
+  nsdp_client_pacer_t *pacer;
+  unsigned sent = 0;
+  double delay;
+  int err;
+
+  for (req = list_first_entry(queue, nsdp_client_request_t, list) ;
+       &req->list != queue ; req = next) {
+    next = list_entry(req->list.next, nsdp_client_request_t, list);
+
+    dev = nsdp_client_get_device(client, req->packet.server_mac);
+    if (!dev)
+      break;
+
+    // Keep the requests to a device in order
+    if (dev->blocked == client->dispatch_gen)
+      continue;
+    if (!nsdp_client_device_can_send(client, dev, req)) {
+      dev->blocked = client->dispatch_gen;
+      continue;
+    }
+
+    nsdp_client_resolve(client, dev, req);
+    pacer = nsdp_client_get_pacer(client, req);
+    if (pacer->blocked == client->dispatch_gen) {
+      dev->blocked = client->dispatch_gen;
+      continue;
+    }
+    delay = nsdp_client_pacer_delay(client, pacer);
+    if (delay > 0) {
+      pacer->blocked = client->dispatch_gen;
+      dev->blocked = client->dispatch_gen;
+      nsdp_client_pace(client, delay);
+      continue;
+    }
+
+    nsdp_client_coalesce(client, req, queue, nsdp_client_max_size(client));
+    next = list_entry(req->list.next, nsdp_client_request_t, list);
+    list_move_tail(&req->list, &client->inflight);
+
+    req->device = dev;
+    req->epoch = dev->epoch;
+    if (req->packet.op == NSDP_OP_WRITE_REQUEST)
+      dev->exclusive = 1;
+
+    err = nsdp_client_send_request(client, req);
+
+    dev->inflight_packets += req->window_packets;
+    dev->inflight_bytes += req->window_bytes;
+    if (err)
+      nsdp_client_send_failed(client, req, err);
+
+    sent += 1;
+    if (quota && sent >= quota)
+      return 1;
+  }
+
+  return 0;
+}
+
+// Send the queued requests, the classes with no weight go before the
+// lower ones, the others take turns sending up to weight requests
+static void nsdp_client_dispatch(nsdp_client_t *client)
+{
+  unsigned i;
+  int more;
+
+  if (!client->iface_running || client->dispatching)
+    return;
+
+  client->dispatching = 1;
+  client->dispatch_gen += 1;
+
+  do {
+    more = 0;
+    for (i = 0 ; i < NSDP_CLIENT_PRIORITY_COUNT ; i += 1)
+      more |= nsdp_client_dispatch_class(client, &client->request[i],
+                                         client->weight[i]);
+  } while (more);
+
+  nsdp_client_dispatch_probes(client);
+  client->dispatching = 0;
+
+  nsdp_client_deliver_failed(client);
+}
+
+static void nsdp_client_queue_request(nsdp_client_t *client,
+                                      nsdp_client_request_t* req)
+{
+  if (req->probe)
+    list_add_tail(&req->list, &client->probe);
+  else
+    list_add_tail(&req->list, &client->request[req->priority]);
+}
+
+static nsdp_client_request_t* nsdp_client_find_request(nsdp_client_t *client,
+                                                       uint32_t id)
+{
+  nsdp_client_request_t *req;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(req, pos, &client->request_id[
+                         id % NSDP_CLIENT_REQUEST_HASH_SIZE], id_hash)
+    if (req->id == id)
+      return req;
+
+  return NULL;
+}
+
+// The request timer waits for the deadline until the request is sent
+static void nsdp_client_request_wait_deadline(nsdp_client_t *client,
+                                              nsdp_client_request_t* req)
+{
+  if (!req->has_deadline || req->cancelled)
+    return;
+  nsdp_client_request_bind(client, req);
+  nsdp_client_request_arm(client, req, NULL);
+}
+
+static void nsdp_client_request_hash_id(nsdp_client_t *client,
+                                        nsdp_client_request_t* req)
+{
+  hlist_add_head(&req->id_hash, &client->request_id[
+                   req->id % NSDP_CLIENT_REQUEST_HASH_SIZE]);
+}
+
+// Give a request an id that no other request uses
+static void nsdp_client_request_add_id(nsdp_client_t *client,
+                                       nsdp_client_request_t* req)
+{
+  do
+    req->id = ++client->next_id;
+  while (req->id == 0 || nsdp_client_find_request(client, req->id));
+
+  nsdp_client_request_hash_id(client, req);
+}
+
+int nsdp_client_add_request(nsdp_client_t *client,
+                            nsdp_client_request_t* req)
+{
+  if (!client || !req || req->priority < 0 ||
+      req->priority >= NSDP_CLIENT_PRIORITY_COUNT ||
+      (!req->on_response && !client->on_completions))
+    return -EINVAL;
+  if (client->request_filter)
+    client->request_filter(client, req, client->request_filter_context);
+
+  nsdp_client_request_add_id(client, req);
+  nsdp_client_request_wait_deadline(client, req);
+  nsdp_client_queue_request(client, req);
+  nsdp_client_dispatch(client);
+  return 0;
+}
+
+// Pass the queued results to the completion callback
+static void nsdp_client_flush_completions(nsdp_client_t *client)
+{
+  unsigned i, count = client->completion_count;
+
+  if (count == 0)
+    return;
+
+  client->on_completions(client, client->completion, count,
+                         client->completions_context);
+
+  for (i = 0 ; i < count ; i += 1)
+    if (client->completion[i].packet)
+      nsdp_packet_uninit(client->completion[i].packet);
+  client->completion_count = 0;
+}
+
+static void nsdp_client_completion_event(int fd, short what, void *arg)
+{
+  nsdp_client_flush_completions(arg);
+}
+
+// Queue the result of a request, taking the response properties,
+// it is passed on once the current event loop iteration is done
+static void nsdp_client_queue_completion(nsdp_client_t *client,
+                                         nsdp_client_request_t* req,
+                                         nsdp_packet_t *response, int err)
+{
+  nsdp_client_completion_t *comp;
+  nsdp_packet_t *packet;
+
+  if (client->completion_count >= client->completion_size)
+    nsdp_client_flush_completions(client);
+
+  comp = &client->completion[client->completion_count];
+  packet = &client->completion_packet[client->completion_count];
+  client->completion_count += 1;
+
+  comp->status = response ? 0 : err ? err : -ETIMEDOUT;
+  comp->id = req->id;
+  comp->context = req->context;
+  comp->packet = NULL;
+  if (!response) {
+    comp->seq_no = req->packet.seq_no;
+    memcpy(comp->mac, req->packet.server_mac, sizeof(nsdp_mac_t));
+  } else {
+    comp->seq_no = response->seq_no;
+    memcpy(comp->mac, response->server_mac, sizeof(nsdp_mac_t));
+
+    nsdp_packet_init(packet);
+    packet->op = response->op;
+    packet->result = response->result;
+    memcpy(packet->client_mac, response->client_mac, sizeof(nsdp_mac_t));
+    memcpy(packet->server_mac, response->server_mac, sizeof(nsdp_mac_t));
+    packet->seq_no = response->seq_no;
+    list_splice_init(&response->properties, &packet->properties);
+    comp->packet = packet;
+  }
+
+  event_active(client->completion_event, EV_TIMEOUT, 1);
+}
+
+// Pass a response, or a timeout, to the request callback or to the
+// completion queue, return 1 if the request is done
+static int nsdp_client_complete(nsdp_client_t *client,
+                                nsdp_client_request_t* req,
+                                nsdp_packet_t *response, int err)
+{
+  if (req->on_response)
+    return req->on_response(response, req->context);
+
+  nsdp_client_queue_completion(client, req, response, err);
+  return 1;
+}
+
+// Take a request out of the queues, the device window and the seq no
+// table, return 0 if its packet carries a batch and must stay in flight
+static int nsdp_client_request_detach(nsdp_client_t *client,
+                                      nsdp_client_request_t* req)
+{
+  hlist_del_init(&req->id_hash);
+  if (!list_empty(&req->batch)) {
+    req->cancelled = 1;
+    return 0;
+  }
+
+  list_del_init(&req->list);
+  nsdp_client_release(req);
+  nsdp_client_request_retire(client, req);
+  if (req->client)
+    evtimer_del(&req->timeout_event);
+  return 1;
+}
+
+int nsdp_client_cancel(nsdp_client_t *client, uint32_t id)
+{
+  nsdp_client_request_t *req;
+
+  if (!client)
+    return -EINVAL;
+
+  req = nsdp_client_find_request(client, id);
+  if (!req)
+    return -ENOENT;
+
+  client->stats.cancelled += 1;
+  if (nsdp_client_request_detach(client, req))
+    nsdp_client_request_free(req);
+
+  // Its part of the device window can be used by the next requests
+  nsdp_client_dispatch(client);
+  return 0;
+}
+
+// Deliver the timeout of a request past its deadline without retrying,
+// return 0 if the request stays in flight for its batch
+static int nsdp_client_request_expire(nsdp_client_t *client,
+                                      nsdp_client_request_t* req)
+{
+  int detached = nsdp_client_request_detach(client, req);
+
+  client->stats.timeouts += 1;
+  client->stats.expired += 1;
+  nsdp_client_complete(client, req, NULL, 0);
+  if (detached)
+    nsdp_client_request_free(req);
+  return detached;
+}
+
+// Extract the part of a response that answers a merged request
+static void nsdp_client_response_part(const nsdp_client_request_t* req,
+                                      const nsdp_packet_t *response,
+                                      nsdp_packet_t *part)
+{
+  nsdp_property_t *prop;
+
+  nsdp_packet_init(part);
+  part->op = response->op;
+  part->result = response->result;
+  memcpy(part->client_mac, response->client_mac, sizeof(nsdp_mac_t));
+  memcpy(part->server_mac, response->server_mac, sizeof(nsdp_mac_t));
+  part->seq_no = response->seq_no;
+
+  nsdp_packet_for_each_property(response, prop) {
+    nsdp_property_t *copy;
+    if (prop->tag == NSDP_PROPERTY_TERMINATOR ||
+        !nsdp_client_request_has_tag(req, prop->tag))
+      continue;
+    copy = nsdp_property_from_data(prop->tag, prop->length, prop->data);
+    if (copy)
+      nsdp_packet_add_property(part, copy);
+  }
+  nsdp_packet_add_properties_terminator(part);
+}
+
+static int nsdp_client_deliver_one(nsdp_client_t *client,
+                                   nsdp_client_request_t* req,
+                                   nsdp_packet_t *response, int merged,
+                                   int err)
+{
+  nsdp_packet_t part;
+  int done;
+
+  // It can't be cancelled from its own callback
+  hlist_del_init(&req->id_hash);
+
+  // Only kept for its batch
+  if (req->cancelled)
+    done = 1;
+  else if (response && merged) {
+    nsdp_client_response_part(req, response, &part);
+    done = nsdp_client_complete(client, req, &part, 0);
+    nsdp_packet_uninit(&part);
+  } else
+    done = nsdp_client_complete(client, req, response, err);
+
+  // The requests that couldn't be sent are not retried
+  if (err)
+    done = 1;
+
+  if (done)
+    nsdp_client_request_free(req);
+  else
+    nsdp_client_request_reset(req);
+
+  return done;
+}
+
+// Deliver a response, a timeout or the send error of the request to
+// the request and its batch
+static void nsdp_client_deliver(nsdp_client_t *client,
+                                nsdp_client_request_t* request,
+                                nsdp_packet_t *response)
+{
+  nsdp_client_request_t *req, *next;
+  LIST_HEAD(batch);
+  LIST_HEAD(again);
+  int merged = !list_empty(&request->batch);
+
+  nsdp_client_release(request);
+  nsdp_client_request_retire(client, request);
+  evtimer_del(&request->timeout_event);
+
+  list_splice_init(&request->batch, &batch);
+  list_move(&request->list, &batch);
+
+  while (!list_empty(&batch)) {
+    req = list_first_entry(&batch, nsdp_client_request_t, list);
+    list_del_init(&req->list);
+    if (!nsdp_client_deliver_one(client, req, response, merged,
+                                 request->error))
+      list_add_tail(&req->list, &again);
+  }
+
+  // The requests that want a resend go first in their class
+  list_for_each_entry_safe_reverse(req, next, &again, list) {
+    list_move(&req->list, &client->request[req->priority]);
+    if (req->id)
+      nsdp_client_request_hash_id(client, req);
+    nsdp_client_request_wait_deadline(client, req);
+  }
+}
+
+// Collect the answer to one chunk, return 1 once all chunks are done
+static int nsdp_client_collect_chunk(nsdp_client_request_t *request,
+                                     nsdp_packet_t *response,
+                                     unsigned index)
+{
+  nsdp_property_t *prop, *next;
+
+  if (request->chunk[index].done)
+    return 0;
+  request->chunk[index].done = 1;
+  request->chunk_pending -= 1;
+  // Keep the error of any chunk
+  if (response->result)
+    request->response.result = response->result;
+
+  list_for_each_entry_safe(prop, next, &response->properties, list)
+    if (prop->tag != NSDP_PROPERTY_TERMINATOR)
+      list_move_tail(&prop->list, &request->response.properties);
+
+  if (request->chunk_pending > 0)
+    return 0;
+
+  request->response.op = response->op;
+  memcpy(request->response.client_mac, response->client_mac,
+         sizeof(nsdp_mac_t));
+  memcpy(request->response.server_mac, response->server_mac,
+         sizeof(nsdp_mac_t));
+  request->response.seq_no = request->packet.seq_no;
+  nsdp_packet_add_properties_terminator(&request->response);
+  return 1;
+}
+
+// Grow the window of the device when the first send got answered
+static void nsdp_client_device_answered(nsdp_client_device_t *dev,
+                                        const nsdp_client_send_t *send)
+{
+  if (!dev || send->attempt != 1)
+    return;
+
+  dev->window += 1.0 / dev->window;
+  if (dev->window > NSDP_CLIENT_MAX_WINDOW)
+    dev->window = NSDP_CLIENT_MAX_WINDOW;
+}
+
+// Halve the window, only once for all the requests in flight
+static void nsdp_client_device_timeout(nsdp_client_device_t *dev,
+                                       unsigned epoch)
+{
+  if (!dev || epoch != dev->epoch)
+    return;
+
+  dev->epoch += 1;
+  dev->window /= 2;
+  if (dev->window < 1)
+    dev->window = 1;
+}
+
+// Handle a packet read in the receive buffer
+static void nsdp_client_recv_packet(nsdp_client_t *client, int len)
+{
+  nsdp_client_request_t *request;
+  nsdp_client_send_t *send;
+  nsdp_packet_t response;
+  int err;
+
+  nsdp_packet_init(&response);
+  err = nsdp_packet_read_header(&response, client->recv_buffer, len);
+  if (err < 0) {
+    fprintf(stderr, "Failed to read packet: %s\n", strerror(-err));
+    return;
+  }
+
+  // The devices broadcast their answers, ignore the ones to other clients
+  if (memcmp(response.client_mac, client->mac, sizeof(nsdp_mac_t)))
+    return;
+
+  client->stats.received += 1;
+
+  // Drop the answers to requests that are already done
+  // before decoding the properties.
+  if (nsdp_client_seq_no_retired(client, response.seq_no)) {
+    client->stats.duplicates += 1;
+    return;
+  }
+
+  request = client->seq_owner[response.seq_no];
+  if (!request) {
+    fprintf(stderr, "Got packet with a bad seq no\n");
+    return;
+  }
+
+  if ((request->packet.op == NSDP_OP_READ_REQUEST &&
+       response.op != NSDP_OP_READ_RESPONSE) ||
+      (request->packet.op == NSDP_OP_WRITE_REQUEST &&
+       response.op != NSDP_OP_WRITE_RESPONSE)) {
+    fprintf(stderr, "Got packet with a bad op\n");
+    return;
+  }
+
+  send = nsdp_client_request_find_send(request, response.seq_no);
+  if (!send) {
+    fprintf(stderr, "Got packet with a bad seq no\n");
+    return;
+  }
+
+  err = nsdp_packet_read(&response, client->recv_buffer, len);
+  if (err < 0) {
+    fprintf(stderr, "Failed to read packet: %s\n", strerror(-err));
+    goto out;
+  }
+
+  nsdp_client_device_answered(request->device, send);
+  nsdp_client_learn(client, &response);
+
+  // Scans get answers from many devices until they time out
+  if (request->collect) {
+    nsdp_client_complete(client, request, &response, 0);
+    goto out;
+  }
+
+  if (request->chunk_count > 0 &&
+      !nsdp_client_collect_chunk(request, &response, send->chunk))
+    goto out;
+
+  // Deliver
+  nsdp_client_deliver(client, request, request->chunk_count > 0 ?
+                      &request->response : &response);
+
+  // Submit the next requests
+  nsdp_client_dispatch(client);
+
+ out:
+  nsdp_packet_uninit(&response);
+}
+
+static void nsdp_client_recv(int sock, short what, void *arg)
+{
+  nsdp_client_t *client = arg;
+  unsigned i;
+  int len;
+
+  // Also read the packets already waiting, so that the answers of a
+  // burst are handled, and their completions passed, together
+  for (i = 0 ; i < NSDP_CLIENT_RECV_BATCH ; i += 1) {
+    len = recv(sock, client->recv_buffer, NSDP_CLIENT_MAX_MTU,
+               i > 0 ? MSG_DONTWAIT : 0);
+    if (len < 0) {
+      if (i == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        fprintf(stderr, "Failed to receive a packet: %s\n",
+                strerror(errno));
+      return;
+    }
+    nsdp_client_recv_packet(client, len);
+  }
+}
+
+static void nsdp_client_request_timeout(int sock, short what, void *arg)
+{
+  nsdp_client_request_t *request = arg;
+  nsdp_client_t *client = request->client;
+  int err;
+
+  // Past the deadline nothing is retried, except for a batch
+  if (request->at_deadline && !request->cancelled &&
+      nsdp_client_request_expire(client, request)) {
+    nsdp_client_dispatch(client);
+    return;
+  }
+
+  nsdp_client_device_timeout(request->device, request->epoch);
+
+  // The device might have changed its address, use broadcast again
+  if (request->auto_addr && !request->fallback &&
+      !nsdp_socket_addr_is_broadcast(&request->in_addr)) {
+    request->fallback = 1;
+    if (request->device)
+      request->device->has_addr = 0;
+    nsdp_client_resolve(client, request->device, request);
+  }
+
+  // Resend if the retry count has been exceeded yet
+  if (request->send_count < request->retry_count) {
+    double delay =
+      nsdp_client_pacer_delay(client, nsdp_client_get_pacer(client, request));
+    if (delay > 0) {
+      struct timeval tv;
+      client->stats.paced += 1;
+      nsdp_client_delay_to_timeval(delay, &tv);
+      nsdp_client_request_arm(client, request, &tv);
+      return;
+    }
+    if (request->device)
+      request->epoch = request->device->epoch;
+    err = nsdp_client_send_request(client, request);
+    if (err) {
+      nsdp_client_send_failed(client, request, err);
+      nsdp_client_dispatch(client);
+    }
+    return;
+  }
+
+  // Deliver the timeout
+  client->stats.timeouts += 1;
+  nsdp_client_deliver(client, request, NULL);
 
-void nsdp_client_request_free(nsdp_client_request_t* req)
-{
-  if (!req)
-    return;
-  list_del(&req->list);
-  nsdp_packet_uninit(&req->packet);
+  // Submit the next requests
+  nsdp_client_dispatch(client);
 }
 
-nsdp_client_request_t* nsdp_client_pending_request(nsdp_client_t *client)
+// Use the interface MTU, but don't assume the devices support jumbo frames
+static unsigned nsdp_client_iface_mtu(const nsdp_iface_t *iface)
 {
-  if (!client || list_empty(&client->request))
-    return NULL;
-  return list_first_entry(&client->request, nsdp_client_request_t, list);
+  if (iface->mtu >= NSDP_CLIENT_MIN_MTU &&
+      iface->mtu < NSDP_CLIENT_DEFAULT_MTU)
+    return iface->mtu;
+  return NSDP_CLIENT_DEFAULT_MTU;
 }
 
-int nsdp_client_send_request(nsdp_client_t *client,
-                             nsdp_client_request_t* req)
+static void nsdp_client_on_iface_change(nsdp_iface_cache_t *cache,
+                                        const nsdp_iface_t *iface,
+                                        int event, void *context)
 {
-  uint8_t buffer[1500];
-  struct timeval tout = {};
-  int len, err;
-
-  if (!client || !req)
-    return -EINVAL;
-
-  req->packet.seq_no = client->seq_no;
-  req->send_count += 1;
+  nsdp_client_t *client = context;
+  nsdp_client_request_t *req, *next;
+  int running, err;
 
-  len = nsdp_packet_write(&req->packet, buffer, sizeof(buffer));
-  if (len < 0)
-    return len;
+  if (strcmp(iface->name, client->iface))
+    return;
 
-  //fprintf(stderr, "Sending request with seq no %u\n", req->packet.seq_no);
-  err = nsdp_socket_sendto(client->socket, buffer, len, &req->in_addr);
-  if (err < 0)
-    return err;
+  running = event != NSDP_IFACE_EVENT_DEL && nsdp_iface_is_running(iface);
+  if (running && client->mac_from_iface)
+    memcpy(client->mac, iface->mac, sizeof(client->mac));
+  if (running && client->mtu_from_iface)
+    client->mtu = nsdp_client_iface_mtu(iface);
 
-  // Add the timeout
-  tout.tv_sec = req->timeout;
-  event_add(client->request_timeout_event, &tout);
+  if (running == client->iface_running)
+    return;
+  client->iface_running = running;
+
+  list_for_each_entry_safe(req, next, &client->inflight, list) {
+    if (running) {
+      // Resend the requests in flight right away
+      err = nsdp_client_send_request(client, req);
+      if (err)
+        nsdp_client_send_failed(client, req, err);
+    } else {
+      // Don't waste the retries while the link is down
+      evtimer_del(&req->timeout_event);
+    }
+  }
 
-  return 0;
+  nsdp_client_dispatch(client);
 }
 
-int nsdp_client_send_pending_request(nsdp_client_t *client)
+static void nsdp_client_iface_event(int fd, short what, void *arg)
 {
-  return nsdp_client_send_request(client,
-                                  nsdp_client_pending_request(client));
-}
+  nsdp_client_t *client = arg;
+  int err;
 
-int nsdp_client_add_request(nsdp_client_t *client,
-                            nsdp_client_request_t* req)
-{
-  int do_send = 0;
-  if (!client || !req)
-    return -EINVAL;
-  do_send = list_empty(&client->request);
-  memcpy(req->packet.client_mac, client->mac, sizeof(nsdp_mac_t));
-  list_add_tail(&req->list, &client->request);
-  return do_send ? nsdp_client_send_pending_request(client) : 0;
+  err = nsdp_iface_cache_process(&client->iface_cache);
+  if (err < 0)
+    fprintf(stderr, "Failed to update the interfaces: %s\n",
+            strerror(-err));
 }
 
-static void nsdp_client_recv(int sock, short what, void *arg)
+static int nsdp_client_init_iface(nsdp_client_t *client, const char* iface)
 {
-  nsdp_client_t *client = arg;
-  nsdp_client_request_t *request;
-  nsdp_packet_t response;
-  uint8_t data[1500];
-  int len, err;
+  const nsdp_iface_t *entry;
+  int err;
 
-  len = recv(sock, data, sizeof(data), 0);
-  if (len < 0) {
-    fprintf(stderr, "Failed to receive a packet: %s\n", strerror(errno));
-    return;
+  err = nsdp_iface_cache_init(&client->iface_cache, 1);
+  if (err)
+    return err;
+
+  entry = nsdp_iface_cache_find(&client->iface_cache, iface);
+  if (!entry) {
+    nsdp_iface_cache_uninit(&client->iface_cache);
+    return -ENODEV;
   }
 
-  // Ignore if there is no request
-  request = nsdp_client_pending_request(client);
-  if (!request)
-    return;
+  client->iface = iface;
 
-  nsdp_packet_init(&response);
-  err = nsdp_packet_read(&response, data, len);
-  if (err < 0) {
-    fprintf(stderr, "Failed to read packet: %s\n", strerror(-err));
-    return;
+  client->iface_running = nsdp_iface_is_running(entry);
+  client->mtu = nsdp_client_iface_mtu(entry);
+  if (client->mac_from_iface)
+    memcpy(client->mac, entry->mac, sizeof(client->mac));
+
+  if (nsdp_iface_cache_fd(&client->iface_cache) >= 0) {
+    nsdp_iface_cache_set_on_change(&client->iface_cache,
+                                   nsdp_client_on_iface_change, client);
+    client->iface_event =
+      event_new(client->ev_base, nsdp_iface_cache_fd(&client->iface_cache),
+                EV_READ | EV_PERSIST, nsdp_client_iface_event, client);
+    event_add(client->iface_event, NULL);
   }
 
-  // TODO: Check the MAC if we are connected
+  return 0;
+}
 
-  if ((request->packet.op == NSDP_OP_READ_REQUEST &&
-       response.op != NSDP_OP_READ_RESPONSE) ||
-      (request->packet.op == NSDP_OP_WRITE_REQUEST &&
-       response.op != NSDP_OP_WRITE_RESPONSE)) {
-    fprintf(stderr, "Got packet with a bad op\n");
+// Release what nsdp_client_init_iface() set up
+static void nsdp_client_uninit_iface(nsdp_client_t *client)
+{
+  if (!client->iface)
     return;
-  }
 
-  if (response.seq_no != client->seq_no) {
-    fprintf(stderr, "Got packet with a bad seq no\n");
-    return;
-  }
+  if (client->iface_event)
+    event_free(client->iface_event);
+  client->iface_event = NULL;
+  nsdp_iface_cache_uninit(&client->iface_cache);
+  client->iface = NULL;
+}
 
-  // Cancel the request timeout
-  event_del(client->request_timeout_event);
+int nsdp_client_set_pacing(nsdp_client_t *client, int type,
+                           double rate, unsigned burst)
+{
+  nsdp_client_pacer_t *pacer;
 
-  // Deliver
-  if (request->on_response(&response, request->context))
-    nsdp_client_request_free(request);
-  else
-    request->send_count = 0;
-  client->seq_no += 1;
+  if (!client || rate < 0 || type < 0 || type >= NSDP_CLIENT_PACE_COUNT)
+    return -EINVAL;
 
-  // Submit the next request, or resubmit the same
-  nsdp_client_send_pending_request(client);
+  pacer = &client->pacer[type];
+  pacer->rate = rate;
+  pacer->burst = burst > 0 ? burst : 1;
+  pacer->tokens = pacer->burst;
+  pacer->last = nsdp_client_now(client);
+  return 0;
 }
 
-static void nsdp_client_request_timeout(int sock, short what, void *arg)
+static void nsdp_client_pace_event(int fd, short what, void *arg)
 {
-  nsdp_client_t *client = arg;
-  nsdp_client_request_t *request;
+  nsdp_client_dispatch(arg);
+}
 
-  request = nsdp_client_pending_request(client);
-  if (!request)
-    return;
+int nsdp_client_set_priority_weights(nsdp_client_t *client,
+                                     const unsigned *weights)
+{
+  unsigned i;
 
-  // Resend if the retry count has been exceeded yet
-  if (request->send_count < request->retry_count) {
-    nsdp_client_send_request(client, request);
-    return;
-  }
+  if (!client)
+    return -EINVAL;
 
-  // Deliver the timeout
-  if (request->on_response(NULL, request->context))
-    nsdp_client_request_free(request);
-  else
-    request->send_count = 0;
-  client->seq_no += 1;
+  for (i = 0 ; i < NSDP_CLIENT_PRIORITY_COUNT ; i += 1)
+    client->weight[i] = weights ? weights[i] : 0;
+  return 0;
+}
 
-  // Submit the next request
-  nsdp_client_send_pending_request(client);
+void nsdp_client_set_request_filter(nsdp_client_t *client,
+                                    nsdp_client_request_filter_f filter,
+                                    void *context)
+{
+  if (!client)
+    return;
+  client->request_filter = filter;
+  client->request_filter_context = context;
 }
 
 int nsdp_client_init(nsdp_client_t *client,
@@ -227,6 +1480,7 @@ int nsdp_client_init(nsdp_client_t *client,
                      unsigned client_port,
                      unsigned server_port)
 {
+  unsigned i;
   int err;
 
   if (!client || !ev_base || (!iface && !mac))
@@ -238,27 +1492,113 @@ int nsdp_client_init(nsdp_client_t *client,
   client->client_port = client_port ? client_port : 63321;
   client->server_port = server_port ? server_port : client->client_port+1;
   client->seq_no = random();
-  INIT_LIST_HEAD(&client->request);
+  client->iface_running = 1;
+  client->mac_from_iface = !mac;
+  client->mtu = NSDP_CLIENT_DEFAULT_MTU;
+  client->mtu_from_iface = 1;
+  for (i = 0 ; i < NSDP_CLIENT_PRIORITY_COUNT ; i += 1)
+    INIT_LIST_HEAD(&client->request[i]);
+  INIT_LIST_HEAD(&client->probe);
+  INIT_LIST_HEAD(&client->inflight);
+  INIT_LIST_HEAD(&client->failed);
+
+  client->send_buffer = malloc(NSDP_CLIENT_MAX_MTU);
+  client->recv_buffer = malloc(NSDP_CLIENT_MAX_MTU);
+  client->seq_owner = calloc(1 << 16, sizeof(*client->seq_owner));
+  if (!client->send_buffer || !client->recv_buffer || !client->seq_owner) {
+    err = -ENOMEM;
+    goto error;
+  }
 
-  if (mac)
+  if (mac) {
     err = nsdp_property_type_mac.from_text(mac, client->mac,
                                            sizeof(client->mac));
-  else
-    err = nsdp_iface_get_mac(iface, client->mac);
-  if (err < 0)
-    return err;
+    if (err < 0)
+      goto error;
+  }
 
-  if ((err = nsdp_socket_open(iface, NULL, client->client_port,
-                              &client->socket)) < 0)
-    return err;
+  if (iface && (err = nsdp_client_init_iface(client, iface)) < 0)
+    goto error;
+
+  // Share the port with the listeners and the other clients, the
+  // answers to their requests are dropped as their seq no isn't ours
+  if ((err = nsdp_socket_open_shared(iface, NULL, client->client_port,
+                                     &client->socket)) < 0)
+    goto error;
 
   client->recv_event = event_new(client->ev_base, client->socket,
                                  EV_READ | EV_PERSIST,
                                  nsdp_client_recv, client);
-  client->request_timeout_event = event_new(client->ev_base, -1, 0,
-                                            nsdp_client_request_timeout,
-                                            client);
+  client->pace_event = evtimer_new(client->ev_base,
+                                   nsdp_client_pace_event, client);
   event_add(client->recv_event, NULL);
+
+  nsdp_client_set_pacing(client, NSDP_CLIENT_PACE_UNICAST,
+                         NSDP_CLIENT_UNICAST_RATE, NSDP_CLIENT_UNICAST_BURST);
+  nsdp_client_set_pacing(client, NSDP_CLIENT_PACE_BROADCAST,
+                         NSDP_CLIENT_BROADCAST_RATE,
+                         NSDP_CLIENT_BROADCAST_BURST);
+  nsdp_client_set_pacing(client, NSDP_CLIENT_PACE_PROBE,
+                         NSDP_CLIENT_PROBE_RATE, NSDP_CLIENT_PROBE_BURST);
+  return 0;
+
+ error:
+  nsdp_client_uninit_iface(client);
+  free(client->send_buffer);
+  free(client->recv_buffer);
+  free(client->seq_owner);
+  client->send_buffer = NULL;
+  client->recv_buffer = NULL;
+  client->seq_owner = NULL;
+  return err;
+}
+
+int nsdp_client_set_mtu(nsdp_client_t *client, unsigned mtu)
+{
+  if (!client || mtu < NSDP_CLIENT_MIN_MTU || mtu > NSDP_CLIENT_MAX_MTU)
+    return -EINVAL;
+  client->mtu = mtu;
+  client->mtu_from_iface = 0;
+  return 0;
+}
+
+const nsdp_client_stats_t* nsdp_client_get_stats(const nsdp_client_t *client)
+{
+  return client ? &client->stats : NULL;
+}
+
+int nsdp_client_set_completion_queue(
+  nsdp_client_t *client, unsigned size,
+  nsdp_client_on_completions_f on_completions, void *context)
+{
+  nsdp_client_completion_t *completion;
+  nsdp_packet_t *packet;
+
+  if (!client || size == 0 || !on_completions)
+    return -EINVAL;
+
+  nsdp_client_flush_completions(client);
+
+  completion = realloc(client->completion, size * sizeof(*completion));
+  if (!completion)
+    return -ENOMEM;
+  client->completion = completion;
+  packet = realloc(client->completion_packet, size * sizeof(*packet));
+  if (!packet)
+    return -ENOMEM;
+  client->completion_packet = packet;
+  client->completion_size = size;
+
+  if (!client->completion_event) {
+    client->completion_event = event_new(client->ev_base, -1, 0,
+                                         nsdp_client_completion_event,
+                                         client);
+    if (!client->completion_event)
+      return -ENOMEM;
+  }
+
+  client->on_completions = on_completions;
+  client->completions_context = context;
   return 0;
 }
 
@@ -319,280 +1659,404 @@ int nsdp_client_write_property(nsdp_client_t *client,
   return nsdp_client_add_request(client, req);
 }
 
-static int nsdp_client_on_scan_response(nsdp_packet_t *response,
-                                        void *context)
-{
-  nsdp_client_t *client = context;
-  nsdp_property_t *property;
-  char value[512];
-
-  if (!response) {
-    printf("Scan timeout!\n");
-    event_base_loopbreak(client->ev_base);
-    return 1;
-  }
-
-  printf("Got scan response from %02x:%02x:%02x:%02x:%02x:%02x\n",
-         response->server_mac[0], response->server_mac[1],
-         response->server_mac[2], response->server_mac[3],
-         response->server_mac[4], response->server_mac[5]);
+typedef struct nsdp_client_apply {
+  nsdp_client_t				*client;
+  nsdp_mac_t				mac;
+  // Desired values
+  struct list_head			properties;
+  nsdp_client_on_apply_f		on_done;
+  void					*context;
+} nsdp_client_apply_t;
 
-  nsdp_packet_for_each_property(response, property) {
-    const struct nsdp_property_desc* desc = nsdp_property_get_desc(property);
-    if (desc) {
-      int len = nsdp_property_to_txt(property, value, sizeof(value));
-      if (len >= 0)
-        printf("  %s: %s\n", desc->name, value);
-      else
-        printf("  %s: (not yet printable)\n", desc->name);
-    } else
-      printf("  %04x: (not yet printable)\n", property->tag);
-  }
+static void nsdp_client_apply_done(nsdp_client_apply_t *apply, int err,
+                                   unsigned written)
+{
+  nsdp_property_t *prop, *next;
 
-  // don't resend the request
-  return 1;
-}
+  if (apply->on_done)
+    apply->on_done(apply->client, apply->mac, err, written, apply->context);
 
-int nsdp_client_do_scan(nsdp_client_t* client, int argc, char*const* argv)
-{
-  nsdp_mac_t all_mac = {};
-  int i;
-  for (i = 0 ; i < 3 ; i += 1) {
-    nsdp_client_read_property(client, all_mac, NULL,
-                         nsdp_client_on_scan_response,
-                         client,
-                         NSDP_PROPERTY_MODEL,
-                         NSDP_PROPERTY_HOSTNAME,
-                         NSDP_PROPERTY_IP,
-                         NSDP_PROPERTY_NETMASK,
-                         NSDP_PROPERTY_GATEWAY,
-                         NSDP_PROPERTY_DHCP,
-                         NSDP_PROPERTY_FIRMWARE_VERSION,
-                         NSDP_PROPERTY_PORT_COUNT,
-                         NSDP_PROPERTY_TERMINATOR);
-    nsdp_client_run(client, 10);
-  }
-  return 0;
+  list_for_each_entry_safe(prop, next, &apply->properties, list)
+    nsdp_property_free(prop);
+  free(apply);
 }
 
-static int nsdp_client_on_read_response(nsdp_packet_t *response,
-                                        void *context)
+static int nsdp_client_on_apply_write(nsdp_packet_t *response, void *context)
 {
-  nsdp_client_t *client = context;
-  nsdp_property_t *property;
-  char value[512];
-  int count = 0;
-
-  if (!response) {
-    printf("Timed out!\n");
-    event_base_loopbreak(client->ev_base);
-    return 1;
-  }
+  nsdp_client_apply_t *apply = context;
+  nsdp_property_t *prop;
+  unsigned written = 0;
+  int err;
 
-  nsdp_packet_for_each_property(response, property) {
-    const struct nsdp_property_desc* desc;
-    if (property->tag == NSDP_PROPERTY_TERMINATOR)
-      break;
-    count += 1;
-    desc = nsdp_property_get_desc(property);
-    if (desc) {
-      int len = nsdp_property_to_txt(property, value, sizeof(value));
-      if (len >= 0)
-        printf("%s: %s\n", desc->desc, value);
-      else
-        printf("%s: (not yet printable)\n", desc->desc);
-    } else
-      printf("0x%04x: (not yet printable)\n", property->tag);
-  }
+  // A refused write, or a wrong password, is in the result code
+  err = response ? nsdp_packet_result_error(response) : -ETIMEDOUT;
 
-  if (count == 0)
-    printf("Empty response\n");
+  // The properties that matched were dropped before the write
+  if (!err)
+    list_for_each_entry(prop, &apply->properties, list)
+      if (prop->tag != NSDP_PROPERTY_PASSWORD)
+        written += 1;
 
-  event_base_loopbreak(client->ev_base);
+  nsdp_client_apply_done(apply, err, written);
   return 1;
 }
 
-int nsdp_client_do_read(nsdp_client_t* client, int argc, char*const* argv)
+static int nsdp_client_on_apply_read(nsdp_packet_t *response, void *context)
 {
+  nsdp_client_apply_t *apply = context;
+  nsdp_property_t *prop, *next, *copy;
   nsdp_client_request_t* req;
-  nsdp_mac_t mac;
-  int i;
+  unsigned count = 0;
+  int err;
 
-  if (argc < 2) {
-    fprintf(stderr,
-            "Usage: nsdp_client [OPTS] -i INTERFACE read MAC PROP...\n");
+  err = response ? nsdp_packet_result_error(response) : -ETIMEDOUT;
+  if (err) {
+    nsdp_client_apply_done(apply, err, 0);
     return 1;
   }
 
-  if (nsdp_property_type_mac.from_text(argv[0], mac, sizeof(mac)) < 0) {
-    fprintf(stderr, "Failed to parse MAC: %s\n", argv[0]);
+  list_for_each_entry_safe(prop, next, &apply->properties, list)
+    if (prop->tag == NSDP_PROPERTY_PASSWORD)
+      continue;
+    else if (nsdp_packet_find_value(response, prop))
+      nsdp_property_free(prop);
+    else
+      count += 1;
+
+  if (count == 0) {
+    nsdp_client_apply_done(apply, 0, 0);
     return 1;
   }
 
-  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST,
-                                mac, NULL,
-                                nsdp_client_on_read_response, client);
+  req = nsdp_client_request_new(NSDP_OP_WRITE_REQUEST, apply->mac, NULL,
+                                nsdp_client_on_apply_write, apply);
   if (!req) {
-    fprintf(stderr, "Failed to create request\n");
+    nsdp_client_apply_done(apply, -ENOMEM, 0);
     return 1;
   }
 
-  for (i = 1 ; i < argc ; i += 1) {
-    const struct nsdp_property_desc* desc = nsdp_get_property_desc(argv[i]);
-    int tag = desc ? desc->tag : strtol(argv[i], NULL, 0);
-    if (tag <= 0) {
-      fprintf(stderr, "Unknown tag type: %s\n", argv[i]);
+  // The password comes first, as given
+  list_for_each_entry(prop, &apply->properties, list) {
+    copy = nsdp_property_from_data(prop->tag, prop->length, prop->data);
+    if (!copy) {
+      nsdp_client_request_free(req);
+      nsdp_client_apply_done(apply, -ENOMEM, 0);
       return 1;
     }
-    nsdp_packet_add_property(&req->packet, nsdp_property_new(tag, 0));
+    nsdp_packet_add_property(&req->packet, copy);
   }
   nsdp_packet_add_properties_terminator(&req->packet);
 
-  nsdp_client_add_request(client, req);
-  return nsdp_client_run(client, -1);
-}
-
-static int nsdp_client_on_write_response(nsdp_packet_t *response,
-                                         void *context)
-{
-  // Just dump the response for now
-  return nsdp_client_on_read_response(response, context);
+  err = nsdp_client_add_request(apply->client, req);
+  if (err) {
+    nsdp_client_request_free(req);
+    nsdp_client_apply_done(apply, err, 0);
+  }
+  return 1;
 }
 
-int nsdp_client_do_write(nsdp_client_t* client, int argc, char*const* argv)
+int nsdp_client_apply(nsdp_client_t *client, const nsdp_mac_t mac,
+                      const struct list_head *properties,
+                      nsdp_client_on_apply_f on_done, void *context)
 {
+  const nsdp_property_t *prop;
   nsdp_client_request_t* req;
-  nsdp_mac_t mac;
-  int i;
+  nsdp_client_apply_t *apply;
+  nsdp_property_t *copy;
+  int err = 0;
 
-  if (argc < 3) {
-    fprintf(stderr,
-            "Usage: nsdp_client [OPTS] -i INTERFACE write MAC PROP VAL...\n");
-    return 1;
-  }
+  if (!client || !mac || !properties)
+    return -EINVAL;
 
-  if (nsdp_property_type_mac.from_text(argv[0], mac, sizeof(mac)) < 0) {
-    fprintf(stderr, "Failed to parse MAC: %s\n", argv[0]);
-    return 1;
-  }
+  apply = calloc(1, sizeof(*apply));
+  if (!apply)
+    return -ENOMEM;
+  apply->client = client;
+  memcpy(apply->mac, mac, sizeof(nsdp_mac_t));
+  INIT_LIST_HEAD(&apply->properties);
 
-  req = nsdp_client_request_new(NSDP_OP_WRITE_REQUEST,
-                                mac, NULL,
-                                nsdp_client_on_write_response, client);
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, apply->mac, NULL,
+                                nsdp_client_on_apply_read, apply);
   if (!req) {
-    fprintf(stderr, "Failed to create request\n");
-    return 1;
+    free(apply);
+    return -ENOMEM;
   }
 
-  for (i = 1 ; i+1 < argc ; i += 2) {
-    const struct nsdp_property_desc* desc = nsdp_get_property_desc(argv[i]);
-    struct nsdp_property* property;
-    if (!desc) {
-      fprintf(stderr, "Unknown tag: %s\n", argv[i]);
-      return 1;
+  list_for_each_entry(prop, properties, list) {
+    if (prop->tag == NSDP_PROPERTY_TERMINATOR)
+      continue;
+    copy = nsdp_property_from_data(prop->tag, prop->length, prop->data);
+    if (!copy) {
+      err = -ENOMEM;
+      break;
     }
-    property = nsdp_property_from_txt(desc, argv[i+1]);
-    if (!property) {
-      fprintf(stderr, "Failed to parse value of tag %s: %s\n",
-              argv[i], argv[i+1]);
-      return 1;
+    list_add_tail(&copy->list, &apply->properties);
+
+    // All the current values come in one read
+    if (prop->tag == NSDP_PROPERTY_PASSWORD)
+      continue;
+    copy = nsdp_property_new(prop->tag, 0);
+    if (!copy) {
+      err = -ENOMEM;
+      break;
     }
-    nsdp_packet_add_property(&req->packet, property);
+    nsdp_packet_add_property(&req->packet, copy);
   }
-  nsdp_packet_add_properties_terminator(&req->packet);
 
-  nsdp_client_add_request(client, req);
-  return nsdp_client_run(client, -1);
+  if (!err && list_empty(&req->packet.properties))
+    err = -EINVAL;
+  if (!err)
+    err = nsdp_packet_add_properties_terminator(&req->packet);
+  if (!err) {
+    apply->on_done = on_done;
+    apply->context = context;
+    err = nsdp_client_add_request(client, req);
+  }
+  // The errors are only returned, without calling on_done
+  if (err) {
+    nsdp_client_request_free(req);
+    apply->on_done = NULL;
+    nsdp_client_apply_done(apply, 0, 0);
+    return err;
+  }
+
+  return 0;
+}
+
+// State shared by the scans and sweeps
+typedef struct nsdp_client_scan {
+  nsdp_client_t				*client;
+  nsdp_inventory_t			*inventory;
+  // Range of the sweep, in host order
+  uint32_t				base;
+  uint32_t				count;
+  uint32_t				next;
+  unsigned				pending;
+  // First error that stopped the sweep, passed to on_done
+  int					err;
+
+  nsdp_client_on_done_f			on_done;
+  void					*context;
+} nsdp_client_scan_t;
+
+static const nsdp_tag_t nsdp_client_scan_tags[] = {
+  NSDP_PROPERTY_MODEL,
+  NSDP_PROPERTY_HOSTNAME,
+  NSDP_PROPERTY_IP,
+  NSDP_PROPERTY_NETMASK,
+  NSDP_PROPERTY_GATEWAY,
+  NSDP_PROPERTY_DHCP,
+  NSDP_PROPERTY_FIRMWARE_VERSION,
+  NSDP_PROPERTY_PORT_COUNT,
+};
+
+static const nsdp_tag_t nsdp_client_probe_tags[] = {
+  NSDP_PROPERTY_MODEL,
+  NSDP_PROPERTY_MAC,
+  NSDP_PROPERTY_IP,
+};
+
+static int nsdp_client_request_add_tags(nsdp_client_request_t* req,
+                                        const nsdp_tag_t *tags,
+                                        unsigned count)
+{
+  nsdp_property_t *prop;
+  unsigned i;
+
+  for (i = 0 ; i < count ; i += 1) {
+    prop = nsdp_property_new(tags[i], 0);
+    if (!prop)
+      return -ENOMEM;
+    nsdp_packet_add_property(&req->packet, prop);
+  }
+  return nsdp_packet_add_properties_terminator(&req->packet);
 }
 
-int nsdp_drop_privileges(void)
+static void nsdp_client_scan_done(nsdp_client_scan_t *scan)
 {
-  int err = 0;
-  if (!err && getuid() != geteuid())
-    err = seteuid(getuid());
-  if (!err && getgid() != getegid())
-    err = setegid(getgid());
-  return err;
+  if (scan->on_done)
+    scan->on_done(scan->client, scan->err, scan->context);
+  free(scan);
 }
 
-void usage(int ret)
+static int nsdp_client_on_scan_response(nsdp_packet_t *response,
+                                        void *context)
 {
-  printf("Usage: nsdp_client [OPTS] -i INTERFACE [scan|read|write] ...\n");
-  exit(ret);
+  nsdp_client_scan_t *scan = context;
+
+  if (response)
+    nsdp_inventory_update_iface(scan->inventory, response,
+                                scan->client->iface);
+  else
+    nsdp_client_scan_done(scan);
+  return 1;
 }
 
-int main(int argc, char*const* argv)
+int nsdp_client_scan(nsdp_client_t *client, nsdp_inventory_t *inventory,
+                     nsdp_client_on_done_f on_done, void *context)
 {
-  nsdp_client_t client;
-  struct event_base *ev_base;
-  char* mac = NULL;
-  char* iface = NULL;
-  unsigned client_port = 0;
-  unsigned server_port = 0;
-  char* action;
-  int (*do_action)(nsdp_client_t* client, int argc, char*const* argv);
-  int opt, err;
+  nsdp_mac_t all_mac = {};
+  nsdp_client_request_t* req;
+  nsdp_client_scan_t *scan;
+  int err;
 
-  srandom(time(NULL));
+  if (!client || !inventory)
+    return -EINVAL;
 
-  while ((opt = getopt(argc, argv, "hm:i:c:s:")) >= 0) {
-    switch (opt) {
-    case '?':
-    case 'h':
-      usage(opt != 'h');
-      /* no return */
-    case 'm':
-      mac = optarg;
-      break;
-    case 'i':
-      iface = optarg;
-      break;
-    case 'c':
-      client_port = atoi(optarg);
-      break;
-    case 's':
-      server_port = atoi(optarg);
-      break;
-    }
+  scan = calloc(1, sizeof(*scan));
+  if (!scan)
+    return -ENOMEM;
+  scan->client = client;
+  scan->inventory = inventory;
+  scan->on_done = on_done;
+  scan->context = context;
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, all_mac, NULL,
+                                nsdp_client_on_scan_response, scan);
+  if (!req) {
+    free(scan);
+    return -ENOMEM;
   }
+  req->collect = 1;
 
-  if (optind >= argc)
-    usage(1);
+  err = nsdp_client_request_add_tags(req, nsdp_client_scan_tags,
+                                     ARRAY_SIZE(nsdp_client_scan_tags));
+  if (err) {
+    nsdp_client_request_free(req);
+    free(scan);
+    return err;
+  }
 
-  action = argv[optind];
-  optind += 1;
+  inventory->generation += 1;
+  return nsdp_client_add_request(client, req);
+}
 
-  if (!strcmp(action, "scan"))
-    do_action = nsdp_client_do_scan;
-  else if (!strcmp(action, "read"))
-    do_action = nsdp_client_do_read;
-  else if (!strcmp(action, "write"))
-    do_action = nsdp_client_do_write;
-  else if (!strcmp(action, "help"))
-    usage(0);
-  else
-    usage(1);
+static int nsdp_client_parse_cidr(const char *cidr,
+                                  uint32_t *base, uint32_t *count)
+{
+  unsigned a, b, c, d, len = 32;
+  uint32_t mask;
+  int n;
 
-  ev_base = event_base_new();
-  if (!ev_base) {
-    fprintf(stderr, "Failed to get event base\n");
-    return 1;
+  n = sscanf(cidr, "%u.%u.%u.%u/%u", &a, &b, &c, &d, &len);
+  if (n < 4 || a > 255 || b > 255 || c > 255 || d > 255 || len > 32)
+    return -EINVAL;
+  // Don't let a typo flood a whole class A
+  if (len < 8)
+    return -E2BIG;
+
+  mask = ~0u << (32 - len);
+  *base = ((a << 24) | (b << 16) | (c << 8) | d) & mask;
+  *count = ~mask + 1;
+
+  // Skip the network and broadcast addresses
+  if (len < 31) {
+    *base += 1;
+    *count -= 2;
   }
 
-  err = nsdp_client_init(&client, ev_base, mac, iface,
-                         client_port, server_port);
-  if (err) {
-    fprintf(stderr, "Failed to init client: %s\n",
-            strerror(-err));
-    return 1;
+  return 0;
+}
+
+static int nsdp_client_on_probe_response(nsdp_packet_t *response,
+                                         void *context);
+
+// Queue the next probes, keeping a bounded number of them in flight
+static int nsdp_client_sweep_fill(nsdp_client_scan_t *scan)
+{
+  nsdp_mac_t all_mac = {};
+  nsdp_client_request_t* req;
+  nsdp_socket_addr_t addr;
+  uint8_t ip4[4];
+  uint32_t ip;
+  int err;
+
+  while (scan->next < scan->count &&
+         scan->pending < NSDP_CLIENT_SWEEP_INFLIGHT) {
+    ip = scan->base + scan->next;
+    ip4[0] = ip >> 24;
+    ip4[1] = ip >> 16;
+    ip4[2] = ip >> 8;
+    ip4[3] = ip;
+
+    memset(&addr, 0, sizeof(addr));
+    nsdp_socket_addr_from_ip4(&addr, ip4);
+    nsdp_socket_addr_set_port(&addr, scan->client->server_port);
+
+    req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, all_mac, &addr,
+                                  nsdp_client_on_probe_response, scan);
+    if (!req) {
+      err = -ENOMEM;
+      goto fail;
+    }
+    req->probe = 1;
+    req->timeout = NSDP_CLIENT_SWEEP_TIMEOUT;
+    req->retry_count = NSDP_CLIENT_SWEEP_RETRIES;
+
+    err = nsdp_client_request_add_tags(req, nsdp_client_probe_tags,
+                                       ARRAY_SIZE(nsdp_client_probe_tags));
+    if (err) {
+      nsdp_client_request_free(req);
+      goto fail;
+    }
+
+    nsdp_client_queue_request(scan->client, req);
+    scan->next += 1;
+    scan->pending += 1;
   }
 
-  err = nsdp_drop_privileges();
-  if (err) {
-    fprintf(stderr, "Failed to drop privileges: %s\n",
-            strerror(-err));
-    return 1;
+  return 0;
+
+fail:
+  // Don't leave holes in the range, stop there and report it
+  scan->err = err;
+  scan->next = scan->count;
+  return err;
+}
+
+static int nsdp_client_on_probe_response(nsdp_packet_t *response,
+                                         void *context)
+{
+  nsdp_client_scan_t *scan = context;
+
+  if (response)
+    nsdp_inventory_update_iface(scan->inventory, response,
+                                scan->client->iface);
+
+  scan->pending -= 1;
+  nsdp_client_sweep_fill(scan);
+  if (scan->pending == 0)
+    nsdp_client_scan_done(scan);
+  return 1;
+}
+
+int nsdp_client_sweep(nsdp_client_t *client, const char *cidr,
+                      nsdp_inventory_t *inventory,
+                      nsdp_client_on_done_f on_done, void *context)
+{
+  nsdp_client_scan_t *scan;
+  int err;
+
+  if (!client || !cidr || !inventory)
+    return -EINVAL;
+
+  scan = calloc(1, sizeof(*scan));
+  if (!scan)
+    return -ENOMEM;
+  scan->client = client;
+  scan->inventory = inventory;
+  scan->on_done = on_done;
+  scan->context = context;
+
+  err = nsdp_client_parse_cidr(cidr, &scan->base, &scan->count);
+  if (!err)
+    err = nsdp_client_sweep_fill(scan);
+  if (err && scan->pending == 0) {
+    free(scan);
+    return err;
   }
 
-  return do_action(&client, argc-optind, argv+optind);
+  inventory->generation += 1;
+  nsdp_client_dispatch(client);
+  return 0;
 }
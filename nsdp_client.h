@@ -0,0 +1,373 @@
+#ifndef NSDP_CLIENT_H
+#define NSDP_CLIENT_H
+
+#include <event.h>
+
+#include "nsdp_socket.h"
+#include "nsdp_iface.h"
+#include "nsdp_packet.h"
+#include "nsdp_inventory.h"
+
+#define NSDP_CLIENT_DEFAULT_MTU		1500
+#define NSDP_CLIENT_MIN_MTU		576
+#define NSDP_CLIENT_MAX_MTU		65535
+// IPv4 and UDP headers
+#define NSDP_CLIENT_MTU_OVERHEAD	28
+
+// Congestion window of each device, in packets
+#define NSDP_CLIENT_INITIAL_WINDOW	2
+#define NSDP_CLIENT_MAX_WINDOW		32
+// Bytes allowed in flight for each packet of the window
+#define NSDP_CLIENT_WINDOW_BYTES	512
+
+#define NSDP_CLIENT_DEVICE_HASH_SIZE	256
+#define NSDP_CLIENT_REQUEST_HASH_SIZE	1024
+
+// Default pacing of the sent packets, in packets per second
+#define NSDP_CLIENT_UNICAST_RATE	500
+#define NSDP_CLIENT_UNICAST_BURST	32
+#define NSDP_CLIENT_BROADCAST_RATE	20
+#define NSDP_CLIENT_BROADCAST_BURST	4
+
+#define NSDP_CLIENT_PROBE_RATE		10000
+#define NSDP_CLIENT_PROBE_BURST		64
+
+#define NSDP_CLIENT_PACE_UNICAST	0
+#define NSDP_CLIENT_PACE_BROADCAST	1
+// Sweep probes, each one goes to a different address
+#define NSDP_CLIENT_PACE_PROBE		2
+#define NSDP_CLIENT_PACE_COUNT		3
+
+// Classes of the queued requests, from the most urgent
+#define NSDP_CLIENT_PRIORITY_INTERACTIVE	0
+#define NSDP_CLIENT_PRIORITY_WRITE	1
+#define NSDP_CLIENT_PRIORITY_BULK	2
+#define NSDP_CLIENT_PRIORITY_COUNT	3
+
+// Packets read from the socket at once before handling the events
+#define NSDP_CLIENT_RECV_BATCH		64
+#define NSDP_CLIENT_DEFAULT_COMPLETIONS	256
+
+// Probes in flight during a sweep, limited by the seq no space
+#define NSDP_CLIENT_SWEEP_INFLIGHT	8192
+#define NSDP_CLIENT_SWEEP_TIMEOUT	1
+#define NSDP_CLIENT_SWEEP_RETRIES	2
+
+// Called with the response, or NULL when the request timed out or
+// couldn't be sent
+typedef int (*nsdp_client_on_response_f)(nsdp_packet_t *response,
+                                         void *context);
+
+struct nsdp_client;
+
+// Called at the end of a scan or sweep, err is set when it stopped early
+typedef void (*nsdp_client_on_done_f)(struct nsdp_client *client, int err,
+                                      void *context);
+
+struct nsdp_client_request;
+
+// Called on the requests being added, can change their properties
+typedef void (*nsdp_client_request_filter_f)(
+  struct nsdp_client *client, struct nsdp_client_request *req,
+  void *context);
+
+// Called at the end of an apply, with the number of properties written
+typedef void (*nsdp_client_on_apply_f)(struct nsdp_client *client,
+                                       const nsdp_mac_t mac, int err,
+                                       unsigned written, void *context);
+
+// Result of a request completed through the completion queue, the
+// status is 0 with the packet, or -ETIMEDOUT or the send error without
+// it. The collect
+// requests get one result per answer and end with their timeout.
+typedef struct nsdp_client_completion {
+  int					status;
+  uint32_t				id;
+  nsdp_seq_no_t				seq_no;
+  nsdp_mac_t				mac;
+  // Only valid during the callback
+  nsdp_packet_t				*packet;
+  void					*context;
+} nsdp_client_completion_t;
+
+typedef void (*nsdp_client_on_completions_f)(
+  struct nsdp_client *client, nsdp_client_completion_t *completions,
+  unsigned count, void *context);
+
+typedef struct nsdp_client_chunk {
+  nsdp_property_t			*first;
+  unsigned				count;
+  int					done;
+} nsdp_client_chunk_t;
+
+// A packet sent for a request, all of them stay valid until the
+// request is done, so that a late answer to a previous send is used.
+typedef struct nsdp_client_send {
+  nsdp_seq_no_t				seq_no;
+  unsigned				chunk;
+  unsigned				attempt;
+} nsdp_client_send_t;
+
+// Congestion state of a device, the window grows by one packet
+// per window of timely answers and is halved on timeouts.
+typedef struct nsdp_client_device {
+  struct hlist_node			hash;
+  nsdp_mac_t				mac;
+  // Management address learned from the answers
+  nsdp_socket_addr_t			addr;
+  int					has_addr;
+  double				window;
+  unsigned				inflight_packets;
+  unsigned				inflight_bytes;
+  // A write is in flight, nothing else can be sent
+  int					exclusive;
+  // Incremented on every window decrease
+  unsigned				epoch;
+  unsigned				blocked;
+} nsdp_client_device_t;
+
+// Token bucket, a rate of 0 disable the pacing
+typedef struct nsdp_client_pacer {
+  double				rate;
+  double				burst;
+  double				tokens;
+  double				last;
+  unsigned				blocked;
+} nsdp_client_pacer_t;
+
+typedef struct nsdp_client_stats {
+  unsigned long				sent;
+  unsigned long				retransmits;
+  unsigned long				received;
+  unsigned long				duplicates;
+  unsigned long				timeouts;
+  unsigned long				paced;
+  unsigned long				expired;
+  unsigned long				cancelled;
+  // Requests completed because they couldn't be sent
+  unsigned long				failed;
+} nsdp_client_stats_t;
+
+typedef struct nsdp_client_request {
+  struct list_head			list;
+  // Pending reads sent along with this request
+  struct list_head			batch;
+  // Handle to cancel the request, set once it is queued
+  uint32_t				id;
+  struct hlist_node			id_hash;
+  unsigned				timeout;
+  unsigned				retry_count;
+  // Absolute time, from gettimeofday(), when the request times out
+  // even if it has retries left
+  struct timeval			deadline;
+  int					has_deadline;
+  // The timer is set to the deadline
+  int					at_deadline;
+  // Cancelled while its packet carries a batch, it stays in flight
+  // for the batch without calling its callback
+  int					cancelled;
+  unsigned				send_count;
+  nsdp_socket_addr_t			in_addr;
+  // Send by unicast when the device address is known
+  int					auto_addr;
+  // Go back to broadcast after a unicast timeout
+  int					fallback;
+  // Sweep probe, not limited by the device windows
+  int					probe;
+  // Broadcast that passes all the answers until it times out
+  int					collect;
+  // Send error that ended the request
+  int					error;
+  // NSDP_CLIENT_PRIORITY_* class, write for the writes and
+  // interactive for the reads unless changed before queuing
+  int					priority;
+  nsdp_packet_t				packet;
+
+  // Packets sent for requests that don't fit in the MTU
+  nsdp_client_chunk_t			*chunk;
+  unsigned				chunk_count;
+  unsigned				chunk_pending;
+  // Response collected from all the chunks
+  nsdp_packet_t				response;
+
+  nsdp_client_send_t			*sent;
+  unsigned				sent_count;
+  unsigned				sent_size;
+
+  struct nsdp_client			*client;
+  struct event				timeout_event;
+  // Part of the device window used by this request
+  nsdp_client_device_t			*device;
+  unsigned				window_packets;
+  unsigned				window_bytes;
+  unsigned				epoch;
+
+  nsdp_client_on_response_f		on_response;
+  void					*context;
+} nsdp_client_request_t;
+
+typedef struct nsdp_client {
+  struct event_base			*ev_base;
+
+  nsdp_socket_t				socket;
+  nsdp_mac_t				mac;
+
+  const char				*iface;
+  nsdp_iface_cache_t			iface_cache;
+  int					iface_running;
+  int					mac_from_iface;
+
+  unsigned				client_port;
+  unsigned				server_port;
+  unsigned				mtu;
+  int					mtu_from_iface;
+
+  uint8_t				*send_buffer;
+  uint8_t				*recv_buffer;
+
+  nsdp_seq_no_t				seq_no;
+  // Request that sent each seq no
+  struct nsdp_client_request		**seq_owner;
+  // Seq no of the requests that are done, to drop the late answers
+  uint8_t				retired[(1 << 16) / 8];
+
+  struct hlist_head			device[NSDP_CLIENT_DEVICE_HASH_SIZE];
+  unsigned				dispatch_gen;
+  int					dispatching;
+
+  nsdp_client_pacer_t			pacer[NSDP_CLIENT_PACE_COUNT];
+  struct event				*pace_event;
+
+  nsdp_client_stats_t			stats;
+
+  nsdp_client_request_filter_f		request_filter;
+  void					*request_filter_context;
+
+  // Queued and in flight requests, by id
+  struct hlist_head			request_id[NSDP_CLIENT_REQUEST_HASH_SIZE];
+  uint32_t				next_id;
+
+  struct event				*recv_event;
+  struct event				*iface_event;
+
+  // Results of the requests without callback, passed in batches
+  nsdp_client_completion_t		*completion;
+  nsdp_packet_t				*completion_packet;
+  unsigned				completion_size;
+  unsigned				completion_count;
+  nsdp_client_on_completions_f		on_completions;
+  void					*completions_context;
+  struct event				*completion_event;
+
+  // Requests waiting to be sent, by class
+  struct list_head			request[NSDP_CLIENT_PRIORITY_COUNT];
+  // Requests sent by each class in turn, 0 for strict priority
+  unsigned				weight[NSDP_CLIENT_PRIORITY_COUNT];
+  // Sweep probes waiting to be sent
+  struct list_head			probe;
+  // Requests waiting for an answer
+  struct list_head			inflight;
+  // Requests that couldn't be sent, completed after the dispatch
+  struct list_head			failed;
+} nsdp_client_t;
+
+// Create a request, without on_response it is completed through the
+// client completion queue
+nsdp_client_request_t*
+nsdp_client_request_new(nsdp_op_t op, nsdp_mac_t server_mac,
+                        nsdp_socket_addr_t* in_addr,
+                        nsdp_client_on_response_f on_response,
+                        void* context);
+
+void nsdp_client_request_free(nsdp_client_request_t* req);
+
+// Time the request out at an absolute time, as given by gettimeofday(),
+// must be set before queuing the request
+void nsdp_client_request_set_deadline(nsdp_client_request_t* req,
+                                      const struct timeval *deadline);
+
+int nsdp_client_init(nsdp_client_t *client,
+                     struct event_base *ev_base,
+                     const char* mac,
+                     const char* iface,
+                     unsigned client_port,
+                     unsigned server_port);
+
+// Set the path MTU, jumbo frames must be explicitly enabled here
+int nsdp_client_set_mtu(nsdp_client_t *client, unsigned mtu);
+
+// Set the rate and burst size of one of the NSDP_CLIENT_PACE_* classes
+int nsdp_client_set_pacing(nsdp_client_t *client, int type,
+                           double rate, unsigned burst);
+
+const nsdp_client_stats_t* nsdp_client_get_stats(const nsdp_client_t *client);
+
+// Set the number of requests each class sends in turn, the classes
+// with a weight of 0, or all of them with NULL, strictly go before
+// the lower ones
+int nsdp_client_set_priority_weights(nsdp_client_t *client,
+                                     const unsigned *weights);
+
+// Set a callback that can change the requests before they are queued
+void nsdp_client_set_request_filter(nsdp_client_t *client,
+                                    nsdp_client_request_filter_f filter,
+                                    void *context);
+
+// Pass the results of the requests that have no on_response callback
+// to on_completions, all the results of an event loop iteration at
+// once, or size of them when the queue gets full
+int nsdp_client_set_completion_queue(
+  nsdp_client_t *client, unsigned size,
+  nsdp_client_on_completions_f on_completions, void *context);
+
+int nsdp_client_run(nsdp_client_t *client, int timeout);
+
+// Queue a request, the client takes ownership of it and sets its id
+int nsdp_client_add_request(nsdp_client_t *client,
+                            nsdp_client_request_t* req);
+
+// Drop a queued or in flight request, its callback is not called and
+// its late answers are ignored. Return -ENOENT if it is already done.
+int nsdp_client_cancel(nsdp_client_t *client, uint32_t id);
+
+int nsdp_client_send_request(nsdp_client_t *client,
+                             nsdp_client_request_t* req);
+
+// Read a list of properties terminated by NSDP_PROPERTY_TERMINATOR
+int nsdp_client_read_property(nsdp_client_t *client,
+                              nsdp_mac_t server_mac,
+                              nsdp_socket_addr_t* in_addr,
+                              nsdp_client_on_response_f on_response,
+                              void *context, ...);
+
+int nsdp_client_write_property(nsdp_client_t *client,
+                               nsdp_mac_t server_mac,
+                               nsdp_socket_addr_t* in_addr,
+                               nsdp_client_on_response_f on_response,
+                               void *context,
+                               unsigned type, unsigned size, const void* data);
+
+// Set properties of a device to the given values. The current values
+// are read first and only the properties that differ are written, in a
+// single write, no write is sent if they all match. The password
+// properties are only sent along with a write.
+int nsdp_client_apply(nsdp_client_t *client, const nsdp_mac_t mac,
+                      const struct list_head *properties,
+                      nsdp_client_on_apply_f on_done, void *context);
+
+// Use the addresses of the inventory devices for the unicast requests,
+// to start with a loaded snapshot before the first scan answers
+int nsdp_client_learn_addresses(nsdp_client_t *client,
+                                const nsdp_inventory_t *inventory);
+
+// Broadcast a scan and add all the devices that answer to the inventory
+int nsdp_client_scan(nsdp_client_t *client, nsdp_inventory_t *inventory,
+                     nsdp_client_on_done_f on_done, void *context);
+
+// Probe every address of an IPv4 CIDR range by unicast and add
+// the devices that answer to the inventory
+int nsdp_client_sweep(nsdp_client_t *client, const char *cidr,
+                      nsdp_inventory_t *inventory,
+                      nsdp_client_on_done_f on_done, void *context);
+
+#endif /* NSDP_CLIENT_H */
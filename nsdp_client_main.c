@@ -0,0 +1,1252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <event.h>
+
+#include "nsdp_client.h"
+#include "nsdp_listener.h"
+#include "nsdp_watch.h"
+#include "nsdp_port_monitor.h"
+#include "nsdp_snapshot.h"
+#include "nsdp_capability.h"
+#include "nsdp_bulk_write.h"
+#include "nsdp_workflow.h"
+#include "nsdp_output.h"
+
+// Seconds between the snapshot saves while watching
+#define NSDP_CLIENT_SNAPSHOT_INTERVAL	60
+
+// State table file published by the port monitor
+static const char *nsdp_client_state_path;
+// Inventory snapshot loaded at startup and saved after the scans
+static const char *nsdp_client_snapshot_path;
+// Tags supported by the models, saved in the snapshot too
+static nsdp_capability_cache_t *nsdp_client_capability;
+// Devices written at once by a bulk write, and if they are re-read
+static unsigned nsdp_client_bulk_inflight;
+static int nsdp_client_bulk_confirm;
+// Only write the properties that differ
+static int nsdp_client_bulk_diff;
+
+// Columns of the CSV output for the scans
+static const nsdp_tag_t nsdp_client_device_columns[] = {
+  NSDP_PROPERTY_MODEL,
+  NSDP_PROPERTY_HOSTNAME,
+  NSDP_PROPERTY_IP,
+  NSDP_PROPERTY_NETMASK,
+  NSDP_PROPERTY_GATEWAY,
+  NSDP_PROPERTY_DHCP,
+  NSDP_PROPERTY_FIRMWARE_VERSION,
+  NSDP_PROPERTY_PORT_COUNT,
+};
+
+static void nsdp_client_print_properties(const struct list_head *properties)
+{
+  const nsdp_property_t *property;
+  char value[512];
+
+  list_for_each_entry(property, properties, list) {
+    const struct nsdp_property_desc* desc = nsdp_property_get_desc(property);
+    if (property->tag == NSDP_PROPERTY_TERMINATOR)
+      continue;
+    if (desc) {
+      int len = nsdp_property_to_txt(property, value, sizeof(value));
+      if (len >= 0)
+        printf("  %s: %s\n", desc->name, value);
+      else
+        printf("  %s: (not yet printable)\n", desc->name);
+    } else
+      printf("  %04x: (not yet printable)\n", property->tag);
+  }
+}
+
+static void nsdp_client_print_device(nsdp_inventory_t *inventory,
+                                     const nsdp_device_t *device,
+                                     int event, void *context)
+{
+  if (event == NSDP_INVENTORY_EVENT_DEL)
+    return;
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_output_device(event == NSDP_INVENTORY_EVENT_NEW ?
+                       "added" : "changed",
+                       device->mac, &device->properties);
+    return;
+  }
+
+  printf("%s %02x:%02x:%02x:%02x:%02x:%02x\n",
+         event == NSDP_INVENTORY_EVENT_NEW ?
+         "Got scan response from" : "Got changes from",
+         device->mac[0], device->mac[1], device->mac[2],
+         device->mac[3], device->mac[4], device->mac[5]);
+  nsdp_client_print_properties(&device->properties);
+}
+
+static void nsdp_client_on_scan_done(nsdp_client_t *client, int err,
+                                     void *context)
+{
+  nsdp_inventory_t *inventory = context;
+
+  if (err)
+    fprintf(stderr, "Scan stopped early: %s\n", strerror(-err));
+  if (nsdp_output_get_format() == NSDP_OUTPUT_TEXT)
+    printf("Found %u device(s)\n", inventory->count);
+  event_base_loopbreak(client->ev_base);
+}
+
+static void nsdp_client_save_snapshot(const nsdp_inventory_t *inventory)
+{
+  int err;
+
+  if (!nsdp_client_snapshot_path)
+    return;
+
+  err = nsdp_snapshot_save_capabilities(inventory, nsdp_client_capability,
+                                        nsdp_client_snapshot_path);
+  if (err)
+    fprintf(stderr, "Failed to save the snapshot %s: %s\n",
+            nsdp_client_snapshot_path, strerror(-err));
+}
+
+int nsdp_client_do_scan(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_inventory_t inventory;
+  int err;
+
+  nsdp_inventory_init(&inventory);
+  nsdp_inventory_set_on_change(&inventory, nsdp_client_print_device, NULL);
+  nsdp_output_set_columns(nsdp_client_device_columns,
+                          ARRAY_SIZE(nsdp_client_device_columns));
+
+  err = nsdp_client_scan(client, &inventory,
+                         nsdp_client_on_scan_done, &inventory);
+  if (err) {
+    fprintf(stderr, "Failed to start the scan: %s\n", strerror(-err));
+    return 1;
+  }
+
+  nsdp_client_run(client, -1);
+  nsdp_client_save_snapshot(&inventory);
+  nsdp_inventory_uninit(&inventory);
+  return 0;
+}
+
+int nsdp_client_do_sweep(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_inventory_t inventory;
+  int err;
+
+  if (argc < 1) {
+    fprintf(stderr, "Usage: nsdp_client [OPTS] sweep CIDR\n");
+    return 1;
+  }
+
+  nsdp_inventory_init(&inventory);
+  nsdp_inventory_set_on_change(&inventory, nsdp_client_print_device, NULL);
+  nsdp_output_set_columns(nsdp_client_device_columns,
+                          ARRAY_SIZE(nsdp_client_device_columns));
+
+  err = nsdp_client_sweep(client, argv[0], &inventory,
+                          nsdp_client_on_scan_done, &inventory);
+  if (err) {
+    fprintf(stderr, "Failed to start the sweep of %s: %s\n",
+            argv[0], strerror(-err));
+    return 1;
+  }
+
+  nsdp_client_run(client, -1);
+  nsdp_client_save_snapshot(&inventory);
+  nsdp_inventory_uninit(&inventory);
+  return 0;
+}
+
+typedef struct nsdp_client_watch {
+  nsdp_client_t				*client;
+  nsdp_inventory_t			inventory;
+  struct event				*save_timer;
+  // The inventory changed since the last save
+  int					dirty;
+} nsdp_client_watch_t;
+
+static void nsdp_client_watch_save(int fd, short what, void *arg)
+{
+  nsdp_client_watch_t *cw = arg;
+  struct timeval tv = { .tv_sec = NSDP_CLIENT_SNAPSHOT_INTERVAL };
+
+  if (cw->dirty)
+    nsdp_client_save_snapshot(&cw->inventory);
+  cw->dirty = 0;
+  evtimer_add(cw->save_timer, &tv);
+}
+
+static void nsdp_client_print_event(nsdp_inventory_t *inventory,
+                                    const nsdp_device_t *device,
+                                    int event, void *context)
+{
+  nsdp_client_watch_t *cw = context;
+
+  static const char *names[] = {
+    [NSDP_INVENTORY_EVENT_NEW] = "added",
+    [NSDP_INVENTORY_EVENT_CHANGE] = "changed",
+    [NSDP_INVENTORY_EVENT_DEL] = "removed",
+  };
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT)
+    nsdp_output_device(names[event], device->mac,
+                       event != NSDP_INVENTORY_EVENT_DEL ?
+                       &device->properties : NULL);
+  else
+    printf("%s %02x:%02x:%02x:%02x:%02x:%02x\n", names[event],
+           device->mac[0], device->mac[1], device->mac[2],
+           device->mac[3], device->mac[4], device->mac[5]);
+  // The events are usually piped to another tool
+  fflush(stdout);
+  cw->dirty = 1;
+}
+
+int nsdp_client_do_watch(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_client_watch_t cw = { .client = client };
+  nsdp_watch_t watch;
+  int err;
+
+  nsdp_inventory_init(&cw.inventory);
+  nsdp_output_set_columns(nsdp_client_device_columns,
+                          ARRAY_SIZE(nsdp_client_device_columns));
+
+  // Start from the last snapshot, the scans only report the differences
+  if (nsdp_client_snapshot_path) {
+    err = nsdp_snapshot_load(&cw.inventory, nsdp_client_snapshot_path);
+    if (err < 0 && err != -ENOENT)
+      fprintf(stderr, "Failed to load the snapshot %s: %s\n",
+              nsdp_client_snapshot_path, strerror(-err));
+    nsdp_client_learn_addresses(client, &cw.inventory);
+
+    cw.save_timer = evtimer_new(client->ev_base, nsdp_client_watch_save, &cw);
+    if (!cw.save_timer) {
+      fprintf(stderr, "Failed to create the snapshot timer\n");
+      return 1;
+    }
+    nsdp_client_watch_save(-1, EV_TIMEOUT, &cw);
+  }
+
+  err = nsdp_watch_init(&watch, client, &cw.inventory,
+                        nsdp_client_print_event, &cw);
+  if (err) {
+    fprintf(stderr, "Failed to start watching: %s\n", strerror(-err));
+    return 1;
+  }
+
+  nsdp_watch_set_interval(&watch, argc > 0 ? atoi(argv[0]) : 0,
+                          argc > 1 ? atoi(argv[1]) : 0);
+
+  return nsdp_client_run(client, -1);
+}
+
+static void nsdp_client_print_port(nsdp_port_monitor_t *monitor,
+                                   const nsdp_mac_t mac, unsigned port,
+                                   const uint8_t *old_status,
+                                   const uint8_t *status, void *context)
+{
+  char old_txt[64], txt[64];
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_property_t *prop =
+      nsdp_property_from_data(NSDP_PROPERTY_PORT_STATUS,
+                              NSDP_PORT_STATUS_SIZE, status);
+    if (prop) {
+      nsdp_output_port("changed", mac, prop);
+      nsdp_property_free(prop);
+    }
+    nsdp_output_flush();
+    return;
+  }
+
+  if (nsdp_property_type_port_status.to_text(
+        old_status, NSDP_PORT_STATUS_SIZE, old_txt, sizeof(old_txt)) < 0)
+    snprintf(old_txt, sizeof(old_txt), "?");
+  if (nsdp_property_type_port_status.to_text(
+        status, NSDP_PORT_STATUS_SIZE, txt, sizeof(txt)) < 0)
+    snprintf(txt, sizeof(txt), "?");
+
+  printf("%02x:%02x:%02x:%02x:%02x:%02x port %u: %s -> %s\n",
+         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+         port, old_txt, txt);
+  fflush(stdout);
+}
+
+int nsdp_client_do_monitor(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_port_monitor_t monitor;
+  nsdp_state_table_t table;
+  nsdp_mac_t mac;
+  int i, err;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: nsdp_client [OPTS] monitor INTERVAL_MS MAC...\n");
+    return 1;
+  }
+
+  err = nsdp_port_monitor_init(&monitor, client,
+                               nsdp_client_print_port, NULL);
+  if (!err)
+    err = nsdp_port_monitor_set_interval(&monitor, atoi(argv[0]));
+  if (err) {
+    fprintf(stderr, "Failed to start the port monitor: %s\n",
+            strerror(-err));
+    return 1;
+  }
+
+  if (nsdp_client_state_path) {
+    err = nsdp_state_table_create(&table, nsdp_client_state_path, 0);
+    if (!err)
+      err = nsdp_port_monitor_set_state_table(&monitor, &table);
+    if (err) {
+      fprintf(stderr, "Failed to create the state table %s: %s\n",
+              nsdp_client_state_path, strerror(-err));
+      return 1;
+    }
+  }
+
+  for (i = 1 ; i < argc ; i += 1) {
+    if (nsdp_property_type_mac.from_text(argv[i], mac, sizeof(mac)) < 0) {
+      fprintf(stderr, "Failed to parse MAC: %s\n", argv[i]);
+      return 1;
+    }
+    nsdp_port_monitor_subscribe(&monitor, mac);
+  }
+
+  return nsdp_client_run(client, -1);
+}
+
+static int nsdp_client_on_read_response(nsdp_packet_t *response,
+                                        void *context)
+{
+  nsdp_client_t *client = context;
+  nsdp_property_t *property;
+  char value[512];
+  int count = 0;
+
+  if (!response) {
+    fprintf(nsdp_output_get_format() == NSDP_OUTPUT_TEXT ? stdout : stderr,
+            "Timed out!\n");
+    event_base_loopbreak(client->ev_base);
+    return 1;
+  }
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_output_device(response->op == NSDP_OP_WRITE_RESPONSE ?
+                       "write" : "read", response->server_mac,
+                       &response->properties);
+    event_base_loopbreak(client->ev_base);
+    return 1;
+  }
+
+  nsdp_packet_for_each_property(response, property) {
+    const struct nsdp_property_desc* desc;
+    if (property->tag == NSDP_PROPERTY_TERMINATOR)
+      break;
+    count += 1;
+    desc = nsdp_property_get_desc(property);
+    if (desc) {
+      int len = nsdp_property_to_txt(property, value, sizeof(value));
+      if (len >= 0)
+        printf("%s: %s\n", desc->desc, value);
+      else
+        printf("%s: (not yet printable)\n", desc->desc);
+    } else
+      printf("0x%04x: (not yet printable)\n", property->tag);
+  }
+
+  if (count == 0)
+    printf("Empty response\n");
+
+  event_base_loopbreak(client->ev_base);
+  return 1;
+}
+
+// Create a read request from MAC PROP... arguments, the tags
+// array gets the read tags.
+static nsdp_client_request_t*
+nsdp_client_parse_read(int argc, char*const* argv, nsdp_tag_t *tags,
+                       nsdp_client_on_response_f on_response, void *context)
+{
+  nsdp_client_request_t* req;
+  nsdp_mac_t mac;
+  int i;
+
+  if (nsdp_property_type_mac.from_text(argv[0], mac, sizeof(mac)) < 0) {
+    fprintf(stderr, "Failed to parse MAC: %s\n", argv[0]);
+    return NULL;
+  }
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST,
+                                mac, NULL, on_response, context);
+  if (!req) {
+    fprintf(stderr, "Failed to create request\n");
+    return NULL;
+  }
+
+  for (i = 1 ; i < argc ; i += 1) {
+    const struct nsdp_property_desc* desc = nsdp_get_property_desc(argv[i]);
+    int tag = desc ? desc->tag : strtol(argv[i], NULL, 0);
+    if (tag <= 0) {
+      fprintf(stderr, "Unknown tag type: %s\n", argv[i]);
+      nsdp_client_request_free(req);
+      return NULL;
+    }
+    nsdp_packet_add_property(&req->packet, nsdp_property_new(tag, 0));
+    if (tags)
+      tags[i - 1] = tag;
+  }
+  nsdp_packet_add_properties_terminator(&req->packet);
+
+  return req;
+}
+
+int nsdp_client_do_read(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_client_request_t* req;
+  nsdp_tag_t tags[argc];
+
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: nsdp_client [OPTS] -i INTERFACE read MAC PROP...\n");
+    return 1;
+  }
+
+  req = nsdp_client_parse_read(argc, argv, tags,
+                               nsdp_client_on_read_response, client);
+  if (!req)
+    return 1;
+  nsdp_output_set_columns(tags, argc - 1);
+
+  nsdp_client_add_request(client, req);
+  return nsdp_client_run(client, -1);
+}
+
+static int nsdp_client_on_write_response(nsdp_packet_t *response,
+                                         void *context)
+{
+  // Just dump the response for now
+  return nsdp_client_on_read_response(response, context);
+}
+
+// Add the properties of PROP VAL... arguments to a packet
+static int nsdp_client_parse_values(int argc, char*const* argv,
+                                    nsdp_packet_t *packet)
+{
+  int i;
+
+  for (i = 0 ; i+1 < argc ; i += 2) {
+    const struct nsdp_property_desc* desc = nsdp_get_property_desc(argv[i]);
+    struct nsdp_property* property;
+    if (!desc) {
+      fprintf(stderr, "Unknown tag: %s\n", argv[i]);
+      return -EINVAL;
+    }
+    property = nsdp_property_from_txt(desc, argv[i+1]);
+    if (!property) {
+      fprintf(stderr, "Failed to parse value of tag %s: %s\n",
+              argv[i], argv[i+1]);
+      return -EINVAL;
+    }
+    nsdp_packet_add_property(packet, property);
+  }
+
+  return 0;
+}
+
+// Create a write request from MAC PROP VAL... arguments
+static nsdp_client_request_t*
+nsdp_client_parse_write(int argc, char*const* argv,
+                        nsdp_client_on_response_f on_response, void *context)
+{
+  nsdp_client_request_t* req;
+  nsdp_mac_t mac;
+
+  if (nsdp_property_type_mac.from_text(argv[0], mac, sizeof(mac)) < 0) {
+    fprintf(stderr, "Failed to parse MAC: %s\n", argv[0]);
+    return NULL;
+  }
+
+  req = nsdp_client_request_new(NSDP_OP_WRITE_REQUEST,
+                                mac, NULL, on_response, context);
+  if (!req) {
+    fprintf(stderr, "Failed to create request\n");
+    return NULL;
+  }
+
+  if (nsdp_client_parse_values(argc - 1, argv + 1, &req->packet)) {
+    nsdp_client_request_free(req);
+    return NULL;
+  }
+  nsdp_packet_add_properties_terminator(&req->packet);
+
+  return req;
+}
+
+int nsdp_client_do_write(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_client_request_t* req;
+
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: nsdp_client [OPTS] -i INTERFACE write MAC PROP VAL...\n");
+    return 1;
+  }
+
+  req = nsdp_client_parse_write(argc, argv,
+                                nsdp_client_on_write_response, client);
+  if (!req)
+    return 1;
+
+  nsdp_client_add_request(client, req);
+  return nsdp_client_run(client, -1);
+}
+
+static void nsdp_client_on_bulk_result(nsdp_bulk_write_t *bulk,
+                                       const nsdp_bulk_write_target_t *target,
+                                       void *context)
+{
+  const uint8_t *mac = target->mac;
+  const char *event;
+
+  if (target->err == 0 && target->written == 0)
+    event = "unchanged";
+  else if (target->err == 0)
+    event = bulk->confirm ? "confirmed" : "written";
+  else if (target->err == -ETIMEDOUT)
+    event = "timeout";
+  else if (target->err == -EIO)
+    event = "mismatch";
+  else if (target->err == -EACCES)
+    event = "denied";
+  else
+    event = "failed";
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT)
+    nsdp_output_device(event, mac, NULL);
+  else
+    printf("[%u/%u] %02x:%02x:%02x:%02x:%02x:%02x %s\n",
+           bulk->completed, bulk->total,
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], event);
+  // Let the progress be followed while the rollout runs
+  nsdp_output_flush();
+  fflush(stdout);
+}
+
+static void nsdp_client_on_bulk_done(nsdp_bulk_write_t *bulk, void *context)
+{
+  event_base_loopbreak(bulk->client->ev_base);
+}
+
+// Add the devices listed in a file, one MAC at the start of each line
+static int nsdp_client_read_devices(nsdp_bulk_write_t *bulk,
+                                    const char *path)
+{
+  char *line = NULL, *mac_txt, *saveptr;
+  size_t size = 0;
+  nsdp_mac_t mac;
+  FILE *file;
+  int err = 0;
+
+  file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+  if (!file) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -errno;
+  }
+
+  while (!err && getline(&line, &size, file) >= 0) {
+    mac_txt = strtok_r(line, " \t\r\n,", &saveptr);
+    // Skip the empty lines and comments
+    if (!mac_txt || mac_txt[0] == '#')
+      continue;
+    if (nsdp_property_type_mac.from_text(mac_txt, mac, sizeof(mac)) < 0) {
+      fprintf(stderr, "Failed to parse MAC: %s\n", mac_txt);
+      err = -EINVAL;
+    } else
+      err = nsdp_bulk_write_add_device(bulk, mac);
+  }
+
+  free(line);
+  if (file != stdin)
+    fclose(file);
+  return err;
+}
+
+int nsdp_client_do_bulk(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_bulk_write_t bulk;
+  nsdp_property_t *prop, *next;
+  nsdp_packet_t values;
+  char summary[64];
+  int err;
+
+  if (argc < 3) {
+    fprintf(stderr, "Usage: nsdp_client [OPTS] -i INTERFACE "
+            "bulk DEVICES PROP VAL...\n");
+    return 1;
+  }
+
+  nsdp_bulk_write_init(&bulk, client, nsdp_client_on_bulk_result,
+                       nsdp_client_on_bulk_done, NULL);
+  nsdp_bulk_write_set_confirm(&bulk, nsdp_client_bulk_confirm);
+  nsdp_bulk_write_set_diff(&bulk, nsdp_client_bulk_diff);
+  if (nsdp_client_bulk_inflight)
+    nsdp_bulk_write_set_inflight(&bulk, nsdp_client_bulk_inflight);
+
+  nsdp_packet_init(&values);
+  err = nsdp_client_parse_values(argc - 1, argv + 1, &values);
+  list_for_each_entry_safe(prop, next, &values.properties, list) {
+    list_del(&prop->list);
+    nsdp_bulk_write_add_property(&bulk, prop);
+  }
+  nsdp_packet_uninit(&values);
+
+  if (!err)
+    err = nsdp_client_read_devices(&bulk, argv[0]);
+  if (!err)
+    err = nsdp_bulk_write_start(&bulk);
+  if (err) {
+    nsdp_bulk_write_uninit(&bulk);
+    return 1;
+  }
+
+  if (bulk.completed < bulk.total)
+    nsdp_client_run(client, -1);
+
+  snprintf(summary, sizeof(summary), "%u/%u device(s) failed",
+           bulk.failed, bulk.total);
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT)
+    nsdp_output_status("done", summary);
+  else
+    printf("Done, %s\n", summary);
+
+  err = bulk.failed ? 1 : 0;
+  nsdp_bulk_write_uninit(&bulk);
+  return err;
+}
+
+// Steps of the VLAN workflow
+#define NSDP_CLIENT_VLANS_ENGINE	1
+#define NSDP_CLIENT_VLANS_MEMBERS	2
+
+static void nsdp_client_print_vlans(const nsdp_mac_t mac,
+                                    const struct list_head *properties)
+{
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_output_device("vlans", mac, properties);
+    return;
+  }
+
+  printf("VLANs of %02x:%02x:%02x:%02x:%02x:%02x\n",
+         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  nsdp_client_print_properties(properties);
+}
+
+// Read the VLAN engine, then the VLAN configuration it uses
+static int nsdp_client_vlans_run(nsdp_workflow_t *wf,
+                                 nsdp_packet_t *response, int err)
+{
+  static const nsdp_tag_t engine_tags[] = { NSDP_PROPERTY_VLAN_ENGINE };
+  static const nsdp_tag_t members_tags[] = {
+    NSDP_PROPERTY_VLAN_ENGINE,
+    NSDP_PROPERTY_VLAN_MEMBERS,
+    NSDP_PROPERTY_PORT_PVID,
+  };
+  const nsdp_property_t *prop, *engine;
+  const uint8_t *mac = wf->mac;
+
+  if (err) {
+    fprintf(stderr, "%02x:%02x:%02x:%02x:%02x:%02x: %s\n",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], strerror(-err));
+    return err;
+  }
+
+  switch (wf->step) {
+  case 0:
+    err = nsdp_workflow_read(wf, NSDP_CLIENT_VLANS_ENGINE,
+                                    engine_tags, ARRAY_SIZE(engine_tags));
+    break;
+  case NSDP_CLIENT_VLANS_ENGINE:
+    engine = NULL;
+    nsdp_packet_for_each_property(response, prop)
+      if (prop->tag == NSDP_PROPERTY_VLAN_ENGINE && prop->length == 1)
+        engine = prop;
+    // The VLANs are disabled
+    if (!engine || engine->data[0] == 0) {
+      nsdp_client_print_vlans(mac, &response->properties);
+      return NSDP_WORKFLOW_DONE;
+    }
+    // Only the 802.1Q engines have a PVID for each port
+    err = nsdp_workflow_read(wf, NSDP_CLIENT_VLANS_MEMBERS,
+                                    members_tags,
+                                    engine->data[0] >= 3 ?
+                                    ARRAY_SIZE(members_tags) :
+                                    ARRAY_SIZE(members_tags) - 1);
+    break;
+  case NSDP_CLIENT_VLANS_MEMBERS:
+    nsdp_client_print_vlans(mac, &response->properties);
+    return NSDP_WORKFLOW_DONE;
+  }
+
+  return err < 0 ? err : NSDP_WORKFLOW_WAIT;
+}
+
+static void nsdp_client_on_vlans_done(nsdp_workflow_group_t *group,
+                                      void *context)
+{
+  event_base_loopbreak(group->client->ev_base);
+}
+
+int nsdp_client_do_vlans(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_workflow_group_t group;
+  nsdp_mac_t mac;
+  int i, err;
+
+  if (argc < 1) {
+    fprintf(stderr, "Usage: nsdp_client [OPTS] -i INTERFACE vlans MAC...\n");
+    return 1;
+  }
+
+  nsdp_workflow_group_init(&group, client, nsdp_client_on_vlans_done, NULL);
+
+  // All the devices run their steps at the same time
+  for (i = 0 ; i < argc ; i += 1) {
+    if (nsdp_property_type_mac.from_text(argv[i], mac, sizeof(mac)) < 0) {
+      fprintf(stderr, "Failed to parse MAC: %s\n", argv[i]);
+      continue;
+    }
+    err = nsdp_workflow_start(&group, mac, nsdp_client_vlans_run, NULL);
+    if (err)
+      fprintf(stderr, "Failed to start reading %s: %s\n",
+              argv[i], strerror(-err));
+  }
+
+  nsdp_workflow_group_close(&group);
+  if (group.completed < group.started)
+    nsdp_client_run(client, -1);
+
+  err = group.failed ? 1 : 0;
+  nsdp_workflow_group_uninit(&group);
+  return err;
+}
+
+#define NSDP_CLIENT_BATCH_MAX_ARGS	64
+#define NSDP_CLIENT_BATCH_READ_SIZE	4096
+
+typedef struct nsdp_client_batch {
+  nsdp_client_t				*client;
+  struct event				*input_event;
+  struct evbuffer			*input;
+  int					eof;
+  // Operations that are not done yet
+  unsigned				pending;
+} nsdp_client_batch_t;
+
+typedef struct nsdp_client_batch_op {
+  nsdp_client_batch_t			*batch;
+  char					*id;
+  // Devices found by a scan, NULL for the other operations
+  nsdp_inventory_t			*inventory;
+} nsdp_client_batch_op_t;
+
+// Columns of the CSV output in batch mode
+static const nsdp_tag_t nsdp_client_batch_columns[] = {
+  NSDP_PROPERTY_MODEL,
+  NSDP_PROPERTY_HOSTNAME,
+  NSDP_PROPERTY_IP,
+  NSDP_PROPERTY_NETMASK,
+  NSDP_PROPERTY_GATEWAY,
+  NSDP_PROPERTY_DHCP,
+  NSDP_PROPERTY_FIRMWARE_VERSION,
+  NSDP_PROPERTY_PORT_COUNT,
+  NSDP_PROPERTY_VLAN_ENGINE,
+};
+
+static void nsdp_client_batch_print(nsdp_client_batch_op_t *op,
+                                    const char *event, const nsdp_mac_t mac,
+                                    const struct list_head *properties)
+{
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_output_set_id(op->id);
+    nsdp_output_device(event, mac, properties);
+    nsdp_output_set_id(NULL);
+    return;
+  }
+
+  printf("%s %s %02x:%02x:%02x:%02x:%02x:%02x\n", op->id, event,
+         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  nsdp_client_print_properties(properties);
+}
+
+static void nsdp_client_batch_check_end(nsdp_client_batch_t *batch)
+{
+  if (batch->eof && batch->pending == 0)
+    event_base_loopbreak(batch->client->ev_base);
+}
+
+// Write the final status of an operation and release it
+static void nsdp_client_batch_done(nsdp_client_batch_op_t *op,
+                                   const char *event, const char *message)
+{
+  nsdp_client_batch_t *batch = op->batch;
+
+  if (nsdp_output_get_format() != NSDP_OUTPUT_TEXT) {
+    nsdp_output_set_id(op->id);
+    nsdp_output_status(event, message);
+    nsdp_output_set_id(NULL);
+  } else
+    printf("%s %s%s%s\n", op->id, event,
+           message ? ": " : "", message ? message : "");
+
+  if (op->inventory) {
+    nsdp_inventory_uninit(op->inventory);
+    free(op->inventory);
+  }
+  free(op->id);
+  free(op);
+  batch->pending -= 1;
+  nsdp_client_batch_check_end(batch);
+}
+
+// Write the results of the reads and writes that completed during the
+// same event loop iteration, and flush the output once for all
+static void nsdp_client_batch_on_completions(
+  nsdp_client_t *client, nsdp_client_completion_t *completions,
+  unsigned count, void *context)
+{
+  nsdp_client_completion_t *comp;
+  nsdp_client_batch_op_t *op;
+  unsigned i;
+
+  for (i = 0 ; i < count ; i += 1) {
+    comp = &completions[i];
+    op = comp->context;
+    if (comp->status) {
+      nsdp_client_batch_done(op, "timeout", NULL);
+      continue;
+    }
+
+    nsdp_client_batch_print(op, comp->packet->op == NSDP_OP_WRITE_RESPONSE ?
+                            "write" : "read", comp->mac,
+                            &comp->packet->properties);
+    nsdp_client_batch_done(op, "done", NULL);
+  }
+
+  nsdp_output_flush();
+}
+
+static void nsdp_client_batch_on_device(nsdp_inventory_t *inventory,
+                                        const nsdp_device_t *device,
+                                        int event, void *context)
+{
+  if (event == NSDP_INVENTORY_EVENT_NEW)
+    nsdp_client_batch_print(context, "added", device->mac,
+                            &device->properties);
+}
+
+static void nsdp_client_batch_on_scan_done(nsdp_client_t *client, int err,
+                                           void *context)
+{
+  nsdp_client_batch_op_t *op = context;
+
+  if (err)
+    nsdp_client_batch_done(op, "error", strerror(-err));
+  else
+    nsdp_client_batch_done(op, "done", NULL);
+}
+
+// Start the operation of one line: ID scan|read|write ARGS...
+static void nsdp_client_batch_line(nsdp_client_batch_t *batch, char *line)
+{
+  char *argv[NSDP_CLIENT_BATCH_MAX_ARGS], *saveptr, *arg;
+  nsdp_client_t *client = batch->client;
+  nsdp_client_batch_op_t *op;
+  nsdp_client_request_t *req;
+  int argc = 0, err;
+
+  for (arg = strtok_r(line, " \t\r", &saveptr) ;
+       arg && argc < NSDP_CLIENT_BATCH_MAX_ARGS ;
+       arg = strtok_r(NULL, " \t\r", &saveptr))
+    argv[argc++] = arg;
+
+  // Skip the empty lines and comments
+  if (argc == 0 || argv[0][0] == '#')
+    return;
+
+  op = calloc(1, sizeof(*op));
+  if (!op || !(op->id = strdup(argv[0]))) {
+    fprintf(stderr, "Failed to allocate operation %s\n", argv[0]);
+    free(op);
+    return;
+  }
+  op->batch = batch;
+  batch->pending += 1;
+
+  // Don't run an operation cut short
+  if (arg)
+    err = -E2BIG;
+  else if (argc >= 2 && !strcmp(argv[1], "scan")) {
+    op->inventory = malloc(sizeof(*op->inventory));
+    err = op->inventory ? nsdp_inventory_init(op->inventory) : -ENOMEM;
+    if (err) {
+      free(op->inventory);
+      op->inventory = NULL;
+    } else {
+      nsdp_inventory_set_on_change(op->inventory,
+                                   nsdp_client_batch_on_device, op);
+      err = nsdp_client_scan(client, op->inventory,
+                             nsdp_client_batch_on_scan_done, op);
+    }
+  } else if (argc >= 4 && !strcmp(argv[1], "read")) {
+    req = nsdp_client_parse_read(argc - 2, argv + 2, NULL, NULL, op);
+    err = req ? nsdp_client_add_request(client, req) : -EINVAL;
+  } else if (argc >= 5 && !strcmp(argv[1], "write")) {
+    req = nsdp_client_parse_write(argc - 2, argv + 2, NULL, op);
+    err = req ? nsdp_client_add_request(client, req) : -EINVAL;
+  } else
+    err = -EINVAL;
+
+  if (err)
+    nsdp_client_batch_done(op, "error", strerror(-err));
+}
+
+static void nsdp_client_batch_input(int fd, short what, void *arg)
+{
+  nsdp_client_batch_t *batch = arg;
+  char *line;
+  int len;
+
+  len = evbuffer_read(batch->input, fd, NSDP_CLIENT_BATCH_READ_SIZE);
+  if (len <= 0) {
+    if (len < 0)
+      fprintf(stderr, "Failed to read the operations: %s\n",
+              strerror(errno));
+    batch->eof = 1;
+    if (batch->input_event)
+      event_del(batch->input_event);
+    // Also run the last line if it has no newline
+    if (evbuffer_get_length(batch->input) > 0)
+      evbuffer_add(batch->input, "\n", 1);
+  }
+
+  while ((line = evbuffer_readln(batch->input, NULL, EVBUFFER_EOL_LF))) {
+    nsdp_client_batch_line(batch, line);
+    free(line);
+  }
+
+  nsdp_client_batch_check_end(batch);
+}
+
+int nsdp_client_do_batch(nsdp_client_t* client, int argc, char*const* argv)
+{
+  nsdp_client_batch_t batch = { .client = client };
+  struct stat st;
+  int fd = 0;
+
+  if (argc > 0 && strcmp(argv[0], "-")) {
+    fd = open(argv[0], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Failed to open %s: %s\n", argv[0], strerror(errno));
+      return 1;
+    }
+  }
+
+  batch.input = evbuffer_new();
+  if (!batch.input) {
+    fprintf(stderr, "Failed to allocate the input buffer\n");
+    return 1;
+  }
+
+  // The reads and writes are completed in batches
+  if (nsdp_client_set_completion_queue(client,
+                                       NSDP_CLIENT_DEFAULT_COMPLETIONS,
+                                       nsdp_client_batch_on_completions,
+                                       &batch)) {
+    fprintf(stderr, "Failed to allocate the completion queue\n");
+    evbuffer_free(batch.input);
+    return 1;
+  }
+
+  nsdp_output_set_columns(nsdp_client_batch_columns,
+                          ARRAY_SIZE(nsdp_client_batch_columns));
+
+  // Regular files can't be polled, read them at once
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+    while (!batch.eof)
+      nsdp_client_batch_input(fd, EV_READ, &batch);
+  } else {
+    batch.input_event = event_new(client->ev_base, fd, EV_READ | EV_PERSIST,
+                                  nsdp_client_batch_input, &batch);
+    event_add(batch.input_event, NULL);
+  }
+
+  if (!batch.eof || batch.pending > 0)
+    nsdp_client_run(client, -1);
+
+  if (batch.input_event)
+    event_free(batch.input_event);
+  evbuffer_free(batch.input);
+  if (fd > 0)
+    close(fd);
+  return 0;
+}
+
+static int nsdp_drop_privileges(void)
+{
+  int err = 0;
+  if (!err && getuid() != geteuid())
+    err = seteuid(getuid());
+  if (!err && getgid() != getegid())
+    err = setegid(getgid());
+  return err;
+}
+
+static void usage(int ret)
+{
+  printf("Usage: nsdp_client [OPTS] -i INTERFACE "
+         "[scan|sweep|watch|listen|monitor|read|write|bulk|vlans|batch] ...\n");
+  exit(ret);
+}
+
+// The listener binds the client port itself and sends nothing, so it
+// runs without a client
+static int nsdp_client_listen(struct event_base *ev_base, const char *iface,
+                              unsigned client_port, int argc,
+                              char*const* argv)
+{
+  nsdp_inventory_t inventory;
+  nsdp_listener_t listener;
+  const nsdp_listener_stats_t *stats;
+  struct timeval tv = {};
+  int err;
+
+  nsdp_inventory_init(&inventory);
+  nsdp_inventory_set_on_change(&inventory, nsdp_client_print_device, NULL);
+  nsdp_output_set_columns(nsdp_client_device_columns,
+                          ARRAY_SIZE(nsdp_client_device_columns));
+
+  err = nsdp_listener_init(&listener, ev_base, iface, client_port,
+                           &inventory);
+  if (err) {
+    fprintf(stderr, "Failed to start the listener: %s\n", strerror(-err));
+    nsdp_inventory_uninit(&inventory);
+    return 1;
+  }
+
+  err = nsdp_drop_privileges();
+  if (err) {
+    fprintf(stderr, "Failed to drop privileges: %s\n",
+            strerror(-err));
+    nsdp_listener_uninit(&listener);
+    nsdp_inventory_uninit(&inventory);
+    return 1;
+  }
+
+  // Listen forever, unless a duration is given
+  if (argc > 0) {
+    tv.tv_sec = atoi(argv[0]);
+    event_base_loopexit(ev_base, &tv);
+  }
+  event_base_dispatch(ev_base);
+
+  stats = nsdp_listener_get_stats(&listener);
+  if (nsdp_output_get_format() == NSDP_OUTPUT_TEXT)
+    printf("Found %u device(s) in %lu response(s)\n",
+           inventory.count, stats->responses);
+
+  nsdp_listener_uninit(&listener);
+  nsdp_inventory_uninit(&inventory);
+  return 0;
+}
+
+int main(int argc, char*const* argv)
+{
+  nsdp_client_t client;
+  // Models of the devices the requests go to, and the tags they support
+  nsdp_inventory_t devices;
+  nsdp_capability_cache_t capability;
+  struct event_base *ev_base;
+  char* mac = NULL;
+  char* iface = NULL;
+  unsigned client_port = 0;
+  unsigned server_port = 0;
+  unsigned mtu = 0;
+  double unicast_rate = -1, broadcast_rate = -1, probe_rate = -1;
+  char* action;
+  int (*do_action)(nsdp_client_t* client, int argc, char*const* argv) = NULL;
+  int listen_only = 0;
+  int opt, err;
+  static const struct option long_options[] = {
+    { "format", required_argument, NULL, 'f' },
+    { "state", required_argument, NULL, 'T' },
+    { "snapshot", required_argument, NULL, 'S' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "confirm", no_argument, NULL, 'C' },
+    { "diff", no_argument, NULL, 'D' },
+    { "help", no_argument, NULL, 'h' },
+    {}
+  };
+
+  srandom(time(NULL));
+
+  while ((opt = getopt_long(argc, argv, "hm:i:c:s:M:R:B:P:f:T:S:j:",
+                            long_options, NULL)) >= 0) {
+    switch (opt) {
+    case '?':
+    case 'h':
+      usage(opt != 'h');
+      /* no return */
+    case 'm':
+      mac = optarg;
+      break;
+    case 'i':
+      iface = optarg;
+      break;
+    case 'c':
+      client_port = atoi(optarg);
+      break;
+    case 's':
+      server_port = atoi(optarg);
+      break;
+    case 'M':
+      mtu = atoi(optarg);
+      break;
+    case 'R':
+      unicast_rate = atof(optarg);
+      break;
+    case 'B':
+      broadcast_rate = atof(optarg);
+      break;
+    case 'P':
+      probe_rate = atof(optarg);
+      break;
+    case 'S':
+      nsdp_client_snapshot_path = optarg;
+      break;
+    case 'T':
+      nsdp_client_state_path = optarg;
+      break;
+    case 'j':
+      nsdp_client_bulk_inflight = atoi(optarg);
+      break;
+    case 'C':
+      nsdp_client_bulk_confirm = 1;
+      break;
+    case 'D':
+      nsdp_client_bulk_diff = 1;
+      break;
+    case 'f':
+      if (nsdp_output_set_format(optarg)) {
+        fprintf(stderr, "Unknown output format: %s\n", optarg);
+        usage(1);
+      }
+      break;
+    }
+  }
+
+  if (optind >= argc)
+    usage(1);
+
+  action = argv[optind];
+  optind += 1;
+
+  if (!strcmp(action, "scan"))
+    do_action = nsdp_client_do_scan;
+  else if (!strcmp(action, "batch"))
+    do_action = nsdp_client_do_batch;
+  else if (!strcmp(action, "monitor"))
+    do_action = nsdp_client_do_monitor;
+  else if (!strcmp(action, "watch"))
+    do_action = nsdp_client_do_watch;
+  else if (!strcmp(action, "listen"))
+    listen_only = 1;
+  else if (!strcmp(action, "sweep"))
+    do_action = nsdp_client_do_sweep;
+  else if (!strcmp(action, "read"))
+    do_action = nsdp_client_do_read;
+  else if (!strcmp(action, "write"))
+    do_action = nsdp_client_do_write;
+  else if (!strcmp(action, "bulk"))
+    do_action = nsdp_client_do_bulk;
+  else if (!strcmp(action, "vlans"))
+    do_action = nsdp_client_do_vlans;
+  else if (!strcmp(action, "help"))
+    usage(0);
+  else
+    usage(1);
+
+  ev_base = event_base_new();
+  if (!ev_base) {
+    fprintf(stderr, "Failed to get event base\n");
+    return 1;
+  }
+
+  if (listen_only)
+    return nsdp_client_listen(ev_base, iface, client_port,
+                              argc-optind, argv+optind);
+
+  err = nsdp_client_init(&client, ev_base, mac, iface,
+                         client_port, server_port);
+  if (err) {
+    fprintf(stderr, "Failed to init client: %s\n",
+            strerror(-err));
+    return 1;
+  }
+
+  if (mtu && (err = nsdp_client_set_mtu(&client, mtu))) {
+    fprintf(stderr, "Invalid MTU: %u\n", mtu);
+    return 1;
+  }
+
+  if (unicast_rate >= 0)
+    nsdp_client_set_pacing(&client, NSDP_CLIENT_PACE_UNICAST, unicast_rate,
+                           NSDP_CLIENT_UNICAST_BURST);
+  if (broadcast_rate >= 0)
+    nsdp_client_set_pacing(&client, NSDP_CLIENT_PACE_BROADCAST,
+                           broadcast_rate, NSDP_CLIENT_BROADCAST_BURST);
+  if (probe_rate >= 0)
+    nsdp_client_set_pacing(&client, NSDP_CLIENT_PACE_PROBE, probe_rate,
+                           NSDP_CLIENT_PROBE_BURST);
+
+  // Only ask the devices for the tags their model supports
+  nsdp_inventory_init(&devices);
+  err = nsdp_capability_cache_init(&capability, &client, &devices);
+  if (err) {
+    fprintf(stderr, "Failed to init capability cache: %s\n",
+            strerror(-err));
+    return 1;
+  }
+  nsdp_client_capability = &capability;
+
+  // Don't probe again the models saved in the snapshot
+  if (nsdp_client_snapshot_path) {
+    err = nsdp_snapshot_load_capabilities(&devices, &capability,
+                                          nsdp_client_snapshot_path);
+    if (err < 0 && err != -ENOENT)
+      fprintf(stderr, "Failed to load the snapshot %s: %s\n",
+              nsdp_client_snapshot_path, strerror(-err));
+  }
+
+  err = nsdp_drop_privileges();
+  if (err) {
+    fprintf(stderr, "Failed to drop privileges: %s\n",
+            strerror(-err));
+    return 1;
+  }
+
+  err = do_action(&client, argc-optind, argv+optind);
+
+  nsdp_capability_cache_uninit(&capability);
+  nsdp_inventory_uninit(&devices);
+  return err;
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+
+#include "nsdp_iface.h"
+
+void nsdp_iface_cache_set_on_change(nsdp_iface_cache_t *cache,
+                                    nsdp_iface_on_change_f on_change,
+                                    void *context)
+{
+  if (!cache)
+    return;
+  cache->on_change = on_change;
+  cache->context = context;
+}
+
+int nsdp_iface_cache_fd(const nsdp_iface_cache_t *cache)
+{
+  return cache ? cache->fd : -1;
+}
+
+nsdp_iface_t *nsdp_iface_cache_find(nsdp_iface_cache_t *cache,
+                                    const char *name)
+{
+  nsdp_iface_t *iface;
+
+  if (!cache || !name)
+    return NULL;
+
+  nsdp_iface_cache_for_each(cache, iface)
+    if (!strcmp(iface->name, name))
+      return iface;
+
+  return NULL;
+}
+
+nsdp_iface_t *nsdp_iface_cache_find_index(nsdp_iface_cache_t *cache,
+                                          int index)
+{
+  nsdp_iface_t *iface;
+
+  if (!cache)
+    return NULL;
+
+  nsdp_iface_cache_for_each(cache, iface)
+    if (iface->index == index)
+      return iface;
+
+  return NULL;
+}
+
+int nsdp_iface_is_running(const nsdp_iface_t *iface)
+{
+  return iface &&
+    (iface->flags & (IFF_UP | IFF_RUNNING)) == (IFF_UP | IFF_RUNNING);
+}
+
+nsdp_iface_t *nsdp_iface_cache_get(nsdp_iface_cache_t *cache, int index)
+{
+  nsdp_iface_t *iface = nsdp_iface_cache_find_index(cache, index);
+
+  if (iface || !cache)
+    return iface;
+
+  iface = calloc(1, sizeof(*iface));
+  if (!iface)
+    return NULL;
+
+  iface->index = index;
+  list_add_tail(&iface->list, &cache->ifaces);
+  return iface;
+}
+
+void nsdp_iface_cache_notify(nsdp_iface_cache_t *cache,
+                             nsdp_iface_t *iface, int event)
+{
+  if (cache->on_change)
+    cache->on_change(cache, iface, event, cache->context);
+}
+
+void nsdp_iface_cache_remove(nsdp_iface_cache_t *cache, nsdp_iface_t *iface)
+{
+  if (!iface)
+    return;
+  list_del(&iface->list);
+  free(iface);
+}
+
+void nsdp_iface_cache_clear(nsdp_iface_cache_t *cache)
+{
+  while (!list_empty(&cache->ifaces))
+    nsdp_iface_cache_remove(cache, list_first_entry(&cache->ifaces,
+                                                    nsdp_iface_t, list));
+}
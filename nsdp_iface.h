@@ -0,0 +1,80 @@
+#ifndef NSDP_IFACE_H
+#define NSDP_IFACE_H
+
+#include "nsdp_types.h"
+
+#define NSDP_IFACE_NAME_SIZE		16
+
+#define NSDP_IFACE_EVENT_NEW		1
+#define NSDP_IFACE_EVENT_CHANGE		2
+#define NSDP_IFACE_EVENT_DEL		3
+
+typedef struct nsdp_iface {
+  struct list_head			list;
+  int					index;
+  // Index of the parent device for stacked links (VLAN), 0 if none
+  int					link;
+  // IFF_* flags as reported by the kernel
+  unsigned				flags;
+  unsigned				mtu;
+  nsdp_mac_t				mac;
+  char					name[NSDP_IFACE_NAME_SIZE];
+  // Last cache reload that reported this interface
+  unsigned				generation;
+} nsdp_iface_t;
+
+struct nsdp_iface_cache;
+
+typedef void (*nsdp_iface_on_change_f)(struct nsdp_iface_cache *cache,
+                                       const nsdp_iface_t *iface,
+                                       int event, void *context);
+
+typedef struct nsdp_iface_cache {
+  // Notification socket, -1 if the backend can't notify changes
+  int					fd;
+  uint32_t				seq;
+  unsigned				generation;
+  struct list_head			ifaces;
+
+  nsdp_iface_on_change_f		on_change;
+  void					*context;
+} nsdp_iface_cache_t;
+
+// Load all the interfaces in the cache, if subscribe is set
+// also listen for changes
+int nsdp_iface_cache_init(nsdp_iface_cache_t *cache, int subscribe);
+
+// Release the cache
+void nsdp_iface_cache_uninit(nsdp_iface_cache_t *cache);
+
+// Set the callback called when an interface is added, changed or removed
+void nsdp_iface_cache_set_on_change(nsdp_iface_cache_t *cache,
+                                    nsdp_iface_on_change_f on_change,
+                                    void *context);
+
+// Get the fd to poll for change notifications, -1 if not supported
+int nsdp_iface_cache_fd(const nsdp_iface_cache_t *cache);
+
+// Handle the pending change notifications without blocking
+int nsdp_iface_cache_process(nsdp_iface_cache_t *cache);
+
+// Lookup an interface
+nsdp_iface_t *nsdp_iface_cache_find(nsdp_iface_cache_t *cache,
+                                    const char *name);
+nsdp_iface_t *nsdp_iface_cache_find_index(nsdp_iface_cache_t *cache,
+                                          int index);
+
+// Check if an interface is up and has a carrier
+int nsdp_iface_is_running(const nsdp_iface_t *iface);
+
+#define nsdp_iface_cache_for_each(cache, iface) \
+  list_for_each_entry((iface), &(cache)->ifaces, list)
+
+// Helpers for the backends
+nsdp_iface_t *nsdp_iface_cache_get(nsdp_iface_cache_t *cache, int index);
+void nsdp_iface_cache_notify(nsdp_iface_cache_t *cache,
+                             nsdp_iface_t *iface, int event);
+void nsdp_iface_cache_remove(nsdp_iface_cache_t *cache, nsdp_iface_t *iface);
+void nsdp_iface_cache_clear(nsdp_iface_cache_t *cache);
+
+#endif /* NSDP_IFACE_H */
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "nsdp_socket.h"
+#include "nsdp_iface.h"
+
+#ifndef NETLINK_BUFFER_SIZE
+#define NETLINK_BUFFER_SIZE 32768
+#endif
+
+static void nsdp_iface_netlink_link(nsdp_iface_cache_t *cache,
+                                    struct nlmsghdr *nh)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nh);
+  struct rtattr *rta;
+  int len = IFLA_PAYLOAD(nh);
+  nsdp_iface_t *iface, old;
+  int event;
+
+  iface = nsdp_iface_cache_find_index(cache, ifi->ifi_index);
+
+  if (nh->nlmsg_type == RTM_DELLINK) {
+    if (iface) {
+      nsdp_iface_cache_notify(cache, iface, NSDP_IFACE_EVENT_DEL);
+      nsdp_iface_cache_remove(cache, iface);
+    }
+    return;
+  }
+
+  if (iface) {
+    old = *iface;
+    event = NSDP_IFACE_EVENT_CHANGE;
+  } else {
+    iface = nsdp_iface_cache_get(cache, ifi->ifi_index);
+    if (!iface)
+      return;
+    event = NSDP_IFACE_EVENT_NEW;
+  }
+
+  iface->generation = cache->generation;
+  iface->flags = ifi->ifi_flags;
+  iface->link = 0;
+
+  for (rta = IFLA_RTA(ifi) ; RTA_OK(rta, len) ; rta = RTA_NEXT(rta, len)) {
+    switch (rta->rta_type) {
+    case IFLA_IFNAME:
+      snprintf(iface->name, sizeof(iface->name), "%.*s",
+               (int)RTA_PAYLOAD(rta), (const char*)RTA_DATA(rta));
+      break;
+    case IFLA_ADDRESS:
+      if (RTA_PAYLOAD(rta) == sizeof(nsdp_mac_t))
+        memcpy(iface->mac, RTA_DATA(rta), sizeof(nsdp_mac_t));
+      break;
+    case IFLA_LINK:
+      if (RTA_PAYLOAD(rta) >= sizeof(int))
+        iface->link = *(int*)RTA_DATA(rta);
+      break;
+    case IFLA_MTU:
+      if (RTA_PAYLOAD(rta) >= sizeof(unsigned))
+        iface->mtu = *(unsigned*)RTA_DATA(rta);
+      break;
+    }
+  }
+
+  // Physical devices report themselves as their own link
+  if (iface->link == iface->index)
+    iface->link = 0;
+
+  if (event == NSDP_IFACE_EVENT_CHANGE &&
+      old.flags == iface->flags && old.link == iface->link &&
+      old.mtu == iface->mtu &&
+      !memcmp(old.mac, iface->mac, sizeof(old.mac)) &&
+      !strcmp(old.name, iface->name))
+    return;
+
+  nsdp_iface_cache_notify(cache, iface, event);
+}
+
+// Read one batch of messages, return 1 once the dump with the given
+// seq no is done, 0 if more messages are expected and a negative
+// error code otherwise.
+static int nsdp_iface_netlink_recv(nsdp_iface_cache_t *cache,
+                                   int flags, uint32_t seq)
+{
+  uint32_t buffer[NETLINK_BUFFER_SIZE / sizeof(uint32_t)];
+  struct nlmsghdr *nh;
+  int len, done = 0;
+
+  len = recv(cache->fd, buffer, sizeof(buffer), flags);
+  if (len < 0)
+    return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+
+  for (nh = (struct nlmsghdr*)buffer ; NLMSG_OK(nh, len) ;
+       nh = NLMSG_NEXT(nh, len)) {
+    switch (nh->nlmsg_type) {
+    case NLMSG_DONE:
+      if (seq && nh->nlmsg_seq == seq)
+        done = 1;
+      break;
+    case NLMSG_ERROR:
+      if (seq && nh->nlmsg_seq == seq) {
+        const struct nlmsgerr *err = NLMSG_DATA(nh);
+        return err->error < 0 ? err->error : 1;
+      }
+      break;
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+      nsdp_iface_netlink_link(cache, nh);
+      break;
+    }
+  }
+
+  return done;
+}
+
+static int nsdp_iface_netlink_dump(nsdp_iface_cache_t *cache)
+{
+  struct {
+    struct nlmsghdr	nh;
+    struct ifinfomsg	ifi;
+  } req = {
+    .nh = {
+      .nlmsg_len = sizeof(req),
+      .nlmsg_type = RTM_GETLINK,
+      .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+    },
+    .ifi = {
+      .ifi_family = AF_UNSPEC,
+    },
+  };
+  nsdp_iface_t *iface, *next;
+  int err;
+
+  cache->generation += 1;
+  req.nh.nlmsg_seq = ++cache->seq;
+  if (send(cache->fd, &req, sizeof(req), 0) < 0)
+    return -errno;
+
+  do {
+    err = nsdp_iface_netlink_recv(cache, 0, req.nh.nlmsg_seq);
+  } while (err == 0 || err == -EINTR);
+  if (err < 0)
+    return err;
+
+  // Drop the links we missed the removal of
+  list_for_each_entry_safe(iface, next, &cache->ifaces, list) {
+    if (iface->generation == cache->generation)
+      continue;
+    nsdp_iface_cache_notify(cache, iface, NSDP_IFACE_EVENT_DEL);
+    nsdp_iface_cache_remove(cache, iface);
+  }
+
+  return 0;
+}
+
+int nsdp_iface_cache_init(nsdp_iface_cache_t *cache, int subscribe)
+{
+  struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+  int group = RTNLGRP_LINK;
+  int err;
+
+  if (!cache)
+    return -EINVAL;
+
+  memset(cache, 0, sizeof(*cache));
+  INIT_LIST_HEAD(&cache->ifaces);
+
+  cache->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (cache->fd < 0)
+    return -errno;
+
+  if (bind(cache->fd, (const struct sockaddr*)&addr, sizeof(addr))) {
+    err = -errno;
+    goto error;
+  }
+
+  // Subscribe before the dump to not miss any change
+  if (subscribe &&
+      setsockopt(cache->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                 &group, sizeof(group))) {
+    err = -errno;
+    fprintf(stderr, "Failed to subscribe to link changes: %s\n",
+            strerror(errno));
+    goto error;
+  }
+
+  err = nsdp_iface_netlink_dump(cache);
+  if (err)
+    goto error;
+
+  if (!subscribe) {
+    close(cache->fd);
+    cache->fd = -1;
+  }
+
+  return 0;
+
+ error:
+  nsdp_iface_cache_uninit(cache);
+  return err;
+}
+
+void nsdp_iface_cache_uninit(nsdp_iface_cache_t *cache)
+{
+  if (!cache)
+    return;
+  if (cache->fd >= 0)
+    close(cache->fd);
+  cache->fd = -1;
+  nsdp_iface_cache_clear(cache);
+}
+
+int nsdp_iface_cache_process(nsdp_iface_cache_t *cache)
+{
+  int err;
+
+  if (!cache || cache->fd < 0)
+    return -EINVAL;
+
+  do {
+    err = nsdp_iface_netlink_recv(cache, MSG_DONTWAIT, 0);
+  } while (err >= 0 || err == -EINTR);
+
+  // The kernel dropped some notifications, reload everything
+  if (err == -ENOBUFS)
+    err = nsdp_iface_netlink_dump(cache);
+
+  return err == -EAGAIN ? 0 : err;
+}
+
+int nsdp_iface_get_mac(const char* iface, uint8_t mac[6])
+{
+  nsdp_iface_cache_t cache;
+  nsdp_iface_t *entry;
+  int err;
+
+  err = nsdp_iface_cache_init(&cache, 0);
+  if (err)
+    return err;
+
+  entry = nsdp_iface_cache_find(&cache, iface);
+  if (entry)
+    memcpy(mac, entry->mac, sizeof(nsdp_mac_t));
+
+  nsdp_iface_cache_uninit(&cache);
+  return entry ? 0 : -ENODEV;
+}
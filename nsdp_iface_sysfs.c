@@ -1,24 +1,114 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
 #include <errno.h>
+#include <dirent.h>
+#include <net/if.h>
 
 #include "nsdp_socket.h"
+#include "nsdp_iface.h"
 
-#ifndef SYSFS_IFACE_ADDR
-#define SYSFS_IFACE_ADDR "/sys/class/net/%s/address"
+#ifndef SYSFS_NET_DIR
+#define SYSFS_NET_DIR "/sys/class/net"
 #endif
 
-int nsdp_iface_get_mac(const char* iface, uint8_t mac[6])
+static int nsdp_iface_sysfs_scanf(const char* iface, const char* attr,
+                                  int count, const char* fmt, ...)
 {
   int err;
   char path[128];
+  va_list ap;
   FILE* fd;
-  snprintf(path, sizeof(path), SYSFS_IFACE_ADDR, iface);
+  snprintf(path, sizeof(path), SYSFS_NET_DIR "/%s/%s", iface, attr);
   fd = fopen(path, "r");
   if (!fd)
     return -errno;
-  err= fscanf(fd, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
-              &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+  va_start(ap, fmt);
+  err = vfscanf(fd, fmt, ap);
+  va_end(ap);
   fclose(fd);
-  return err == 6 ? 0 : -EINVAL;
+  return err == count ? 0 : -EINVAL;
+}
+
+int nsdp_iface_get_mac(const char* iface, uint8_t mac[6])
+{
+  return nsdp_iface_sysfs_scanf(iface, "address", 6,
+                                "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+                                &mac[0], &mac[1], &mac[2],
+                                &mac[3], &mac[4], &mac[5]);
+}
+
+static int nsdp_iface_sysfs_load(nsdp_iface_cache_t *cache, const char *name)
+{
+  nsdp_iface_t *iface;
+  int index, link, carrier = 0;
+  unsigned flags, mtu = 0;
+
+  if (nsdp_iface_sysfs_scanf(name, "ifindex", 1, "%d", &index) ||
+      nsdp_iface_sysfs_scanf(name, "iflink", 1, "%d", &link) ||
+      nsdp_iface_sysfs_scanf(name, "flags", 1, "%x", &flags))
+    return -EINVAL;
+
+  iface = nsdp_iface_cache_get(cache, index);
+  if (!iface)
+    return -ENOMEM;
+
+  // The carrier can't be read while the interface is down
+  nsdp_iface_sysfs_scanf(name, "carrier", 1, "%d", &carrier);
+  if (carrier)
+    flags |= IFF_RUNNING;
+  nsdp_iface_sysfs_scanf(name, "mtu", 1, "%u", &mtu);
+
+  snprintf(iface->name, sizeof(iface->name), "%s", name);
+  iface->link = link != index ? link : 0;
+  iface->flags = flags;
+  iface->mtu = mtu;
+  iface->generation = cache->generation;
+  nsdp_iface_get_mac(name, iface->mac);
+  return 0;
+}
+
+int nsdp_iface_cache_init(nsdp_iface_cache_t *cache, int subscribe)
+{
+  struct dirent *entry;
+  DIR *dir;
+  int err = 0;
+
+  if (!cache)
+    return -EINVAL;
+
+  memset(cache, 0, sizeof(*cache));
+  INIT_LIST_HEAD(&cache->ifaces);
+  // sysfs has no way to notify changes
+  cache->fd = -1;
+
+  dir = opendir(SYSFS_NET_DIR);
+  if (!dir)
+    return -errno;
+
+  while (!err && (entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    err = nsdp_iface_sysfs_load(cache, entry->d_name);
+    // Ignore the interfaces that vanished in the meantime
+    if (err == -EINVAL)
+      err = 0;
+  }
+
+  closedir(dir);
+  if (err)
+    nsdp_iface_cache_clear(cache);
+  return err;
+}
+
+void nsdp_iface_cache_uninit(nsdp_iface_cache_t *cache)
+{
+  if (cache)
+    nsdp_iface_cache_clear(cache);
+}
+
+int nsdp_iface_cache_process(nsdp_iface_cache_t *cache)
+{
+  return -ENOTSUP;
 }
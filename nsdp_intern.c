@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_intern.h"
+
+int nsdp_intern_init(nsdp_intern_pool_t *pool)
+{
+  unsigned i;
+
+  if (!pool)
+    return -EINVAL;
+
+  memset(pool, 0, sizeof(*pool));
+  for (i = 0 ; i < NSDP_INTERN_HASH_SIZE ; i += 1)
+    INIT_HLIST_HEAD(&pool->hash[i]);
+  return 0;
+}
+
+void nsdp_intern_uninit(nsdp_intern_pool_t *pool)
+{
+  nsdp_intern_string_t *str;
+  unsigned i;
+
+  if (!pool)
+    return;
+
+  for (i = 0 ; i < NSDP_INTERN_HASH_SIZE ; i += 1)
+    while (!hlist_empty(&pool->hash[i])) {
+      str = hlist_entry(pool->hash[i].first, nsdp_intern_string_t, hash);
+      hlist_del(&str->hash);
+      free(str);
+    }
+
+  nsdp_intern_init(pool);
+}
+
+static struct hlist_head *nsdp_intern_bucket(nsdp_intern_pool_t *pool,
+                                             const char *value,
+                                             unsigned length)
+{
+  unsigned i, hash = 2166136261u;
+
+  for (i = 0 ; i < length ; i += 1)
+    hash = (hash ^ (uint8_t)value[i]) * 16777619u;
+
+  return &pool->hash[hash % NSDP_INTERN_HASH_SIZE];
+}
+
+static nsdp_intern_string_t *nsdp_intern_find(struct hlist_head *head,
+                                              const char *value,
+                                              unsigned length)
+{
+  nsdp_intern_string_t *str;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(str, pos, head, hash)
+    if (str->length == length && !memcmp(str->value, value, length))
+      return str;
+
+  return NULL;
+}
+
+const char *nsdp_intern_lookup(nsdp_intern_pool_t *pool,
+                               const void *value, unsigned length)
+{
+  nsdp_intern_string_t *str;
+
+  if (!pool || !value)
+    return NULL;
+
+  length = strnlen(value, length);
+  str = nsdp_intern_find(nsdp_intern_bucket(pool, value, length),
+                         value, length);
+  return str ? str->value : NULL;
+}
+
+const char *nsdp_intern_get(nsdp_intern_pool_t *pool,
+                            const void *value, unsigned length)
+{
+  struct hlist_head *head;
+  nsdp_intern_string_t *str;
+
+  if (!pool || !value)
+    return NULL;
+
+  length = strnlen(value, length);
+  head = nsdp_intern_bucket(pool, value, length);
+  str = nsdp_intern_find(head, value, length);
+  if (str) {
+    str->refs += 1;
+    return str->value;
+  }
+
+  str = malloc(sizeof(*str) + length + 1);
+  if (!str)
+    return NULL;
+
+  str->refs = 1;
+  str->length = length;
+  memcpy(str->value, value, length);
+  str->value[length] = 0;
+  hlist_add_head(&str->hash, head);
+
+  pool->count += 1;
+  pool->bytes += length + 1;
+  return str->value;
+}
+
+const char *nsdp_intern_ref(const char *handle)
+{
+  if (handle)
+    container_of(handle, nsdp_intern_string_t, value[0])->refs += 1;
+  return handle;
+}
+
+void nsdp_intern_put(nsdp_intern_pool_t *pool, const char *handle)
+{
+  nsdp_intern_string_t *str;
+
+  if (!pool || !handle)
+    return;
+
+  str = container_of(handle, nsdp_intern_string_t, value[0]);
+  str->refs -= 1;
+  if (str->refs > 0)
+    return;
+
+  hlist_del(&str->hash);
+  pool->count -= 1;
+  pool->bytes -= str->length + 1;
+  free(str);
+}
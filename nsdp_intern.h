@@ -0,0 +1,53 @@
+#ifndef NSDP_INTERN_H
+#define NSDP_INTERN_H
+
+#include "nsdp_types.h"
+
+#define NSDP_INTERN_HASH_SIZE		256
+
+// Shared immutable copy of a value, the handle given to the users
+// points to value, which is always NUL terminated.
+typedef struct nsdp_intern_string {
+  struct hlist_node			hash;
+  unsigned				refs;
+  unsigned				length;
+  char					value[0];
+} nsdp_intern_string_t;
+
+// Pool of interned values, each distinct value is only stored once and
+// two handles from the same pool are equal if and only if they are the
+// same pointer.
+typedef struct nsdp_intern_pool {
+  struct hlist_head			hash[NSDP_INTERN_HASH_SIZE];
+  // Distinct values and their total size
+  unsigned				count;
+  unsigned long				bytes;
+} nsdp_intern_pool_t;
+
+int nsdp_intern_init(nsdp_intern_pool_t *pool);
+
+// Free the pool, all its handles become invalid
+void nsdp_intern_uninit(nsdp_intern_pool_t *pool);
+
+// Get a handle on a value, adding it to the pool if needed. The value
+// stops at its first NUL byte, the handle must be released with
+// nsdp_intern_put().
+const char *nsdp_intern_get(nsdp_intern_pool_t *pool,
+                            const void *value, unsigned length);
+
+// Take another reference on a handle
+const char *nsdp_intern_ref(const char *handle);
+
+// Release a handle, the value is freed with its last handle
+void nsdp_intern_put(nsdp_intern_pool_t *pool, const char *handle);
+
+// Get the handle of a value if it is in the pool, without a reference
+const char *nsdp_intern_lookup(nsdp_intern_pool_t *pool,
+                               const void *value, unsigned length);
+
+static inline unsigned nsdp_intern_length(const char *handle)
+{
+  return container_of(handle, nsdp_intern_string_t, value[0])->length;
+}
+
+#endif /* NSDP_INTERN_H */
@@ -0,0 +1,540 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_inventory.h"
+
+// Indexed properties, the devices keep their values as interned handles
+static const struct nsdp_inventory_indexed {
+  int					index;
+  nsdp_tag_t				tag;
+} nsdp_inventory_indexed[] = {
+  { NSDP_INVENTORY_INDEX_MODEL, NSDP_PROPERTY_MODEL },
+  { NSDP_INVENTORY_INDEX_FIRMWARE, NSDP_PROPERTY_FIRMWARE_VERSION },
+};
+
+static int nsdp_inventory_is_interned(nsdp_tag_t tag)
+{
+  unsigned i;
+
+  for (i = 0 ; i < ARRAY_SIZE(nsdp_inventory_indexed) ; i += 1)
+    if (nsdp_inventory_indexed[i].tag == tag)
+      return 1;
+
+  return 0;
+}
+
+int nsdp_inventory_init(nsdp_inventory_t *inventory)
+{
+  unsigned i, j;
+
+  if (!inventory)
+    return -EINVAL;
+
+  memset(inventory, 0, sizeof(*inventory));
+  for (i = 0 ; i < NSDP_INVENTORY_HASH_SIZE ; i += 1) {
+    INIT_HLIST_HEAD(&inventory->hash[i]);
+    INIT_HLIST_HEAD(&inventory->ip_hash[i]);
+  }
+  for (i = 0 ; i < NSDP_INVENTORY_INDEX_COUNT ; i += 1)
+    for (j = 0 ; j < NSDP_INVENTORY_KEY_HASH_SIZE ; j += 1)
+      INIT_HLIST_HEAD(&inventory->key[i][j]);
+  INIT_LIST_HEAD(&inventory->devices);
+  nsdp_intern_init(&inventory->own_strings);
+  inventory->strings = &inventory->own_strings;
+  return 0;
+}
+
+int nsdp_inventory_set_intern_pool(nsdp_inventory_t *inventory,
+                                   nsdp_intern_pool_t *pool)
+{
+  if (!inventory || !pool)
+    return -EINVAL;
+  if (inventory->count > 0)
+    return -EBUSY;
+
+  inventory->strings = pool;
+  return 0;
+}
+
+static struct hlist_head *nsdp_inventory_key_bucket(nsdp_inventory_t *inventory,
+                                                    int index,
+                                                    const char *value)
+{
+  return &inventory->key[index][((uintptr_t)value >> 4) %
+                                NSDP_INVENTORY_KEY_HASH_SIZE];
+}
+
+static nsdp_inventory_key_t *
+nsdp_inventory_key_lookup(nsdp_inventory_t *inventory, int index,
+                          const char *value)
+{
+  nsdp_inventory_key_t *key;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(key, pos,
+                       nsdp_inventory_key_bucket(inventory, index, value),
+                       hash)
+    if (key->value == value)
+      return key;
+
+  return NULL;
+}
+
+// Remove a device from the key of an index, the last one frees the key
+static void nsdp_device_clear_index(nsdp_inventory_t *inventory,
+                                    nsdp_device_t *device, int index)
+{
+  nsdp_inventory_key_t *key = device->index[index].key;
+
+  if (!key)
+    return;
+
+  list_del(&device->index[index].list);
+  device->index[index].key = NULL;
+  key->count -= 1;
+  if (key->count == 0) {
+    hlist_del(&key->hash);
+    nsdp_intern_put(inventory->strings, key->value);
+    free(key);
+  }
+}
+
+static int nsdp_device_set_index(nsdp_inventory_t *inventory,
+                                 nsdp_device_t *device, int index,
+                                 const char *value, unsigned len)
+{
+  nsdp_inventory_key_t *key;
+  const char *str;
+
+  // The interned properties already are the handle of their key
+  if (device->index[index].key && device->index[index].key->value == value)
+    return 0;
+
+  str = nsdp_intern_get(inventory->strings, value, len);
+  if (!str)
+    return -ENOMEM;
+
+  if (device->index[index].key && device->index[index].key->value == str) {
+    nsdp_intern_put(inventory->strings, str);
+    return 0;
+  }
+
+  nsdp_device_clear_index(inventory, device, index);
+
+  // Each key holds one reference on its value
+  key = nsdp_inventory_key_lookup(inventory, index, str);
+  if (key)
+    nsdp_intern_put(inventory->strings, str);
+  else {
+    key = calloc(1, sizeof(*key));
+    if (!key) {
+      nsdp_intern_put(inventory->strings, str);
+      return -ENOMEM;
+    }
+    INIT_LIST_HEAD(&key->devices);
+    key->value = str;
+    hlist_add_head(&key->hash,
+                   nsdp_inventory_key_bucket(inventory, index, str));
+  }
+
+  list_add_tail(&device->index[index].list, &key->devices);
+  device->index[index].key = key;
+  key->count += 1;
+  return 0;
+}
+
+static struct hlist_head *nsdp_inventory_ip_bucket(nsdp_inventory_t *inventory,
+                                                   const uint8_t ip[4])
+{
+  return &inventory->ip_hash[nsdp_get_u32be(ip) % NSDP_INVENTORY_HASH_SIZE];
+}
+
+static void nsdp_device_set_ip(nsdp_inventory_t *inventory,
+                               nsdp_device_t *device, const uint8_t ip[4])
+{
+  static const uint8_t any_ip[4];
+
+  if (!memcmp(device->ip, ip, sizeof(device->ip)))
+    return;
+
+  if (!hlist_unhashed(&device->ip_hash))
+    hlist_del_init(&device->ip_hash);
+  memcpy(device->ip, ip, sizeof(device->ip));
+  if (memcmp(ip, any_ip, sizeof(any_ip)))
+    hlist_add_head(&device->ip_hash, nsdp_inventory_ip_bucket(inventory, ip));
+}
+
+// Update the indexes from the properties of a device
+static int nsdp_inventory_reindex(nsdp_inventory_t *inventory,
+                                  nsdp_device_t *device, const char *iface)
+{
+  const struct nsdp_inventory_indexed *indexed;
+  const nsdp_property_t *prop;
+  unsigned i;
+  int err = 0;
+
+  for (i = 0 ; i < ARRAY_SIZE(nsdp_inventory_indexed) && !err ; i += 1) {
+    indexed = &nsdp_inventory_indexed[i];
+    prop = nsdp_device_get_property(device, indexed->tag);
+    if (prop)
+      err = nsdp_device_set_index(inventory, device, indexed->index,
+                                  (const char*)prop->data, prop->length);
+  }
+
+  if (!err && iface)
+    err = nsdp_device_set_index(inventory, device,
+                                NSDP_INVENTORY_INDEX_IFACE,
+                                iface, strlen(iface));
+
+  prop = nsdp_device_get_property(device, NSDP_PROPERTY_IP);
+  if (prop && prop->length == sizeof(device->ip))
+    nsdp_device_set_ip(inventory, device, prop->data);
+
+  return err;
+}
+
+// Free a property of a device, releasing its interned value
+static void nsdp_device_free_property(nsdp_inventory_t *inventory,
+                                      nsdp_property_t *prop)
+{
+  if (nsdp_inventory_is_interned(prop->tag))
+    nsdp_intern_put(inventory->strings, (const char*)prop->data);
+  nsdp_property_free(prop);
+}
+
+static void nsdp_device_free(nsdp_inventory_t *inventory,
+                             nsdp_device_t *device)
+{
+  nsdp_property_t *prop, *next;
+  unsigned i;
+
+  for (i = 0 ; i < NSDP_INVENTORY_INDEX_COUNT ; i += 1)
+    nsdp_device_clear_index(inventory, device, i);
+  if (!hlist_unhashed(&device->ip_hash))
+    hlist_del(&device->ip_hash);
+
+  list_for_each_entry_safe(prop, next, &device->properties, list)
+    nsdp_device_free_property(inventory, prop);
+  free(device);
+}
+
+void nsdp_inventory_uninit(nsdp_inventory_t *inventory)
+{
+  nsdp_device_t *device, *next;
+
+  if (!inventory)
+    return;
+
+  list_for_each_entry_safe(device, next, &inventory->devices, list)
+    nsdp_device_free(inventory, device);
+  nsdp_intern_uninit(&inventory->own_strings);
+  nsdp_inventory_init(inventory);
+}
+
+void nsdp_inventory_set_on_change(nsdp_inventory_t *inventory,
+                                  nsdp_inventory_on_change_f on_change,
+                                  void *context)
+{
+  if (!inventory)
+    return;
+  inventory->on_change = on_change;
+  inventory->context = context;
+}
+
+static struct hlist_head *nsdp_inventory_bucket(nsdp_inventory_t *inventory,
+                                                const nsdp_mac_t mac)
+{
+  return &inventory->hash[nsdp_mac_hash(mac) % NSDP_INVENTORY_HASH_SIZE];
+}
+
+nsdp_device_t *nsdp_inventory_find_ip(nsdp_inventory_t *inventory,
+                                      const uint8_t ip[4])
+{
+  nsdp_device_t *device;
+  struct hlist_node *pos;
+
+  if (!inventory || !ip)
+    return NULL;
+
+  hlist_for_each_entry(device, pos, nsdp_inventory_ip_bucket(inventory, ip),
+                       ip_hash)
+    if (!memcmp(device->ip, ip, sizeof(device->ip)))
+      return device;
+
+  return NULL;
+}
+
+nsdp_inventory_key_t *nsdp_inventory_find_key(nsdp_inventory_t *inventory,
+                                              int index, const char *value)
+{
+  const char *str;
+
+  if (!inventory || !value || index < 0 ||
+      index >= NSDP_INVENTORY_INDEX_COUNT)
+    return NULL;
+
+  str = nsdp_intern_lookup(inventory->strings, value, strlen(value));
+  return str ? nsdp_inventory_key_lookup(inventory, index, str) : NULL;
+}
+
+int nsdp_inventory_select(nsdp_inventory_t *inventory,
+                          const char *model, const char *firmware,
+                          const char *iface,
+                          nsdp_inventory_select_f select, void *context)
+{
+  const char *values[NSDP_INVENTORY_INDEX_COUNT] = {
+    [NSDP_INVENTORY_INDEX_MODEL] = model,
+    [NSDP_INVENTORY_INDEX_FIRMWARE] = firmware,
+    [NSDP_INVENTORY_INDEX_IFACE] = iface,
+  };
+  nsdp_inventory_key_t *keys[NSDP_INVENTORY_INDEX_COUNT] = {};
+  nsdp_device_index_t *entry, *next;
+  nsdp_device_t *device, *next_device;
+  int i, smallest = -1, count = 0;
+
+  if (!inventory || !select)
+    return -EINVAL;
+
+  for (i = 0 ; i < NSDP_INVENTORY_INDEX_COUNT ; i += 1) {
+    if (!values[i])
+      continue;
+    keys[i] = nsdp_inventory_find_key(inventory, i, values[i]);
+    if (!keys[i])
+      return 0;
+    if (smallest < 0 || keys[i]->count < keys[smallest]->count)
+      smallest = i;
+  }
+
+  if (smallest < 0) {
+    list_for_each_entry_safe(device, next_device, &inventory->devices, list) {
+      select(inventory, device, context);
+      count += 1;
+    }
+    return count;
+  }
+
+  // The keys are shared, so the other values are pointer compares
+  list_for_each_entry_safe(entry, next, &keys[smallest]->devices, list) {
+    device = container_of(entry - smallest, nsdp_device_t, index[0]);
+    for (i = 0 ; i < NSDP_INVENTORY_INDEX_COUNT ; i += 1)
+      if (keys[i] && device->index[i].key != keys[i])
+        break;
+    if (i < NSDP_INVENTORY_INDEX_COUNT)
+      continue;
+    select(inventory, device, context);
+    count += 1;
+  }
+
+  return count;
+}
+
+nsdp_device_t *nsdp_inventory_find(nsdp_inventory_t *inventory,
+                                   const nsdp_mac_t mac)
+{
+  nsdp_device_t *device;
+  struct hlist_node *pos;
+
+  if (!inventory || !mac)
+    return NULL;
+
+  hlist_for_each_entry(device, pos, nsdp_inventory_bucket(inventory, mac),
+                       hash)
+    if (!memcmp(device->mac, mac, sizeof(nsdp_mac_t)))
+      return device;
+
+  return NULL;
+}
+
+static void nsdp_inventory_notify(nsdp_inventory_t *inventory,
+                                  const nsdp_device_t *device, int event)
+{
+  if (inventory->on_change)
+    inventory->on_change(inventory, device, event, inventory->context);
+}
+
+void nsdp_inventory_remove(nsdp_inventory_t *inventory,
+                           nsdp_device_t *device)
+{
+  if (!inventory || !device)
+    return;
+
+  nsdp_inventory_notify(inventory, device, NSDP_INVENTORY_EVENT_DEL);
+  hlist_del(&device->hash);
+  list_del(&device->list);
+  inventory->count -= 1;
+  nsdp_device_free(inventory, device);
+}
+
+const nsdp_property_t *nsdp_device_get_property(const nsdp_device_t *device,
+                                                nsdp_tag_t tag)
+{
+  const nsdp_property_t *prop;
+
+  if (!device)
+    return NULL;
+
+  nsdp_device_for_each_property(device, prop)
+    if (prop->tag == tag)
+      return prop;
+
+  return NULL;
+}
+
+static nsdp_property_t *nsdp_property_next_tag(struct list_head *head,
+                                               nsdp_property_t *prop,
+                                               nsdp_tag_t tag)
+{
+  list_for_each_entry_continue(prop, head, list)
+    if (prop->tag == tag)
+      return prop;
+  return NULL;
+}
+
+// Some properties, like the port status, are repeated for each port,
+// so all the values of a tag are compared and replaced together.
+static int nsdp_device_tag_equal(nsdp_inventory_t *inventory,
+                                 nsdp_device_t *device,
+                                 const nsdp_packet_t *response,
+                                 nsdp_property_t *first)
+{
+  struct list_head *head = (struct list_head *)&response->properties;
+  int interned = nsdp_inventory_is_interned(first->tag);
+  nsdp_property_t *prop = first, *old;
+
+  old = list_entry(&device->properties, nsdp_property_t, list);
+  old = nsdp_property_next_tag(&device->properties, old, first->tag);
+
+  while (prop && old) {
+    // The interned values are equal if they have the same handle
+    if (interned) {
+      if (nsdp_intern_lookup(inventory->strings, prop->data, prop->length) !=
+          (const char*)old->data)
+        return 0;
+    } else if (prop->length != old->length ||
+               memcmp(prop->data, old->data, prop->length))
+      return 0;
+    prop = nsdp_property_next_tag(head, prop, first->tag);
+    old = nsdp_property_next_tag(&device->properties, old, first->tag);
+  }
+
+  return !prop && !old;
+}
+
+// Copy a property of a response, the interned ones only point to the
+// value in the string pool
+static nsdp_property_t *nsdp_device_copy_property(nsdp_inventory_t *inventory,
+                                                  const nsdp_property_t *prop)
+{
+  nsdp_property_t *copy;
+  const char *str;
+
+  if (!nsdp_inventory_is_interned(prop->tag))
+    return nsdp_property_from_data(prop->tag, prop->length, prop->data);
+
+  str = nsdp_intern_get(inventory->strings, prop->data, prop->length);
+  if (!str)
+    return NULL;
+
+  copy = nsdp_property_from_shared(prop->tag, nsdp_intern_length(str), str);
+  if (!copy)
+    nsdp_intern_put(inventory->strings, str);
+  return copy;
+}
+
+static int nsdp_device_set_tag(nsdp_inventory_t *inventory,
+                               nsdp_device_t *device,
+                               const nsdp_packet_t *response,
+                               nsdp_property_t *first)
+{
+  struct list_head *head = (struct list_head *)&response->properties;
+  nsdp_property_t *prop, *next, *copy;
+
+  list_for_each_entry_safe(prop, next, &device->properties, list)
+    if (prop->tag == first->tag)
+      nsdp_device_free_property(inventory, prop);
+
+  for (prop = first ; prop ;
+       prop = nsdp_property_next_tag(head, prop, first->tag)) {
+    copy = nsdp_device_copy_property(inventory, prop);
+    if (!copy)
+      return -ENOMEM;
+    list_add_tail(&copy->list, &device->properties);
+  }
+
+  return 0;
+}
+
+// Check if a tag already appeared earlier in the response
+static int nsdp_packet_tag_seen(const nsdp_packet_t *response,
+                                const nsdp_property_t *until)
+{
+  const nsdp_property_t *prop;
+
+  nsdp_packet_for_each_property(response, prop) {
+    if (prop == until)
+      break;
+    if (prop->tag == until->tag)
+      return 1;
+  }
+
+  return 0;
+}
+
+int nsdp_inventory_update(nsdp_inventory_t *inventory,
+                          const nsdp_packet_t *response)
+{
+  return nsdp_inventory_update_iface(inventory, response, NULL);
+}
+
+int nsdp_inventory_update_iface(nsdp_inventory_t *inventory,
+                                const nsdp_packet_t *response,
+                                const char *iface)
+{
+  nsdp_device_t *device;
+  nsdp_property_t *prop;
+  int event = 0, err;
+
+  if (!inventory || !response || response->op != NSDP_OP_READ_RESPONSE ||
+      nsdp_mac_is_zero(response->server_mac))
+    return -EINVAL;
+
+  device = nsdp_inventory_find(inventory, response->server_mac);
+  if (!device) {
+    device = calloc(1, sizeof(*device));
+    if (!device)
+      return -ENOMEM;
+    memcpy(device->mac, response->server_mac, sizeof(nsdp_mac_t));
+    INIT_LIST_HEAD(&device->properties);
+    INIT_HLIST_NODE(&device->ip_hash);
+    hlist_add_head(&device->hash,
+                   nsdp_inventory_bucket(inventory, device->mac));
+    list_add_tail(&device->list, &inventory->devices);
+    inventory->count += 1;
+    event = NSDP_INVENTORY_EVENT_NEW;
+  }
+
+  device->last_seen = time(NULL);
+  device->generation = inventory->generation;
+
+  nsdp_packet_for_each_property(response, prop) {
+    // Empty values are the properties the device doesn't support
+    if (prop->tag == NSDP_PROPERTY_TERMINATOR || prop->length == 0 ||
+        nsdp_packet_tag_seen(response, prop) ||
+        nsdp_device_tag_equal(inventory, device, response, prop))
+      continue;
+    err = nsdp_device_set_tag(inventory, device, response, prop);
+    if (err)
+      return err;
+    if (!event)
+      event = NSDP_INVENTORY_EVENT_CHANGE;
+  }
+
+  err = nsdp_inventory_reindex(inventory, device, iface);
+  if (err)
+    return err;
+
+  if (event)
+    nsdp_inventory_notify(inventory, device, event);
+  return event;
+}
@@ -0,0 +1,150 @@
+#ifndef NSDP_INVENTORY_H
+#define NSDP_INVENTORY_H
+
+#include <time.h>
+#include "nsdp_packet.h"
+#include "nsdp_intern.h"
+
+#define NSDP_INVENTORY_HASH_SIZE	1024
+// Buckets of the model, firmware and interface indexes
+#define NSDP_INVENTORY_KEY_HASH_SIZE	256
+
+#define NSDP_INVENTORY_INDEX_MODEL	0
+#define NSDP_INVENTORY_INDEX_FIRMWARE	1
+#define NSDP_INVENTORY_INDEX_IFACE	2
+#define NSDP_INVENTORY_INDEX_COUNT	3
+
+#define NSDP_INVENTORY_EVENT_NEW	1
+#define NSDP_INVENTORY_EVENT_CHANGE	2
+#define NSDP_INVENTORY_EVENT_DEL	3
+
+// Value of an index shared by all the devices that have it
+typedef struct nsdp_inventory_key {
+  struct hlist_node			hash;
+  struct list_head			devices;
+  unsigned				count;
+  // Interned in the inventory string pool
+  const char				*value;
+} nsdp_inventory_key_t;
+
+typedef struct nsdp_device_index {
+  struct list_head			list;
+  nsdp_inventory_key_t			*key;
+} nsdp_device_index_t;
+
+typedef struct nsdp_device {
+  struct hlist_node			hash;
+  struct list_head			list;
+  nsdp_mac_t				mac;
+  // Management address, hashed if not zero
+  uint8_t				ip[4];
+  struct hlist_node			ip_hash;
+  nsdp_device_index_t			index[NSDP_INVENTORY_INDEX_COUNT];
+  // Last value reported for each property
+  struct list_head			properties;
+  time_t				last_seen;
+  // Last inventory generation that saw this device
+  unsigned				generation;
+} nsdp_device_t;
+
+struct nsdp_inventory;
+
+typedef void (*nsdp_inventory_on_change_f)(struct nsdp_inventory *inventory,
+                                           const nsdp_device_t *device,
+                                           int event, void *context);
+
+// Set of devices keyed by MAC, filled from the read responses
+typedef struct nsdp_inventory {
+  struct hlist_head			hash[NSDP_INVENTORY_HASH_SIZE];
+  struct hlist_head			ip_hash[NSDP_INVENTORY_HASH_SIZE];
+  struct hlist_head			key[NSDP_INVENTORY_INDEX_COUNT]
+                                           [NSDP_INVENTORY_KEY_HASH_SIZE];
+  struct list_head			devices;
+  unsigned				count;
+  unsigned				generation;
+
+  // Pool of the indexed values, can be shared by several inventories
+  nsdp_intern_pool_t			*strings;
+  nsdp_intern_pool_t			own_strings;
+
+  nsdp_inventory_on_change_f		on_change;
+  void					*context;
+} nsdp_inventory_t;
+
+int nsdp_inventory_init(nsdp_inventory_t *inventory);
+
+void nsdp_inventory_uninit(nsdp_inventory_t *inventory);
+
+// Use a string pool shared with other inventories, the inventory
+// must be empty
+int nsdp_inventory_set_intern_pool(nsdp_inventory_t *inventory,
+                                   nsdp_intern_pool_t *pool);
+
+// Set the callback called when a device is added, changed or removed
+void nsdp_inventory_set_on_change(nsdp_inventory_t *inventory,
+                                  nsdp_inventory_on_change_f on_change,
+                                  void *context);
+
+// Merge the properties of a read response in the inventory, return
+// the event that happened, 0 if nothing changed or a negative error
+int nsdp_inventory_update(nsdp_inventory_t *inventory,
+                          const nsdp_packet_t *response);
+
+// Same as nsdp_inventory_update() and also record the interface the
+// response came from, a NULL iface keeps the current one
+int nsdp_inventory_update_iface(nsdp_inventory_t *inventory,
+                                const nsdp_packet_t *response,
+                                const char *iface);
+
+// Lookup a device
+nsdp_device_t *nsdp_inventory_find(nsdp_inventory_t *inventory,
+                                   const nsdp_mac_t mac);
+
+// Lookup a device by its management address
+nsdp_device_t *nsdp_inventory_find_ip(nsdp_inventory_t *inventory,
+                                      const uint8_t ip[4]);
+
+// Lookup the devices that have a value for one of the indexes, the
+// returned key lists them and is only valid until the next update
+nsdp_inventory_key_t *nsdp_inventory_find_key(nsdp_inventory_t *inventory,
+                                              int index, const char *value);
+
+typedef void (*nsdp_inventory_select_f)(nsdp_inventory_t *inventory,
+                                        nsdp_device_t *device,
+                                        void *context);
+
+// Call select for the devices that have all the given values, NULL
+// values match all the devices. Only the devices of the smallest
+// index are visited. Return the number of selected devices.
+int nsdp_inventory_select(nsdp_inventory_t *inventory,
+                          const char *model, const char *firmware,
+                          const char *iface,
+                          nsdp_inventory_select_f select, void *context);
+
+// Remove a device from the inventory
+void nsdp_inventory_remove(nsdp_inventory_t *inventory,
+                           nsdp_device_t *device);
+
+// Get the first value of a property of a device
+const nsdp_property_t *nsdp_device_get_property(const nsdp_device_t *device,
+                                                nsdp_tag_t tag);
+
+// Get the value of one of the indexes for a device, or NULL. The
+// values are interned, equal values are the same pointer.
+static inline const char *nsdp_device_get_index(const nsdp_device_t *device,
+                                                int index)
+{
+  return device->index[index].key ? device->index[index].key->value : NULL;
+}
+
+#define nsdp_inventory_for_each(inventory, device) \
+  list_for_each_entry((device), &(inventory)->devices, list)
+
+// Iterate over the devices of an index key
+#define nsdp_inventory_key_for_each(key, device, idx) \
+  list_for_each_entry((device), &(key)->devices, index[idx].list)
+
+#define nsdp_device_for_each_property(device, prop) \
+  list_for_each_entry((prop), &(device)->properties, list)
+
+#endif /* NSDP_INVENTORY_H */
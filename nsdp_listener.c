@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_listener.h"
+
+#define NSDP_LISTENER_BUFFER_SIZE	65535
+
+static void nsdp_listener_recv(int sock, short what, void *arg)
+{
+  nsdp_listener_t *listener = arg;
+  nsdp_packet_t response;
+  int len, err;
+
+  len = nsdp_socket_recvfrom(listener->socket, listener->buffer,
+                             NSDP_LISTENER_BUFFER_SIZE, NULL);
+  if (len < 0) {
+    fprintf(stderr, "Failed to receive a packet: %s\n", strerror(errno));
+    return;
+  }
+
+  listener->stats.received += 1;
+
+  // Only decode the properties of the read responses
+  nsdp_packet_init(&response);
+  err = nsdp_packet_read_header(&response, listener->buffer, len);
+  if (err < 0 || response.op != NSDP_OP_READ_RESPONSE ||
+      nsdp_mac_is_zero(response.server_mac)) {
+    listener->stats.ignored += 1;
+    return;
+  }
+
+  err = nsdp_packet_read(&response, listener->buffer, len);
+  if (err < 0)
+    listener->stats.ignored += 1;
+  else if (nsdp_inventory_update_iface(listener->inventory, &response,
+                                       listener->iface) >= 0)
+    listener->stats.responses += 1;
+
+  nsdp_packet_uninit(&response);
+}
+
+int nsdp_listener_init(nsdp_listener_t *listener,
+                       struct event_base *ev_base,
+                       const char *iface, unsigned port,
+                       nsdp_inventory_t *inventory)
+{
+  int err;
+
+  if (!listener || !ev_base || !inventory)
+    return -EINVAL;
+
+  memset(listener, 0, sizeof(*listener));
+  listener->ev_base = ev_base;
+  listener->inventory = inventory;
+  listener->iface = iface;
+  listener->socket = -1;
+
+  listener->buffer = malloc(NSDP_LISTENER_BUFFER_SIZE);
+  if (!listener->buffer)
+    return -ENOMEM;
+
+  err = nsdp_socket_open_shared(iface, NULL, port ? port : 63321,
+                                &listener->socket);
+  if (err < 0)
+    goto error;
+
+  listener->recv_event = event_new(ev_base, listener->socket,
+                                   EV_READ | EV_PERSIST,
+                                   nsdp_listener_recv, listener);
+  if (!listener->recv_event) {
+    err = -ENOMEM;
+    goto error;
+  }
+  event_add(listener->recv_event, NULL);
+
+  return 0;
+
+ error:
+  nsdp_listener_uninit(listener);
+  return err;
+}
+
+void nsdp_listener_uninit(nsdp_listener_t *listener)
+{
+  if (!listener)
+    return;
+
+  if (listener->recv_event)
+    event_free(listener->recv_event);
+  listener->recv_event = NULL;
+  if (listener->socket >= 0)
+    nsdp_socket_close(listener->socket);
+  listener->socket = -1;
+  free(listener->buffer);
+  listener->buffer = NULL;
+}
+
+const nsdp_listener_stats_t*
+  nsdp_listener_get_stats(const nsdp_listener_t *listener)
+{
+  return listener ? &listener->stats : NULL;
+}
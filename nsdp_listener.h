@@ -0,0 +1,41 @@
+#ifndef NSDP_LISTENER_H
+#define NSDP_LISTENER_H
+
+#include <event.h>
+
+#include "nsdp_socket.h"
+#include "nsdp_inventory.h"
+
+typedef struct nsdp_listener_stats {
+  unsigned long				received;
+  // Read responses merged in the inventory
+  unsigned long				responses;
+  // Requests, write responses and packets that failed to parse
+  unsigned long				ignored;
+} nsdp_listener_stats_t;
+
+// Passive listener that fills an inventory with the read responses
+// sent to the other clients, without sending anything.
+typedef struct nsdp_listener {
+  struct event_base			*ev_base;
+  const char				*iface;
+  nsdp_socket_t				socket;
+  struct event				*recv_event;
+  uint8_t				*buffer;
+
+  nsdp_inventory_t			*inventory;
+  nsdp_listener_stats_t			stats;
+} nsdp_listener_t;
+
+// Listen on the client port, 63321 if 0
+int nsdp_listener_init(nsdp_listener_t *listener,
+                       struct event_base *ev_base,
+                       const char *iface, unsigned port,
+                       nsdp_inventory_t *inventory);
+
+void nsdp_listener_uninit(nsdp_listener_t *listener);
+
+const nsdp_listener_stats_t*
+  nsdp_listener_get_stats(const nsdp_listener_t *listener);
+
+#endif /* NSDP_LISTENER_H */
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_output.h"
+
+#define NSDP_OUTPUT_MAX_COLUMNS		32
+#define NSDP_OUTPUT_BUFFER_SIZE		65536
+#define NSDP_OUTPUT_NAME_SIZE		32
+
+static int nsdp_output_format = NSDP_OUTPUT_TEXT;
+static nsdp_tag_t nsdp_output_columns[NSDP_OUTPUT_MAX_COLUMNS];
+static unsigned nsdp_output_column_count;
+static int nsdp_output_header_done;
+static const char *nsdp_output_id;
+
+static const char *nsdp_output_port_statistics[] = {
+  "rx", "tx", "packets", "broadcast", "multicast", "crc_errors",
+};
+
+#define NSDP_OUTPUT_STATISTICS_COUNT ARRAY_SIZE(nsdp_output_port_statistics)
+
+// Fields written in the current record
+static unsigned nsdp_output_fields;
+
+int nsdp_output_set_format(const char *name)
+{
+  if (!strcmp(name, "text"))
+    nsdp_output_format = NSDP_OUTPUT_TEXT;
+  else if (!strcmp(name, "jsonl"))
+    nsdp_output_format = NSDP_OUTPUT_JSONL;
+  else if (!strcmp(name, "csv"))
+    nsdp_output_format = NSDP_OUTPUT_CSV;
+  else
+    return -EINVAL;
+
+  // The records are only flushed when the buffer is full
+  if (nsdp_output_format != NSDP_OUTPUT_TEXT)
+    setvbuf(stdout, NULL, _IOFBF, NSDP_OUTPUT_BUFFER_SIZE);
+  return 0;
+}
+
+int nsdp_output_get_format(void)
+{
+  return nsdp_output_format;
+}
+
+static int nsdp_output_is_port_tag(nsdp_tag_t tag)
+{
+  return tag == NSDP_PROPERTY_PORT_STATUS ||
+    tag == NSDP_PROPERTY_PORT_STATISTICS;
+}
+
+void nsdp_output_set_columns(const nsdp_tag_t *tags, unsigned count)
+{
+  unsigned i;
+
+  nsdp_output_column_count = 0;
+  for (i = 0 ; i < count ; i += 1) {
+    // The ports get their own records
+    if (nsdp_output_is_port_tag(tags[i]) ||
+        nsdp_output_column_count >= NSDP_OUTPUT_MAX_COLUMNS)
+      continue;
+    nsdp_output_columns[nsdp_output_column_count++] = tags[i];
+  }
+}
+
+void nsdp_output_set_id(const char *id)
+{
+  nsdp_output_id = id;
+}
+
+void nsdp_output_flush(void)
+{
+  fflush(stdout);
+}
+
+// Length of the valid UTF-8 sequence at str, 0 if it isn't one
+static unsigned nsdp_output_utf8_len(const unsigned char *str, unsigned len)
+{
+  unsigned char min = 0x80, max = 0xbf;
+  unsigned i, count;
+
+  if (str[0] >= 0xc2 && str[0] <= 0xdf)
+    count = 2;
+  else if (str[0] >= 0xe0 && str[0] <= 0xef)
+    count = 3;
+  else if (str[0] >= 0xf0 && str[0] <= 0xf4)
+    count = 4;
+  else
+    return 0;
+
+  // Reject the overlong forms, the surrogates and what is past U+10FFFF
+  if (str[0] == 0xe0)
+    min = 0xa0;
+  else if (str[0] == 0xed)
+    max = 0x9f;
+  else if (str[0] == 0xf0)
+    min = 0x90;
+  else if (str[0] == 0xf4)
+    max = 0x8f;
+
+  if (count > len || str[1] < min || str[1] > max)
+    return 0;
+  for (i = 2 ; i < count ; i += 1)
+    if (str[i] < 0x80 || str[i] > 0xbf)
+      return 0;
+  return count;
+}
+
+static void nsdp_output_string(const char *str, unsigned len)
+{
+  unsigned i, n;
+
+  if (nsdp_output_format == NSDP_OUTPUT_JSONL) {
+    putchar('"');
+    for (i = 0 ; i < len ; i += 1) {
+      unsigned char c = str[i];
+      if (c == '"' || c == '\\')
+        printf("\\%c", c);
+      else if (c < 0x20 || c == 0x7f)
+        printf("\\u%04x", c);
+      else if (c < 0x80)
+        putchar(c);
+      else if ((n = nsdp_output_utf8_len((const unsigned char*)str + i,
+                                         len - i))) {
+        fwrite(str + i, 1, n, stdout);
+        i += n - 1;
+      } else
+        // Not UTF-8, write the byte as a latin-1 character
+        printf("\\u%04x", c);
+    }
+    putchar('"');
+    return;
+  }
+
+  // CSV only quotes the fields that need it
+  if (!memchr(str, ',', len) && !memchr(str, '"', len) &&
+      !memchr(str, '\n', len) && !memchr(str, ';', len)) {
+    fwrite(str, 1, len, stdout);
+    return;
+  }
+
+  putchar('"');
+  for (i = 0 ; i < len ; i += 1) {
+    if (str[i] == '"')
+      putchar('"');
+    putchar(str[i]);
+  }
+  putchar('"');
+}
+
+static void nsdp_output_key(const char *name);
+static void nsdp_output_tag_name(nsdp_tag_t tag, char *name, unsigned size);
+
+// Write the header of the CSV records. They all share the same columns:
+// the kind of record, the device ones, the port ones and the message.
+static void nsdp_output_header(void)
+{
+  char name[NSDP_OUTPUT_NAME_SIZE];
+  unsigned i;
+
+  if (nsdp_output_header_done)
+    return;
+  nsdp_output_header_done = 1;
+
+  printf("id,kind,event,mac");
+  for (i = 0 ; i < nsdp_output_column_count ; i += 1) {
+    nsdp_output_tag_name(nsdp_output_columns[i], name, sizeof(name));
+    printf(",%s", name);
+  }
+  printf(",port,status");
+  for (i = 0 ; i < NSDP_OUTPUT_STATISTICS_COUNT ; i += 1)
+    printf(",%s", nsdp_output_port_statistics[i]);
+  printf(",message\n");
+}
+
+// Leave some CSV columns empty
+static void nsdp_output_skip(unsigned count)
+{
+  while (count-- > 0)
+    nsdp_output_key(NULL);
+}
+
+static void nsdp_output_begin(const char *kind)
+{
+  if (nsdp_output_format == NSDP_OUTPUT_CSV)
+    nsdp_output_header();
+
+  nsdp_output_fields = 0;
+  if (nsdp_output_format == NSDP_OUTPUT_JSONL)
+    putchar('{');
+  if (nsdp_output_id || nsdp_output_format == NSDP_OUTPUT_CSV) {
+    nsdp_output_key("id");
+    if (nsdp_output_id)
+      nsdp_output_string(nsdp_output_id, strlen(nsdp_output_id));
+  }
+  if (nsdp_output_format == NSDP_OUTPUT_CSV) {
+    nsdp_output_key("kind");
+    nsdp_output_string(kind, strlen(kind));
+  }
+}
+
+static void nsdp_output_end(void)
+{
+  if (nsdp_output_format == NSDP_OUTPUT_JSONL)
+    putchar('}');
+  putchar('\n');
+}
+
+static void nsdp_output_key(const char *name)
+{
+  if (nsdp_output_fields++ > 0)
+    putchar(',');
+  if (nsdp_output_format == NSDP_OUTPUT_JSONL) {
+    nsdp_output_string(name, strlen(name));
+    putchar(':');
+  }
+}
+
+static void nsdp_output_mac(const nsdp_mac_t mac)
+{
+  char txt[18];
+
+  snprintf(txt, sizeof(txt), "%02x:%02x:%02x:%02x:%02x:%02x",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  nsdp_output_key("mac");
+  nsdp_output_string(txt, sizeof(txt) - 1);
+}
+
+static void nsdp_output_value(const nsdp_property_t *prop)
+{
+  const struct nsdp_property_desc *desc = nsdp_property_get_desc(prop);
+  char txt[512];
+  int len;
+
+  if (desc && desc->type == &nsdp_property_type_u8 && prop->length == 1) {
+    printf("%u", prop->data[0]);
+    return;
+  }
+
+  if (desc && desc->type == &nsdp_property_type_str) {
+    len = strnlen((const char*)prop->data, prop->length);
+    nsdp_output_string((const char*)prop->data, len);
+    return;
+  }
+
+  len = nsdp_property_to_txt(prop, txt, sizeof(txt));
+  if (len >= 0)
+    nsdp_output_string(txt, strlen(txt));
+  else if (nsdp_output_format == NSDP_OUTPUT_JSONL)
+    printf("null");
+}
+
+// Write all the values of a tag, as an array if there are several,
+// the CSV output separates them with semicolons.
+static void nsdp_output_tag(const struct list_head *properties,
+                            const nsdp_property_t *first)
+{
+  const nsdp_property_t *prop = first;
+  unsigned count = 0;
+
+  list_for_each_entry_from(prop, properties, list)
+    if (prop->tag == first->tag)
+      count += 1;
+
+  if (count > 1 && nsdp_output_format == NSDP_OUTPUT_JSONL)
+    putchar('[');
+
+  count = 0;
+  prop = first;
+  list_for_each_entry_from(prop, properties, list) {
+    if (prop->tag != first->tag)
+      continue;
+    if (count++ > 0)
+      putchar(nsdp_output_format == NSDP_OUTPUT_JSONL ? ',' : ';');
+    nsdp_output_value(prop);
+  }
+
+  if (count > 1 && nsdp_output_format == NSDP_OUTPUT_JSONL)
+    putchar(']');
+}
+
+static const nsdp_property_t *
+nsdp_output_find(const struct list_head *properties, nsdp_tag_t tag)
+{
+  const nsdp_property_t *prop;
+
+  list_for_each_entry(prop, properties, list)
+    if (prop->tag == tag)
+      return prop;
+
+  return NULL;
+}
+
+static void nsdp_output_tag_name(nsdp_tag_t tag, char *name, unsigned size)
+{
+  const struct nsdp_property_desc *desc = nsdp_get_property_desc_from_tag(tag);
+
+  if (desc)
+    snprintf(name, size, "%s", desc->name);
+  else
+    snprintf(name, size, "0x%04x", tag);
+}
+
+static void nsdp_output_csv_device(const char *event, const nsdp_mac_t mac,
+                                   const struct list_head *properties)
+{
+  const nsdp_property_t *prop;
+  unsigned i;
+
+  nsdp_output_begin("device");
+  nsdp_output_key("event");
+  nsdp_output_string(event, strlen(event));
+  nsdp_output_mac(mac);
+  for (i = 0 ; i < nsdp_output_column_count ; i += 1) {
+    nsdp_output_key(NULL);
+    prop = properties ?
+      nsdp_output_find(properties, nsdp_output_columns[i]) : NULL;
+    if (prop)
+      nsdp_output_tag(properties, prop);
+  }
+  // Port, status, statistics and message
+  nsdp_output_skip(2 + NSDP_OUTPUT_STATISTICS_COUNT + 1);
+  nsdp_output_end();
+}
+
+static void nsdp_output_json_device(const char *event, const nsdp_mac_t mac,
+                                    const struct list_head *properties)
+{
+  const nsdp_property_t *prop, *other;
+  char name[NSDP_OUTPUT_NAME_SIZE];
+
+  nsdp_output_begin("device");
+  nsdp_output_key("event");
+  nsdp_output_string(event, strlen(event));
+  nsdp_output_mac(mac);
+
+  if (properties) {
+    list_for_each_entry(prop, properties, list) {
+      if (prop->tag == NSDP_PROPERTY_TERMINATOR || prop->length == 0 ||
+          nsdp_output_is_port_tag(prop->tag))
+        continue;
+      // Only write each tag once
+      other = nsdp_output_find(properties, prop->tag);
+      if (other != prop)
+        continue;
+      nsdp_output_tag_name(prop->tag, name, sizeof(name));
+      nsdp_output_key(name);
+      nsdp_output_tag(properties, prop);
+    }
+  }
+
+  nsdp_output_end();
+}
+
+void nsdp_output_device(const char *event, const nsdp_mac_t mac,
+                        const struct list_head *properties)
+{
+  const nsdp_property_t *prop;
+
+  if (nsdp_output_format == NSDP_OUTPUT_CSV)
+    nsdp_output_csv_device(event, mac, properties);
+  else
+    nsdp_output_json_device(event, mac, properties);
+
+  if (!properties)
+    return;
+
+  list_for_each_entry(prop, properties, list)
+    if (nsdp_output_is_port_tag(prop->tag) && prop->length > 0)
+      nsdp_output_port(event, mac, prop);
+}
+
+void nsdp_output_port(const char *event, const nsdp_mac_t mac,
+                      const nsdp_property_t *prop)
+{
+  char txt[64], *status;
+  unsigned i;
+
+  if (prop->tag == NSDP_PROPERTY_PORT_STATUS) {
+    if (prop->length < 3)
+      return;
+  } else if (prop->tag == NSDP_PROPERTY_PORT_STATISTICS) {
+    if (prop->length < 1 + 8 * NSDP_OUTPUT_STATISTICS_COUNT)
+      return;
+  } else
+    return;
+
+  nsdp_output_begin("port");
+  nsdp_output_key("event");
+  nsdp_output_string(event, strlen(event));
+  nsdp_output_mac(mac);
+  if (nsdp_output_format == NSDP_OUTPUT_CSV)
+    nsdp_output_skip(nsdp_output_column_count);
+  nsdp_output_key("port");
+  printf("%u", prop->data[0]);
+
+  if (prop->tag == NSDP_PROPERTY_PORT_STATUS) {
+    // Drop the port number from the text form
+    if (nsdp_property_to_txt(prop, txt, sizeof(txt)) < 0)
+      snprintf(txt, sizeof(txt), "unknown");
+    status = strchr(txt, ':');
+    status = status ? status + 1 : txt;
+    nsdp_output_key("status");
+    nsdp_output_string(status, strlen(status));
+    if (nsdp_output_format == NSDP_OUTPUT_CSV)
+      nsdp_output_skip(NSDP_OUTPUT_STATISTICS_COUNT);
+  } else {
+    if (nsdp_output_format == NSDP_OUTPUT_CSV)
+      nsdp_output_skip(1);
+    for (i = 0 ; i < NSDP_OUTPUT_STATISTICS_COUNT ; i += 1) {
+      nsdp_output_key(nsdp_output_port_statistics[i]);
+      printf("%" PRIu64, nsdp_get_u64be(prop->data + 1 + 8 * i));
+    }
+  }
+
+  if (nsdp_output_format == NSDP_OUTPUT_CSV)
+    nsdp_output_skip(1);
+  nsdp_output_end();
+}
+
+void nsdp_output_status(const char *event, const char *message)
+{
+  nsdp_output_begin("status");
+  nsdp_output_key("event");
+  nsdp_output_string(event, strlen(event));
+  // Mac, device columns, port, status and statistics
+  if (nsdp_output_format == NSDP_OUTPUT_CSV)
+    nsdp_output_skip(1 + nsdp_output_column_count + 2 +
+                     NSDP_OUTPUT_STATISTICS_COUNT);
+  if (message || nsdp_output_format == NSDP_OUTPUT_CSV) {
+    nsdp_output_key("message");
+    if (message)
+      nsdp_output_string(message, strlen(message));
+  }
+  nsdp_output_end();
+}
@@ -0,0 +1,35 @@
+#ifndef NSDP_OUTPUT_H
+#define NSDP_OUTPUT_H
+
+#include "nsdp_packet.h"
+
+#define NSDP_OUTPUT_TEXT		0
+#define NSDP_OUTPUT_JSONL		1
+#define NSDP_OUTPUT_CSV			2
+
+// Select the output format from its name, text by default
+int nsdp_output_set_format(const char *name);
+
+int nsdp_output_get_format(void);
+
+// Set the properties written as columns of the CSV device records
+void nsdp_output_set_columns(const nsdp_tag_t *tags, unsigned count);
+
+// Set the ID written first in the following records, NULL for none
+void nsdp_output_set_id(const char *id);
+
+// Write a record that only has an event and an optional message
+void nsdp_output_status(const char *event, const char *message);
+
+// Write a record for a device, the per port properties are written
+// as their own records, one for each port.
+void nsdp_output_device(const char *event, const nsdp_mac_t mac,
+                        const struct list_head *properties);
+
+// Write a record for one port of a device
+void nsdp_output_port(const char *event, const nsdp_mac_t mac,
+                      const nsdp_property_t *prop);
+
+void nsdp_output_flush(void);
+
+#endif /* NSDP_OUTPUT_H */
@@ -8,7 +8,7 @@
 
 void nsdp_packet_init(nsdp_packet_t *pkt)
 {
-  memset(pkt, 0, sizeof(pkt));
+  memset(pkt, 0, sizeof(*pkt));
   INIT_LIST_HEAD(&pkt->properties);
 }
 
@@ -66,6 +66,22 @@ int nsdp_packet_has_terminator(nsdp_packet_t *pkt)
   return (last->tag == NSDP_PROPERTY_TERMINATOR);
 }
 
+const nsdp_property_t *nsdp_packet_find_value(const nsdp_packet_t *pkt,
+                                              const nsdp_property_t *prop)
+{
+  const nsdp_property_t *value;
+
+  if (!pkt || !prop)
+    return NULL;
+
+  nsdp_packet_for_each_property(pkt, value)
+    if (value->tag == prop->tag && value->length == prop->length &&
+        !memcmp(value->data, prop->data, prop->length))
+      return value;
+
+  return NULL;
+}
+
 int nsdp_packet_add_property(nsdp_packet_t *pkt, nsdp_property_t *property)
 {
   int term;
@@ -100,6 +116,28 @@ int nsdp_packet_add_properties_terminator(nsdp_packet_t *pkt)
   return err;
 }
 
+int nsdp_packet_write_header(const nsdp_packet_t *pkt, void *buffer,
+                             unsigned max_size)
+{
+  uint8_t *data = buffer;
+
+  if (!pkt || !buffer)
+    return -EINVAL;
+  if (max_size < NSDP_PKT_HEADER_SIZE)
+    return -E2BIG;
+
+  memset(data, 0, NSDP_PKT_HEADER_SIZE);
+  data[0x00] = 1; // version
+  data[0x01] = pkt->op;
+  data[0x02] = pkt->result;
+  memcpy(data+0x08, pkt->client_mac, sizeof(nsdp_mac_t));
+  memcpy(data+0x0e, pkt->server_mac, sizeof(nsdp_mac_t));
+  nsdp_set_u16be(data+0x16, pkt->seq_no);
+  memcpy(data+0x18, "NSDP", 4); // signature
+
+  return NSDP_PKT_HEADER_SIZE;
+}
+
 int nsdp_packet_write(const nsdp_packet_t *pkt, void *buffer,
                       unsigned max_size)
 {
@@ -115,30 +153,19 @@ int nsdp_packet_write(const nsdp_packet_t *pkt, void *buffer,
   if (length > max_size)
     return -E2BIG;
 
-  data[0x00] = 1; // version
-  data[0x01] = pkt->op;
-  memcpy(data+0x08, pkt->client_mac, sizeof(nsdp_mac_t));
-  memcpy(data+0x0e, pkt->server_mac, sizeof(nsdp_mac_t));
-  nsdp_set_u16be(data+0x16, pkt->seq_no);
-  memcpy(data+0x18, "NSDP", 4); // signature
+  nsdp_packet_write_header(pkt, data, max_size);
 
-  list_for_each_entry(prop, &pkt->properties, list) {
-    nsdp_set_u16be(data+pos, prop->tag);
-    nsdp_set_u16be(data+pos+2, prop->length);
-    if (prop->length > 0)
-      memcpy(data+pos+NSDP_PROPERTY_HEADER_SIZE, prop->data, prop->length);
-    pos += NSDP_PROPERTY_HEADER_SIZE + prop->length;
-  }
+  list_for_each_entry(prop, &pkt->properties, list)
+    pos += nsdp_property_write(prop, data+pos, max_size-pos);
 
   assert(pos == length);
   return pos;
 }
 
-int nsdp_packet_read(nsdp_packet_t *pkt, const void *buffer, unsigned size)
+int nsdp_packet_read_header(nsdp_packet_t *pkt, const void *buffer,
+                            unsigned size)
 {
   const uint8_t* data = buffer;
-  unsigned pos = NSDP_PKT_HEADER_SIZE;
-  int err;
 
   if (!pkt || !buffer ||
       size < NSDP_PKT_HEADER_SIZE + NSDP_PROPERTY_HEADER_SIZE)
@@ -148,15 +175,34 @@ int nsdp_packet_read(nsdp_packet_t *pkt, const void *buffer, unsigned size)
     return -EINVAL;
 
   pkt->op = data[1];
+  pkt->result = data[2];
   memcpy(pkt->client_mac, data+0x08, sizeof(nsdp_mac_t));
   memcpy(pkt->server_mac, data+0x0e, sizeof(nsdp_mac_t));
   pkt->seq_no = nsdp_get_u16be(data+0x16);
 
+  return NSDP_PKT_HEADER_SIZE;
+}
+
+int nsdp_packet_read(nsdp_packet_t *pkt, const void *buffer, unsigned size)
+{
+  const uint8_t* data = buffer;
+  unsigned pos = NSDP_PKT_HEADER_SIZE;
+  int err;
+
+  err = nsdp_packet_read_header(pkt, buffer, size);
+  if (err < 0)
+    return err;
+
   while (pos + NSDP_PROPERTY_HEADER_SIZE <= size) {
-    nsdp_property_t *prop =
-      nsdp_property_from_data(nsdp_get_u16be(data+pos),
-                              nsdp_get_u16be(data+pos+2),
-                              data+pos+NSDP_PROPERTY_HEADER_SIZE);
+    nsdp_length_t length = nsdp_get_u16be(data+pos+2);
+    nsdp_property_t *prop;
+
+    // Don't read past the end of the datagram
+    if (pos + NSDP_PROPERTY_HEADER_SIZE + length > size)
+      return -EINVAL;
+
+    prop = nsdp_property_from_data(nsdp_get_u16be(data+pos), length,
+                                   data+pos+NSDP_PROPERTY_HEADER_SIZE);
     if (!prop)
       return -ENOMEM;
     err = nsdp_packet_add_property(pkt, prop);
@@ -169,3 +215,18 @@ int nsdp_packet_read(nsdp_packet_t *pkt, const void *buffer, unsigned size)
 
   return pos;
 }
+
+int nsdp_packet_result_error(const nsdp_packet_t *pkt)
+{
+  if (!pkt)
+    return -EINVAL;
+
+  switch (pkt->result) {
+  case NSDP_RESULT_SUCCESS:
+    return 0;
+  case NSDP_RESULT_DENIED:
+    return -EACCES;
+  default:
+    return -EREMOTEIO;
+  }
+}
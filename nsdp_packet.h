@@ -6,7 +6,6 @@
 
 #define NSDP_PKT_HEADER_SIZE		0x20
 #define NSDP_PKT_TRAILER_SIZE		0x04
-#define NSDP_PROPERTY_HEADER_SIZE	0x04
 
 #define NSDP_OP_READ_REQUEST		0x01
 #define NSDP_OP_READ_RESPONSE		0x02
@@ -18,6 +17,13 @@
 #define NSDP_OP_IS_RESPONSE(op)	\
   ((op) == NSDP_OP_READ_RESPONSE || (op) == NSDP_OP_WRITE_RESPONSE)
 
+// Result codes of the responses
+#define NSDP_RESULT_SUCCESS		0x00
+#define NSDP_RESULT_READ_ONLY		0x05
+#define NSDP_RESULT_INVALID_VALUE	0x07
+// Wrong password
+#define NSDP_RESULT_DENIED		0x0a
+
 #define NSDP_OP_IS_READ(op)	\
   ((op) == NSDP_OP_READ_REQUEST || (op) == NSDP_OP_READ_RESPONSE)
 #define NSDP_OP_IS_WRITE(op)	\
@@ -26,6 +32,7 @@
 
 typedef struct nsdp_packet {
   nsdp_op_t		op;
+  uint8_t		result;
   nsdp_mac_t		client_mac;
   nsdp_mac_t		server_mac;
   nsdp_seq_no_t		seq_no;
@@ -42,14 +49,29 @@ void nsdp_packet_free(nsdp_packet_t *pkt);
 
 int nsdp_packet_length(const nsdp_packet_t *pkt);
 
+int nsdp_packet_has_terminator(nsdp_packet_t *pkt);
+
 int nsdp_packet_add_property(nsdp_packet_t *pkt, nsdp_property_t *property);
 
+// Find a property with the same tag and value as prop
+const nsdp_property_t *nsdp_packet_find_value(const nsdp_packet_t *pkt,
+                                              const nsdp_property_t *prop);
+
 int nsdp_packet_add_properties_terminator(nsdp_packet_t *pkt);
 
+int nsdp_packet_write_header(const nsdp_packet_t *pkt, void *buffer,
+                             unsigned max_size);
+
 int nsdp_packet_write(const nsdp_packet_t *pkt, void *buffer, unsigned max_size);
 
+int nsdp_packet_read_header(nsdp_packet_t *pkt, const void *buffer,
+                            unsigned size);
+
 int nsdp_packet_read(nsdp_packet_t *pkt, const void *buffer, unsigned size);
 
+// Error of the response result code, 0 on success
+int nsdp_packet_result_error(const nsdp_packet_t *pkt);
+
 #define nsdp_packet_for_each_property(pkt, t) \
   list_for_each_entry((t), &(pkt)->properties, list)
 
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "nsdp_port_monitor.h"
+
+static void nsdp_port_monitor_device_free(nsdp_port_monitor_device_t *dev)
+{
+  list_del(&dev->list);
+  // The poll callback frees it
+  if (dev->polling)
+    dev->removed = 1;
+  else
+    free(dev);
+}
+
+static void nsdp_port_monitor_publish_status(nsdp_state_port_t *port,
+                                             const uint8_t *status)
+{
+  static const uint32_t speed[] = { 0, 10, 10, 100, 100, 1000 };
+
+  memcpy(port->status, status, NSDP_PORT_STATUS_SIZE);
+  port->link = status[1] != 0;
+  port->speed = status[1] < ARRAY_SIZE(speed) ? speed[status[1]] : 0;
+}
+
+static void nsdp_port_monitor_publish_statistics(nsdp_state_port_t *port,
+                                                 const uint8_t *stats)
+{
+  port->rx = nsdp_get_u64be(stats + 1);
+  port->tx = nsdp_get_u64be(stats + 1 + 8);
+  port->packets = nsdp_get_u64be(stats + 1 + 2 * 8);
+  port->broadcast = nsdp_get_u64be(stats + 1 + 3 * 8);
+  port->multicast = nsdp_get_u64be(stats + 1 + 4 * 8);
+  port->crc_errors = nsdp_get_u64be(stats + 1 + 5 * 8);
+}
+
+// Copy a response in the state table record of the device
+static void nsdp_port_monitor_publish(nsdp_port_monitor_device_t *dev,
+                                      const nsdp_packet_t *response)
+{
+  nsdp_state_device_t *state = dev->state;
+  nsdp_property_t *prop;
+  struct timeval now;
+  unsigned port;
+
+  gettimeofday(&now, NULL);
+
+  nsdp_state_device_write_begin(state);
+  nsdp_packet_for_each_property(response, prop) {
+    if (prop->length < 1)
+      continue;
+    port = prop->data[0];
+    if (port >= NSDP_STATE_TABLE_MAX_PORTS)
+      continue;
+
+    if (prop->tag == NSDP_PROPERTY_PORT_STATUS &&
+        prop->length == NSDP_PORT_STATUS_SIZE)
+      nsdp_port_monitor_publish_status(&state->port[port], prop->data);
+    else if (prop->tag == NSDP_PROPERTY_PORT_STATISTICS &&
+             prop->length >= NSDP_PORT_STATISTICS_SIZE)
+      nsdp_port_monitor_publish_statistics(&state->port[port], prop->data);
+    else
+      continue;
+
+    if (port + 1 > state->port_count)
+      state->port_count = port + 1;
+  }
+  state->updated = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+  nsdp_state_device_write_end(state);
+}
+
+static int nsdp_port_monitor_on_response(nsdp_packet_t *response,
+                                         void *context)
+{
+  nsdp_port_monitor_device_t *dev = context;
+  nsdp_port_monitor_t *monitor;
+  nsdp_property_t *prop;
+  uint64_t bit;
+  unsigned port;
+
+  dev->polling = 0;
+  if (dev->removed) {
+    free(dev);
+    return 1;
+  }
+
+  // Keep the last snapshot on timeouts
+  if (!response)
+    return 1;
+
+  monitor = dev->monitor;
+  if (dev->state)
+    nsdp_port_monitor_publish(dev, response);
+
+  nsdp_packet_for_each_property(response, prop) {
+    if (prop->tag != NSDP_PROPERTY_PORT_STATUS ||
+        prop->length != NSDP_PORT_STATUS_SIZE)
+      continue;
+    port = prop->data[0];
+    if (port >= NSDP_PORT_MONITOR_MAX_PORTS)
+      continue;
+
+    bit = (uint64_t)1 << port;
+    if (!memcmp(dev->status[port], prop->data, NSDP_PORT_STATUS_SIZE))
+      continue;
+
+    if ((dev->known & bit) && monitor->on_change)
+      monitor->on_change(monitor, dev->mac, port, dev->status[port],
+                         prop->data, monitor->context);
+    memcpy(dev->status[port], prop->data, NSDP_PORT_STATUS_SIZE);
+    dev->known |= bit;
+  }
+
+  return 1;
+}
+
+static int nsdp_port_monitor_send(nsdp_port_monitor_t *monitor,
+                                  nsdp_port_monitor_device_t *dev)
+{
+  nsdp_client_request_t *req;
+  nsdp_property_t *prop;
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, dev->mac, NULL,
+                                nsdp_port_monitor_on_response, dev);
+  if (!req)
+    return -ENOMEM;
+  // Background polling, the other requests go first
+  req->priority = NSDP_CLIENT_PRIORITY_BULK;
+
+  prop = nsdp_property_new(NSDP_PROPERTY_PORT_STATUS, 0);
+  if (prop)
+    nsdp_packet_add_property(&req->packet, prop);
+  if (prop && monitor->state_table) {
+    prop = nsdp_property_new(NSDP_PROPERTY_PORT_STATISTICS, 0);
+    if (prop)
+      nsdp_packet_add_property(&req->packet, prop);
+  }
+  if (!prop) {
+    nsdp_client_request_free(req);
+    return -ENOMEM;
+  }
+  nsdp_packet_add_properties_terminator(&req->packet);
+
+  return nsdp_client_add_request(monitor->client, req);
+}
+
+static void nsdp_port_monitor_poll(int fd, short what, void *arg)
+{
+  nsdp_port_monitor_t *monitor = arg;
+  nsdp_port_monitor_device_t *dev;
+  struct timeval tv;
+  int err;
+
+  list_for_each_entry(dev, &monitor->devices, list) {
+    // Slow devices are not polled again before they answer
+    if (dev->polling)
+      continue;
+    err = nsdp_port_monitor_send(monitor, dev);
+    if (err)
+      fprintf(stderr, "Failed to poll the ports: %s\n", strerror(-err));
+    else
+      dev->polling = 1;
+  }
+
+  tv.tv_sec = monitor->interval / 1000;
+  tv.tv_usec = (monitor->interval % 1000) * 1000;
+  evtimer_add(monitor->timer, &tv);
+}
+
+int nsdp_port_monitor_init(nsdp_port_monitor_t *monitor,
+                           nsdp_client_t *client,
+                           nsdp_port_monitor_on_change_f on_change,
+                           void *context)
+{
+  if (!monitor || !client)
+    return -EINVAL;
+
+  memset(monitor, 0, sizeof(*monitor));
+  INIT_LIST_HEAD(&monitor->devices);
+  monitor->client = client;
+  monitor->interval = NSDP_PORT_MONITOR_INTERVAL;
+  monitor->on_change = on_change;
+  monitor->context = context;
+
+  monitor->timer = evtimer_new(client->ev_base,
+                               nsdp_port_monitor_poll, monitor);
+  if (!monitor->timer)
+    return -ENOMEM;
+
+  event_active(monitor->timer, EV_TIMEOUT, 0);
+  return 0;
+}
+
+void nsdp_port_monitor_uninit(nsdp_port_monitor_t *monitor)
+{
+  if (!monitor)
+    return;
+
+  while (!list_empty(&monitor->devices))
+    nsdp_port_monitor_device_free(
+      list_first_entry(&monitor->devices, nsdp_port_monitor_device_t, list));
+
+  if (monitor->timer)
+    event_free(monitor->timer);
+  monitor->timer = NULL;
+}
+
+int nsdp_port_monitor_set_interval(nsdp_port_monitor_t *monitor,
+                                   unsigned interval)
+{
+  if (!monitor || interval == 0)
+    return -EINVAL;
+  monitor->interval = interval;
+  return 0;
+}
+
+int nsdp_port_monitor_set_state_table(nsdp_port_monitor_t *monitor,
+                                      nsdp_state_table_t *table)
+{
+  nsdp_port_monitor_device_t *dev;
+
+  if (!monitor || !table || !table->writable)
+    return -EINVAL;
+
+  monitor->state_table = table;
+  list_for_each_entry(dev, &monitor->devices, list)
+    if (!dev->state)
+      dev->state = nsdp_state_table_add(table, dev->mac);
+
+  return 0;
+}
+
+static nsdp_port_monitor_device_t *
+nsdp_port_monitor_find(nsdp_port_monitor_t *monitor, const nsdp_mac_t mac)
+{
+  nsdp_port_monitor_device_t *dev;
+
+  list_for_each_entry(dev, &monitor->devices, list)
+    if (!memcmp(dev->mac, mac, sizeof(nsdp_mac_t)))
+      return dev;
+
+  return NULL;
+}
+
+int nsdp_port_monitor_subscribe(nsdp_port_monitor_t *monitor,
+                                const nsdp_mac_t mac)
+{
+  nsdp_port_monitor_device_t *dev;
+
+  if (!monitor || !mac || nsdp_mac_is_zero(mac))
+    return -EINVAL;
+
+  if (nsdp_port_monitor_find(monitor, mac))
+    return -EEXIST;
+
+  dev = calloc(1, sizeof(*dev));
+  if (!dev)
+    return -ENOMEM;
+
+  dev->monitor = monitor;
+  memcpy(dev->mac, mac, sizeof(nsdp_mac_t));
+  if (monitor->state_table) {
+    dev->state = nsdp_state_table_add(monitor->state_table, mac);
+    if (!dev->state) {
+      free(dev);
+      return -ENOSPC;
+    }
+  }
+  list_add_tail(&dev->list, &monitor->devices);
+  return 0;
+}
+
+int nsdp_port_monitor_unsubscribe(nsdp_port_monitor_t *monitor,
+                                  const nsdp_mac_t mac)
+{
+  nsdp_port_monitor_device_t *dev;
+
+  if (!monitor || !mac)
+    return -EINVAL;
+
+  dev = nsdp_port_monitor_find(monitor, mac);
+  if (!dev)
+    return -ENOENT;
+
+  nsdp_port_monitor_device_free(dev);
+  return 0;
+}
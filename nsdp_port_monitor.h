@@ -0,0 +1,74 @@
+#ifndef NSDP_PORT_MONITOR_H
+#define NSDP_PORT_MONITOR_H
+
+#include "nsdp_client.h"
+#include "nsdp_state_table.h"
+
+#define NSDP_PORT_MONITOR_MAX_PORTS	64
+// Size of a port status record: port, speed and flow control
+#define NSDP_PORT_STATUS_SIZE		3
+// Port and six 64 bits counters
+#define NSDP_PORT_STATISTICS_SIZE	(1 + 6 * 8)
+#define NSDP_PORT_MONITOR_INTERVAL	1000
+
+struct nsdp_port_monitor;
+
+// Called for each port whose status record changed
+typedef void (*nsdp_port_monitor_on_change_f)(
+  struct nsdp_port_monitor *monitor, const nsdp_mac_t mac, unsigned port,
+  const uint8_t *old_status, const uint8_t *status, void *context);
+
+typedef struct nsdp_port_monitor_device {
+  struct list_head			list;
+  struct nsdp_port_monitor		*monitor;
+  nsdp_mac_t				mac;
+  // Last status record of each port, as sent by the device
+  uint8_t				status[NSDP_PORT_MONITOR_MAX_PORTS]
+                                              [NSDP_PORT_STATUS_SIZE];
+  uint64_t				known;
+  // A poll is in flight
+  int					polling;
+  // Unsubscribed while polling, freed once the poll is done
+  int					removed;
+  // Record published in the state table
+  nsdp_state_device_t			*state;
+} nsdp_port_monitor_device_t;
+
+// Poll the port status of the subscribed devices
+typedef struct nsdp_port_monitor {
+  nsdp_client_t				*client;
+  struct list_head			devices;
+  struct event				*timer;
+  // Poll interval in milliseconds
+  unsigned				interval;
+  // Where the decoded status and counters get published
+  nsdp_state_table_t			*state_table;
+
+  nsdp_port_monitor_on_change_f		on_change;
+  void					*context;
+} nsdp_port_monitor_t;
+
+int nsdp_port_monitor_init(nsdp_port_monitor_t *monitor,
+                           nsdp_client_t *client,
+                           nsdp_port_monitor_on_change_f on_change,
+                           void *context);
+
+void nsdp_port_monitor_uninit(nsdp_port_monitor_t *monitor);
+
+// Set the poll interval in milliseconds
+int nsdp_port_monitor_set_interval(nsdp_port_monitor_t *monitor,
+                                   unsigned interval);
+
+// Publish the state of the ports in a state table, the counters are
+// then polled along with the status
+int nsdp_port_monitor_set_state_table(nsdp_port_monitor_t *monitor,
+                                      nsdp_state_table_t *table);
+
+// Start or stop following the ports of a device, the first poll
+// only takes a snapshot and doesn't report anything.
+int nsdp_port_monitor_subscribe(nsdp_port_monitor_t *monitor,
+                                const nsdp_mac_t mac);
+int nsdp_port_monitor_unsubscribe(nsdp_port_monitor_t *monitor,
+                                  const nsdp_mac_t mac);
+
+#endif /* NSDP_PORT_MONITOR_H */
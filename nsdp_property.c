@@ -18,6 +18,7 @@ nsdp_property_t*
   INIT_LIST_HEAD(&prop->list);
   prop->tag = tag;
   prop->length = length;
+  prop->data = (uint8_t*)(prop + 1);
 
   return prop;
 }
@@ -37,6 +38,21 @@ nsdp_property_t*
   return prop;
 }
 
+nsdp_property_t*
+  nsdp_property_from_shared(unsigned tag, unsigned length, const void* data)
+{
+  nsdp_property_t *prop;
+
+  prop = nsdp_property_new(tag, 0);
+  if (!prop)
+    return NULL;
+
+  prop->length = length;
+  prop->data = (uint8_t*)data;
+
+  return prop;
+}
+
 nsdp_property_t*
   nsdp_property_from_txt(const struct nsdp_property_desc* desc,
                          const char* txt)
@@ -79,6 +95,27 @@ int nsdp_property_to_txt(const nsdp_property_t *prop, char* txt,
     -EINVAL;
 }
 
+int nsdp_property_write(const nsdp_property_t *prop, void *buffer,
+                        unsigned max_size)
+{
+  uint8_t *data = buffer;
+  unsigned length;
+
+  if (!prop || !buffer)
+    return -EINVAL;
+
+  length = NSDP_PROPERTY_HEADER_SIZE + prop->length;
+  if (length > max_size)
+    return -E2BIG;
+
+  nsdp_set_u16be(data, prop->tag);
+  nsdp_set_u16be(data+2, prop->length);
+  if (prop->length > 0)
+    memcpy(data+NSDP_PROPERTY_HEADER_SIZE, prop->data, prop->length);
+
+  return length;
+}
+
 void nsdp_property_free(nsdp_property_t *prop)
 {
   list_del(&prop->list);
@@ -5,6 +5,8 @@
 #include "nsdp_property_types.h"
 #include "nsdp_properties.h"
 
+#define NSDP_PROPERTY_HEADER_SIZE	0x04
+
 struct nsdp_property_desc {
   nsdp_tag_t				tag;
   const char				*name;
@@ -30,7 +32,8 @@ typedef struct nsdp_property {
   struct list_head	list;
   nsdp_tag_t		tag;
   nsdp_length_t		length;
-  uint8_t		data[0];
+  // Value stored right after the property, or a shared one
+  uint8_t		*data;
 } nsdp_property_t;
 
 // Create a property object
@@ -41,6 +44,11 @@ nsdp_property_t*
 nsdp_property_t*
   nsdp_property_from_data(unsigned tag, unsigned length, const void *data);
 
+// Create a property object pointing to data instead of holding a copy,
+// data must not change and outlive the property
+nsdp_property_t*
+  nsdp_property_from_shared(unsigned tag, unsigned length, const void *data);
+
 // Create a property from its human readable form
 nsdp_property_t*
   nsdp_property_from_txt(const struct nsdp_property_desc* desc,
@@ -54,6 +62,10 @@ const struct nsdp_property_desc*
 int nsdp_property_to_txt(const nsdp_property_t *prop,
                          char* txt, unsigned size);
 
+// Write the property in wire format, return the written size
+int nsdp_property_write(const nsdp_property_t *prop,
+                        void *buffer, unsigned max_size);
+
 // Free the property
 void nsdp_property_free(nsdp_property_t* prop);
 
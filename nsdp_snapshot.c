@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nsdp_snapshot.h"
+
+// Record fields holding the value of a property
+static const struct nsdp_snapshot_field {
+  nsdp_tag_t				tag;
+  unsigned				offset;
+  unsigned				size;
+  // NUL terminated string, shorter values are allowed
+  int					string;
+} nsdp_snapshot_fields[] = {
+#define NSDP_SNAPSHOT_FIELD(tag, field, string)				\
+  { NSDP_PROPERTY_##tag, offsetof(nsdp_snapshot_record_t, field),	\
+    sizeof(((nsdp_snapshot_record_t*)0)->field), string }
+  NSDP_SNAPSHOT_FIELD(MODEL, model, 1),
+  NSDP_SNAPSHOT_FIELD(HOSTNAME, hostname, 1),
+  NSDP_SNAPSHOT_FIELD(MAC, mac, 0),
+  NSDP_SNAPSHOT_FIELD(IP, ip, 0),
+  NSDP_SNAPSHOT_FIELD(NETMASK, netmask, 0),
+  NSDP_SNAPSHOT_FIELD(GATEWAY, gateway, 0),
+  NSDP_SNAPSHOT_FIELD(DHCP, dhcp, 0),
+  NSDP_SNAPSHOT_FIELD(FIRMWARE_VERSION, firmware, 1),
+  NSDP_SNAPSHOT_FIELD(PORT_COUNT, port_count, 0),
+#undef NSDP_SNAPSHOT_FIELD
+};
+
+static void nsdp_snapshot_fill(nsdp_snapshot_record_t *record,
+                               const nsdp_device_t *device)
+{
+  const char *iface = nsdp_device_get_index(device,
+                                            NSDP_INVENTORY_INDEX_IFACE);
+  const struct nsdp_snapshot_field *field;
+  const nsdp_property_t *prop;
+  uint8_t *data;
+  unsigned i, len;
+
+  memset(record, 0, sizeof(*record));
+  memcpy(record->mac, device->mac, sizeof(nsdp_mac_t));
+  record->last_seen = device->last_seen;
+  if (iface)
+    snprintf(record->iface, sizeof(record->iface), "%s", iface);
+
+  for (i = 0 ; i < ARRAY_SIZE(nsdp_snapshot_fields) ; i += 1) {
+    field = &nsdp_snapshot_fields[i];
+    prop = nsdp_device_get_property(device, field->tag);
+    if (!prop)
+      continue;
+
+    data = (uint8_t*)record + field->offset;
+    if (field->string) {
+      len = prop->length < field->size - 1 ? prop->length : field->size - 1;
+      memcpy(data, prop->data, len);
+      data[len] = 0;
+    } else if (prop->length == field->size)
+      memcpy(data, prop->data, field->size);
+    else
+      continue;
+
+    if (record->tag_count < NSDP_SNAPSHOT_MAX_TAGS)
+      record->tags[record->tag_count++] = field->tag;
+  }
+}
+
+// Add the tags supported by the model of the device
+static void nsdp_snapshot_fill_capability(nsdp_snapshot_record_t *record,
+                                          const nsdp_device_t *device,
+                                          nsdp_capability_cache_t *cache)
+{
+  nsdp_capability_t *cap;
+  int count;
+
+  cap = nsdp_capability_find_model(
+    cache, nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_MODEL),
+    nsdp_device_get_index(device, NSDP_INVENTORY_INDEX_FIRMWARE));
+  if (!cap)
+    return;
+
+  count = nsdp_capability_get_supported(cache, cap, record->supported,
+                                        NSDP_SNAPSHOT_MAX_SUPPORTED);
+  if (count < 0)
+    return;
+
+  record->flags |= NSDP_SNAPSHOT_FLAG_CAPABILITY;
+  record->supported_count = count;
+}
+
+static int nsdp_snapshot_has_tag(const nsdp_snapshot_record_t *record,
+                                 nsdp_tag_t tag)
+{
+  unsigned i;
+
+  for (i = 0 ; i < record->tag_count && i < NSDP_SNAPSHOT_MAX_TAGS ; i += 1)
+    if (record->tags[i] == tag)
+      return 1;
+
+  return 0;
+}
+
+int nsdp_snapshot_save(const nsdp_inventory_t *inventory, const char *path)
+{
+  return nsdp_snapshot_save_capabilities(inventory, NULL, path);
+}
+
+int nsdp_snapshot_save_capabilities(const nsdp_inventory_t *inventory,
+                                    nsdp_capability_cache_t *cache,
+                                    const char *path)
+{
+  nsdp_snapshot_header_t header = {
+    .magic = NSDP_SNAPSHOT_MAGIC,
+    .version = NSDP_SNAPSHOT_VERSION,
+    .record_size = sizeof(nsdp_snapshot_record_t),
+  };
+  nsdp_snapshot_record_t record;
+  const nsdp_device_t *device;
+  char *tmp_path;
+  FILE *file;
+  int err = 0;
+
+  if (!inventory || !path)
+    return -EINVAL;
+
+  tmp_path = malloc(strlen(path) + 5);
+  if (!tmp_path)
+    return -ENOMEM;
+  sprintf(tmp_path, "%s.tmp", path);
+
+  file = fopen(tmp_path, "w");
+  if (!file) {
+    err = -errno;
+    free(tmp_path);
+    return err;
+  }
+
+  header.count = inventory->count;
+  header.saved = time(NULL);
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    err = -errno;
+
+  list_for_each_entry(device, &inventory->devices, list) {
+    if (err)
+      break;
+    nsdp_snapshot_fill(&record, device);
+    if (cache)
+      nsdp_snapshot_fill_capability(&record, device, cache);
+    if (fwrite(&record, sizeof(record), 1, file) != 1)
+      err = -errno;
+  }
+
+  // Readers see either the old or the new snapshot, never a partial one
+  if (!err && (fflush(file) || fsync(fileno(file))))
+    err = -errno;
+  if (fclose(file) && !err)
+    err = -errno;
+  if (!err && rename(tmp_path, path))
+    err = -errno;
+  if (err)
+    unlink(tmp_path);
+
+  free(tmp_path);
+  return err;
+}
+
+// Rebuild the read response that gave this record
+static int nsdp_snapshot_load_record(nsdp_inventory_t *inventory,
+                                     nsdp_capability_cache_t *cache,
+                                     const nsdp_snapshot_record_t *record)
+{
+  const struct nsdp_snapshot_field *field;
+  char iface[NSDP_SNAPSHOT_IFACE_SIZE];
+  const uint8_t *data;
+  nsdp_device_t *device;
+  nsdp_property_t *prop;
+  nsdp_packet_t packet;
+  unsigned i, len;
+  int err = 0;
+
+  nsdp_packet_init(&packet);
+  packet.op = NSDP_OP_READ_RESPONSE;
+  memcpy(packet.server_mac, record->mac, sizeof(nsdp_mac_t));
+
+  for (i = 0 ; i < ARRAY_SIZE(nsdp_snapshot_fields) && !err ; i += 1) {
+    field = &nsdp_snapshot_fields[i];
+    if (!nsdp_snapshot_has_tag(record, field->tag))
+      continue;
+
+    data = (const uint8_t*)record + field->offset;
+    len = field->string ? strnlen((const char*)data, field->size) :
+      field->size;
+    prop = nsdp_property_from_data(field->tag, len, data);
+    if (!prop)
+      err = -ENOMEM;
+    else
+      nsdp_packet_add_property(&packet, prop);
+  }
+
+  if (!err) {
+    snprintf(iface, sizeof(iface), "%.*s", (int)sizeof(record->iface) - 1,
+             record->iface);
+    err = nsdp_inventory_update_iface(inventory, &packet,
+                                      iface[0] ? iface : NULL);
+    device = nsdp_inventory_find(inventory, record->mac);
+    if (device)
+      device->last_seen = record->last_seen;
+
+    // A model being probed keeps the result of the probe
+    if (err >= 0 && device && cache &&
+        (record->flags & NSDP_SNAPSHOT_FLAG_CAPABILITY) &&
+        record->supported_count <= NSDP_SNAPSHOT_MAX_SUPPORTED) {
+      err = nsdp_capability_set_supported(cache, device, record->supported,
+                                          record->supported_count);
+      if (err == -EBUSY || err == -ENOENT)
+        err = 0;
+    }
+  }
+
+  nsdp_packet_uninit(&packet);
+  return err < 0 ? err : 0;
+}
+
+int nsdp_snapshot_load(nsdp_inventory_t *inventory, const char *path)
+{
+  return nsdp_snapshot_load_capabilities(inventory, NULL, path);
+}
+
+int nsdp_snapshot_load_capabilities(nsdp_inventory_t *inventory,
+                                    nsdp_capability_cache_t *cache,
+                                    const char *path)
+{
+  const nsdp_snapshot_header_t *header;
+  const nsdp_snapshot_record_t *record;
+  struct stat st;
+  void *map;
+  unsigned i;
+  int fd, err = 0;
+
+  if (!inventory || !path || (cache && cache->inventory != inventory))
+    return -EINVAL;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st)) {
+    err = -errno;
+    close(fd);
+    return err;
+  }
+
+  if (st.st_size < sizeof(*header)) {
+    close(fd);
+    return -EBADMSG;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  header = map;
+  if (header->magic != NSDP_SNAPSHOT_MAGIC ||
+      header->version != NSDP_SNAPSHOT_VERSION ||
+      header->record_size != sizeof(*record) ||
+      sizeof(*header) + (unsigned long)header->count * sizeof(*record) >
+      st.st_size) {
+    munmap(map, st.st_size);
+    return -EBADMSG;
+  }
+
+  record = (const nsdp_snapshot_record_t*)(header + 1);
+  for (i = 0 ; i < header->count && !err ; i += 1)
+    err = nsdp_snapshot_load_record(inventory, cache, &record[i]);
+
+  munmap(map, st.st_size);
+  return err ? err : i;
+}
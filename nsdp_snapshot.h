@@ -0,0 +1,73 @@
+#ifndef NSDP_SNAPSHOT_H
+#define NSDP_SNAPSHOT_H
+
+#include "nsdp_capability.h"
+
+#define NSDP_SNAPSHOT_MAGIC		0x4E534449 /* NSDI */
+#define NSDP_SNAPSHOT_VERSION		2
+
+#define NSDP_SNAPSHOT_IFACE_SIZE	16
+#define NSDP_SNAPSHOT_STRING_SIZE	64
+#define NSDP_SNAPSHOT_MAX_TAGS		32
+#define NSDP_SNAPSHOT_MAX_SUPPORTED	256
+
+// The record has the tags supported by the model of the device
+#define NSDP_SNAPSHOT_FLAG_CAPABILITY	0x01
+
+// Start of the file, followed by count records
+typedef struct nsdp_snapshot_header {
+  uint32_t				magic;
+  uint32_t				version;
+  uint32_t				record_size;
+  uint32_t				count;
+  // Time of the save, in seconds since the epoch
+  uint64_t				saved;
+} nsdp_snapshot_header_t;
+
+// A device, the strings are NUL terminated and truncated if needed
+typedef struct nsdp_snapshot_record {
+  nsdp_mac_t				mac;
+  uint8_t				ip[4];
+  uint8_t				netmask[4];
+  uint8_t				gateway[4];
+  uint8_t				dhcp;
+  uint8_t				port_count;
+  uint8_t				tag_count;
+  uint8_t				flags;
+  uint64_t				last_seen;
+  // Interface the device was found on
+  char					iface[NSDP_SNAPSHOT_IFACE_SIZE];
+  char					model[NSDP_SNAPSHOT_STRING_SIZE];
+  char					hostname[NSDP_SNAPSHOT_STRING_SIZE];
+  char					firmware[NSDP_SNAPSHOT_STRING_SIZE];
+  // Properties the device has a value for, only these fields are set
+  // and loaded back
+  nsdp_tag_t				tags[NSDP_SNAPSHOT_MAX_TAGS];
+  // Tags supported by the model, with NSDP_SNAPSHOT_FLAG_CAPABILITY
+  uint16_t				supported_count;
+  nsdp_tag_t				supported[NSDP_SNAPSHOT_MAX_SUPPORTED];
+} nsdp_snapshot_record_t;
+
+// Save the inventory in a file, replaced atomically
+int nsdp_snapshot_save(const nsdp_inventory_t *inventory, const char *path);
+
+// Add the devices of a snapshot to an inventory, with the interface
+// they were found on. They keep the generation of the inventory so the
+// following scans expire the devices that are gone. Return the number
+// of devices loaded.
+int nsdp_snapshot_load(nsdp_inventory_t *inventory, const char *path);
+
+// Same, also saving the tags supported by the models known to the
+// cache, which can be NULL
+int nsdp_snapshot_save_capabilities(const nsdp_inventory_t *inventory,
+                                    nsdp_capability_cache_t *cache,
+                                    const char *path);
+
+// Same, also setting the tags supported by the models in the cache, if
+// not NULL. The cache must be the one of the inventory, so the probes
+// are only sent for the models missing from the snapshot.
+int nsdp_snapshot_load_capabilities(nsdp_inventory_t *inventory,
+                                    nsdp_capability_cache_t *cache,
+                                    const char *path);
+
+#endif /* NSDP_SNAPSHOT_H */
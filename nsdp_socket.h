@@ -10,6 +10,11 @@
 // bound to the given address and/or device
 int nsdp_socket_open(const char* dev, const char* local_addr,
                      int local_port, nsdp_socket_t* sock);
+// Same as nsdp_socket_open() but with SO_REUSEADDR, so several
+// clients and listeners on this host can bind the same port. The
+// other programs that bind it must set SO_REUSEADDR too.
+int nsdp_socket_open_shared(const char* dev, const char* local_addr,
+                            int local_port, nsdp_socket_t* sock);
 int nsdp_socket_close(nsdp_socket_t sock);
 
 int nsdp_socket_sendto(nsdp_socket_t sock, const void *buf,
@@ -19,9 +24,13 @@ int nsdp_socket_recvfrom(nsdp_socket_t sock, void *buf,
                          unsigned length, nsdp_socket_addr_t *from);
 
 int nsdp_socket_addr_aton(nsdp_socket_addr_t* addr, const char* ip);
+int nsdp_socket_addr_from_ip4(nsdp_socket_addr_t* addr, const void *ip4);
 int nsdp_socket_addr_set_broadcast(nsdp_socket_addr_t* addr);
 int nsdp_socket_addr_set_anyaddr(nsdp_socket_addr_t* addr);
 int nsdp_socket_addr_set_port(nsdp_socket_addr_t* addr, unsigned port);
+int nsdp_socket_addr_is_broadcast(const nsdp_socket_addr_t* addr);
+int nsdp_socket_addr_equal(const nsdp_socket_addr_t* a,
+                           const nsdp_socket_addr_t* b);
 
 int nsdp_iface_get_mac(const char* iface, uint8_t mac[6]);
 
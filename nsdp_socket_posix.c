@@ -11,8 +11,9 @@
 
 #include "nsdp_socket.h"
 
-int nsdp_socket_open(const char* dev, const char* local_addr,
-                     int local_port, nsdp_socket_t* sock)
+static int nsdp_socket_open_common(const char* dev, const char* local_addr,
+                                   int local_port, int reuse,
+                                   nsdp_socket_t* sock)
 {
   int err = 0, broadcast = 1, fd;
   struct sockaddr_in addr = { .sin_family = AF_INET,
@@ -29,6 +30,13 @@ int nsdp_socket_open(const char* dev, const char* local_addr,
   if (err)
     fprintf(stderr, "Failed to set broadcast mode: %s\n", strerror(errno));
 
+  // Share the port with the other sockets that asked for it
+  if (reuse) {
+    err = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (err)
+      fprintf(stderr, "Failed to set address reuse: %s\n", strerror(errno));
+  }
+
   // If a device is given, bind to it
   if (dev) {
 #ifdef SO_BINDTODEVICE
@@ -75,6 +83,18 @@ int nsdp_socket_open(const char* dev, const char* local_addr,
   return err;
 }
 
+int nsdp_socket_open(const char* dev, const char* local_addr,
+                     int local_port, nsdp_socket_t* sock)
+{
+  return nsdp_socket_open_common(dev, local_addr, local_port, 0, sock);
+}
+
+int nsdp_socket_open_shared(const char* dev, const char* local_addr,
+                            int local_port, nsdp_socket_t* sock)
+{
+  return nsdp_socket_open_common(dev, local_addr, local_port, 1, sock);
+}
+
 int nsdp_socket_close(nsdp_socket_t sock)
 {
   return close(sock);
@@ -87,8 +107,8 @@ int nsdp_socket_sendto(nsdp_socket_t sock, const void *buf,
                 (const struct sockaddr*)to, to ? sizeof(*to) : 0);
 }
 
-int nsdp_socket_recvfrm(nsdp_socket_t sock, void *buf,
-                        unsigned length, nsdp_socket_addr_t *from)
+int nsdp_socket_recvfrom(nsdp_socket_t sock, void *buf,
+                         unsigned length, nsdp_socket_addr_t *from)
 {
   socklen_t slen = sizeof(*from);
   return recvfrom(sock, buf, length, 0,
@@ -107,6 +127,17 @@ int nsdp_socket_addr_aton(nsdp_socket_addr_t* addr, const char* ip)
   return 0;
 }
 
+int nsdp_socket_addr_from_ip4(nsdp_socket_addr_t* addr, const void *ip4)
+{
+  if (!addr || !ip4)
+    return -EINVAL;
+
+  addr->sin_family = AF_INET;
+  memcpy(&addr->sin_addr, ip4, sizeof(addr->sin_addr));
+
+  return 0;
+}
+
 int nsdp_socket_addr_set_broadcast(nsdp_socket_addr_t* addr)
 {
   if (!addr)
@@ -139,3 +170,18 @@ int nsdp_socket_addr_set_port(nsdp_socket_addr_t* addr, unsigned port)
   return 0;
 }
 
+int nsdp_socket_addr_is_broadcast(const nsdp_socket_addr_t* addr)
+{
+  return addr && addr->sin_addr.s_addr == INADDR_BROADCAST;
+}
+
+int nsdp_socket_addr_equal(const nsdp_socket_addr_t* a,
+                           const nsdp_socket_addr_t* b)
+{
+  if (!a || !b)
+    return 0;
+
+  return a->sin_family == b->sin_family &&
+    a->sin_addr.s_addr == b->sin_addr.s_addr &&
+    a->sin_port == b->sin_port;
+}
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nsdp_state_table.h"
+
+static int nsdp_state_table_map(nsdp_state_table_t *table, int fd,
+                                unsigned long size, int writable)
+{
+  void *map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+    return -errno;
+
+  table->header = map;
+  table->device = (nsdp_state_device_t*)(table->header + 1);
+  table->size = size;
+  table->writable = writable;
+  return 0;
+}
+
+int nsdp_state_table_create(nsdp_state_table_t *table, const char *path,
+                            unsigned capacity)
+{
+  unsigned long size;
+  char *tmp_path;
+  int fd, err;
+
+  if (!table || !path)
+    return -EINVAL;
+  if (capacity == 0)
+    capacity = NSDP_STATE_TABLE_CAPACITY;
+
+  size = sizeof(nsdp_state_header_t) +
+    (unsigned long)capacity * sizeof(nsdp_state_device_t);
+
+  // Build the table in a new file and move it over the old one, the
+  // readers that still map the old file would get SIGBUS if it shrunk.
+  tmp_path = malloc(strlen(path) + 5);
+  if (!tmp_path)
+    return -ENOMEM;
+  sprintf(tmp_path, "%s.tmp", path);
+
+  fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    err = -errno;
+    free(tmp_path);
+    return err;
+  }
+
+  if (ftruncate(fd, size))
+    err = -errno;
+  else
+    err = nsdp_state_table_map(table, fd, size, 1);
+  close(fd);
+  if (err)
+    goto error;
+
+  table->header->version = NSDP_STATE_TABLE_VERSION;
+  table->header->record_size = sizeof(nsdp_state_device_t);
+  table->header->capacity = capacity;
+  __atomic_store_n(&table->header->magic, NSDP_STATE_TABLE_MAGIC,
+                   __ATOMIC_RELEASE);
+
+  if (rename(tmp_path, path)) {
+    err = -errno;
+    nsdp_state_table_close(table);
+    goto error;
+  }
+
+  free(tmp_path);
+  return 0;
+
+ error:
+  unlink(tmp_path);
+  free(tmp_path);
+  return err;
+}
+
+int nsdp_state_table_open(nsdp_state_table_t *table, const char *path)
+{
+  const nsdp_state_header_t *header;
+  struct stat st;
+  int fd, err;
+
+  if (!table || !path)
+    return -EINVAL;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat(fd, &st)) {
+    err = -errno;
+    close(fd);
+    return err;
+  }
+
+  if (st.st_size < sizeof(nsdp_state_header_t)) {
+    close(fd);
+    return -EBADMSG;
+  }
+
+  err = nsdp_state_table_map(table, fd, st.st_size, 0);
+  close(fd);
+  if (err)
+    return err;
+
+  header = table->header;
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) !=
+      NSDP_STATE_TABLE_MAGIC ||
+      header->version != NSDP_STATE_TABLE_VERSION ||
+      header->record_size != sizeof(nsdp_state_device_t) ||
+      sizeof(*header) + (unsigned long)header->capacity *
+      sizeof(nsdp_state_device_t) > table->size) {
+    nsdp_state_table_close(table);
+    return -EBADMSG;
+  }
+
+  return 0;
+}
+
+void nsdp_state_table_close(nsdp_state_table_t *table)
+{
+  if (!table || !table->header)
+    return;
+
+  munmap(table->header, table->size);
+  table->header = NULL;
+  table->device = NULL;
+}
+
+nsdp_state_device_t *nsdp_state_table_add(nsdp_state_table_t *table,
+                                          const nsdp_mac_t mac)
+{
+  nsdp_state_device_t *device;
+  unsigned count, i;
+
+  if (!table || !table->writable || !mac)
+    return NULL;
+
+  // Records are never removed, reuse the one of a device added again
+  count = table->header->count;
+  for (i = 0 ; i < count ; i += 1)
+    if (!memcmp(table->device[i].mac, mac, sizeof(nsdp_mac_t)))
+      return &table->device[i];
+
+  if (count >= table->header->capacity)
+    return NULL;
+
+  device = &table->device[count];
+  memcpy(device->mac, mac, sizeof(nsdp_mac_t));
+  // Publish the record once it is filled
+  __atomic_store_n(&table->header->count, count + 1, __ATOMIC_RELEASE);
+  return device;
+}
+
+unsigned nsdp_state_table_count(const nsdp_state_table_t *table)
+{
+  unsigned count;
+
+  if (!table || !table->header)
+    return 0;
+
+  count = __atomic_load_n(&table->header->count, __ATOMIC_ACQUIRE);
+  return count < table->header->capacity ? count : table->header->capacity;
+}
+
+void nsdp_state_device_write_begin(nsdp_state_device_t *device)
+{
+  __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void nsdp_state_device_write_end(nsdp_state_device_t *device)
+{
+  __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELEASE);
+}
+
+int nsdp_state_table_read(const nsdp_state_table_t *table, unsigned index,
+                          nsdp_state_device_t *copy)
+{
+  const nsdp_state_device_t *device;
+  uint32_t seq;
+  unsigned i;
+
+  if (!table || !copy || index >= nsdp_state_table_count(table))
+    return -EINVAL;
+
+  device = &table->device[index];
+  for (i = 0 ; i < NSDP_STATE_TABLE_READ_RETRIES ; i += 1) {
+    seq = __atomic_load_n(&device->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    memcpy(copy, device, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&device->seq, __ATOMIC_RELAXED) == seq)
+      return 0;
+  }
+
+  return -EBUSY;
+}
@@ -0,0 +1,87 @@
+#ifndef NSDP_STATE_TABLE_H
+#define NSDP_STATE_TABLE_H
+
+#include "nsdp_types.h"
+
+#define NSDP_STATE_TABLE_MAGIC		0x4E534454 /* NSDT */
+#define NSDP_STATE_TABLE_VERSION	1
+#define NSDP_STATE_TABLE_MAX_PORTS	64
+#define NSDP_STATE_TABLE_CAPACITY	1024
+// Attempts of a reader before giving up on a record being written
+#define NSDP_STATE_TABLE_READ_RETRIES	1000
+
+// Decoded state of a port, the counters are 0 until they are polled
+typedef struct nsdp_state_port {
+  // Raw status record: port, speed and flow control
+  uint8_t				status[3];
+  uint8_t				link;
+  // Link speed in Mbit/s
+  uint32_t				speed;
+  uint64_t				rx;
+  uint64_t				tx;
+  uint64_t				packets;
+  uint64_t				broadcast;
+  uint64_t				multicast;
+  uint64_t				crc_errors;
+} nsdp_state_port_t;
+
+// Record of a device, seq is odd while the poller writes it
+typedef struct nsdp_state_device {
+  uint32_t				seq;
+  // Ports are indexed by their number, this is the highest one + 1
+  uint32_t				port_count;
+  nsdp_mac_t				mac;
+  uint8_t				reserved[2];
+  // Time of the last update, in milliseconds since the epoch
+  uint64_t				updated;
+  nsdp_state_port_t			port[NSDP_STATE_TABLE_MAX_PORTS];
+} __attribute__((aligned(64))) nsdp_state_device_t;
+
+// Start of the file, followed by capacity device records
+typedef struct nsdp_state_header {
+  uint32_t				magic;
+  uint32_t				version;
+  uint32_t				record_size;
+  uint32_t				capacity;
+  // Records in use, only ever grows
+  uint32_t				count;
+} __attribute__((aligned(64))) nsdp_state_header_t;
+
+// Fixed layout memory-mapped file holding the latest port state of
+// the polled devices. The poller is the only writer, readers in other
+// processes map it read only and take consistent copies of the records
+// without any lock or syscall.
+typedef struct nsdp_state_table {
+  nsdp_state_header_t			*header;
+  nsdp_state_device_t			*device;
+  unsigned long				size;
+  int					writable;
+} nsdp_state_table_t;
+
+// Create a new empty table and map it for writing, it replaces the
+// file at path, the readers should open it again to see the new one
+int nsdp_state_table_create(nsdp_state_table_t *table, const char *path,
+                            unsigned capacity);
+
+// Map an existing file for reading
+int nsdp_state_table_open(nsdp_state_table_t *table, const char *path);
+
+void nsdp_state_table_close(nsdp_state_table_t *table);
+
+// Get the record of a device, adding it if needed, the writer should
+// keep the returned pointer as the lookup is linear
+nsdp_state_device_t *nsdp_state_table_add(nsdp_state_table_t *table,
+                                          const nsdp_mac_t mac);
+
+// Number of records that can be read
+unsigned nsdp_state_table_count(const nsdp_state_table_t *table);
+
+// Enclose every update of a record, readers retry while it is written
+void nsdp_state_device_write_begin(nsdp_state_device_t *device);
+void nsdp_state_device_write_end(nsdp_state_device_t *device);
+
+// Copy a record, return -EBUSY if it was always changing while copied
+int nsdp_state_table_read(const nsdp_state_table_t *table, unsigned index,
+                          nsdp_state_device_t *copy);
+
+#endif /* NSDP_STATE_TABLE_H */
@@ -13,12 +13,33 @@ typedef uint8_t 	nsdp_mac_t[6];
 typedef uint16_t	nsdp_seq_no_t;
 typedef uint8_t 	nsdp_sig_t[4];
 
+static inline int nsdp_mac_is_zero(const nsdp_mac_t mac)
+{
+  return !(mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]);
+}
+
+static inline unsigned nsdp_mac_hash(const nsdp_mac_t mac)
+{
+  unsigned i, hash = 2166136261u;
+
+  for (i = 0 ; i < sizeof(nsdp_mac_t) ; i += 1)
+    hash = (hash ^ mac[i]) * 16777619u;
+
+  return hash;
+}
+
 static inline void nsdp_set_u16be(void* buf, uint16_t val)
 {
   ((uint8_t*)buf)[1] = (val >> 0) & 0xFF;
   ((uint8_t*)buf)[0] = (val >> 8) & 0xFF;
 }
 
+static inline void nsdp_set_u32be(void* buf, uint32_t val)
+{
+  nsdp_set_u16be((uint8_t*)buf + 2, val & 0xFFFF);
+  nsdp_set_u16be(buf, val >> 16);
+}
+
 static inline uint16_t nsdp_get_u16be(const void *buf)
 {
   return ((((uint16_t)(((uint8_t*)buf)[1])) << 0) |
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_watch.h"
+
+static void nsdp_watch_on_change(nsdp_inventory_t *inventory,
+                                 const nsdp_device_t *device,
+                                 int event, void *context)
+{
+  nsdp_watch_t *watch = context;
+
+  watch->changed = 1;
+  if (watch->on_change)
+    watch->on_change(inventory, device, event, watch->context);
+}
+
+// Remove the devices that didn't answer the last scans
+static void nsdp_watch_expire(nsdp_watch_t *watch)
+{
+  nsdp_inventory_t *inventory = watch->inventory;
+  nsdp_device_t *device, *next;
+
+  list_for_each_entry_safe(device, next, &inventory->devices, list)
+    if (inventory->generation - device->generation >= watch->max_missed)
+      nsdp_inventory_remove(inventory, device);
+}
+
+static void nsdp_watch_on_scan_done(nsdp_client_t *client, int err,
+                                    void *context)
+{
+  nsdp_watch_t *watch = context;
+  struct timeval tv = {};
+
+  nsdp_watch_expire(watch);
+
+  if (watch->changed)
+    watch->interval = watch->min_interval;
+  else if (watch->interval < watch->max_interval / 2)
+    watch->interval *= 2;
+  else
+    watch->interval = watch->max_interval;
+  watch->changed = 0;
+
+  tv.tv_sec = watch->interval;
+  evtimer_add(watch->timer, &tv);
+}
+
+static void nsdp_watch_scan(int fd, short what, void *arg)
+{
+  nsdp_watch_t *watch = arg;
+  struct timeval tv = {};
+  int err;
+
+  err = nsdp_client_scan(watch->client, watch->inventory,
+                         nsdp_watch_on_scan_done, watch);
+  if (err) {
+    fprintf(stderr, "Failed to start a scan: %s\n", strerror(-err));
+    tv.tv_sec = watch->interval;
+    evtimer_add(watch->timer, &tv);
+  }
+}
+
+int nsdp_watch_init(nsdp_watch_t *watch, nsdp_client_t *client,
+                    nsdp_inventory_t *inventory,
+                    nsdp_inventory_on_change_f on_change,
+                    void *context)
+{
+  if (!watch || !client || !inventory)
+    return -EINVAL;
+
+  memset(watch, 0, sizeof(*watch));
+  watch->client = client;
+  watch->inventory = inventory;
+  watch->min_interval = NSDP_WATCH_MIN_INTERVAL;
+  watch->max_interval = NSDP_WATCH_MAX_INTERVAL;
+  watch->interval = watch->min_interval;
+  watch->max_missed = NSDP_WATCH_MAX_MISSED;
+  watch->on_change = on_change;
+  watch->context = context;
+
+  watch->timer = evtimer_new(client->ev_base, nsdp_watch_scan, watch);
+  if (!watch->timer)
+    return -ENOMEM;
+
+  nsdp_inventory_set_on_change(inventory, nsdp_watch_on_change, watch);
+
+  // Start right away
+  event_active(watch->timer, EV_TIMEOUT, 0);
+  return 0;
+}
+
+void nsdp_watch_uninit(nsdp_watch_t *watch)
+{
+  if (!watch)
+    return;
+
+  if (watch->timer)
+    event_free(watch->timer);
+  watch->timer = NULL;
+  if (watch->inventory)
+    nsdp_inventory_set_on_change(watch->inventory, NULL, NULL);
+}
+
+int nsdp_watch_set_interval(nsdp_watch_t *watch,
+                            unsigned min_interval, unsigned max_interval)
+{
+  if (!watch)
+    return -EINVAL;
+
+  if (min_interval)
+    watch->min_interval = min_interval;
+  if (max_interval)
+    watch->max_interval = max_interval;
+  if (watch->max_interval < watch->min_interval)
+    watch->max_interval = watch->min_interval;
+  watch->interval = watch->min_interval;
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef NSDP_WATCH_H
+#define NSDP_WATCH_H
+
+#include "nsdp_client.h"
+
+// Delay between the end of a scan and the next one, in seconds
+#define NSDP_WATCH_MIN_INTERVAL		10
+#define NSDP_WATCH_MAX_INTERVAL		600
+// Scans a device can miss before it is considered removed
+#define NSDP_WATCH_MAX_MISSED		3
+
+// Repeat the scans and report the devices added, changed and removed.
+// The interval gets back to the minimum after a change and doubles
+// after every scan that didn't change anything.
+typedef struct nsdp_watch {
+  nsdp_client_t				*client;
+  nsdp_inventory_t			*inventory;
+  struct event				*timer;
+
+  unsigned				min_interval;
+  unsigned				max_interval;
+  unsigned				interval;
+  unsigned				max_missed;
+  // Something changed during the current scan
+  int					changed;
+
+  nsdp_inventory_on_change_f		on_change;
+  void					*context;
+} nsdp_watch_t;
+
+// Start watching, on_change gets the NSDP_INVENTORY_EVENT_* events
+int nsdp_watch_init(nsdp_watch_t *watch, nsdp_client_t *client,
+                    nsdp_inventory_t *inventory,
+                    nsdp_inventory_on_change_f on_change,
+                    void *context);
+
+// Stop watching, the client must not be running a scan for it
+void nsdp_watch_uninit(nsdp_watch_t *watch);
+
+// Set the interval bounds in seconds, 0 keeps the current value
+int nsdp_watch_set_interval(nsdp_watch_t *watch,
+                            unsigned min_interval, unsigned max_interval);
+
+#endif /* NSDP_WATCH_H */
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_workflow.h"
+
+int nsdp_workflow_group_init(nsdp_workflow_group_t *group,
+                             nsdp_client_t *client,
+                             nsdp_workflow_on_done_f on_done, void *context)
+{
+  if (!group || !client)
+    return -EINVAL;
+
+  memset(group, 0, sizeof(*group));
+  group->client = client;
+  INIT_LIST_HEAD(&group->running);
+  group->on_done = on_done;
+  group->context = context;
+  return 0;
+}
+
+void nsdp_workflow_group_uninit(nsdp_workflow_group_t *group)
+{
+  nsdp_workflow_t *wf, *next;
+
+  if (!group)
+    return;
+
+  list_for_each_entry_safe(wf, next, &group->running, list) {
+    list_del_init(&wf->list);
+    // The response callback frees it
+    if (wf->waiting)
+      wf->group = NULL;
+    else
+      free(wf);
+  }
+}
+
+static void nsdp_workflow_check_done(nsdp_workflow_group_t *group)
+{
+  if (group->closed && list_empty(&group->running) && group->on_done) {
+    group->closed = 0;
+    group->on_done(group, group->context);
+  }
+}
+
+static void nsdp_workflow_finish(nsdp_workflow_t *wf, int err)
+{
+  nsdp_workflow_group_t *group = wf->group;
+
+  list_del(&wf->list);
+  group->completed += 1;
+  if (err < 0)
+    group->failed += 1;
+  // A step that sent a request before ending leaves it to the response
+  // callback to free the workflow
+  if (wf->waiting)
+    wf->group = NULL;
+  else
+    free(wf);
+}
+
+// Run a step and end the workflow if it didn't wait for an answer
+static int nsdp_workflow_run(nsdp_workflow_t *wf,
+                             nsdp_packet_t *response, int err)
+{
+  int ret = wf->run(wf, response, err);
+
+  if (ret == NSDP_WORKFLOW_WAIT && !wf->waiting)
+    ret = -EINVAL;
+  if (ret != NSDP_WORKFLOW_WAIT)
+    nsdp_workflow_finish(wf, ret);
+  return ret;
+}
+
+static int nsdp_workflow_on_response(nsdp_packet_t *response, void *context)
+{
+  nsdp_workflow_t *wf = context;
+  nsdp_workflow_group_t *group = wf->group;
+
+  wf->waiting = 0;
+  if (!group) {
+    free(wf);
+    return 1;
+  }
+
+  nsdp_workflow_run(wf, response, response ? 0 : -ETIMEDOUT);
+  nsdp_workflow_check_done(group);
+  return 1;
+}
+
+int nsdp_workflow_start(nsdp_workflow_group_t *group, const nsdp_mac_t mac,
+                        nsdp_workflow_run_f run, void *context)
+{
+  nsdp_workflow_t *wf;
+  int ret;
+
+  if (!group || !mac || !run)
+    return -EINVAL;
+
+  wf = calloc(1, sizeof(*wf));
+  if (!wf)
+    return -ENOMEM;
+
+  wf->group = group;
+  memcpy(wf->mac, mac, sizeof(nsdp_mac_t));
+  wf->run = run;
+  wf->context = context;
+  list_add_tail(&wf->list, &group->running);
+  group->started += 1;
+
+  ret = nsdp_workflow_run(wf, NULL, 0);
+  return ret < 0 ? ret : 0;
+}
+
+void nsdp_workflow_group_close(nsdp_workflow_group_t *group)
+{
+  if (!group)
+    return;
+  group->closed = 1;
+  nsdp_workflow_check_done(group);
+}
+
+static int nsdp_workflow_send(nsdp_workflow_t *wf, unsigned step,
+                              nsdp_client_request_t *req)
+{
+  int err;
+
+  if (wf->waiting) {
+    nsdp_client_request_free(req);
+    return -EBUSY;
+  }
+
+  nsdp_packet_add_properties_terminator(&req->packet);
+  err = nsdp_client_add_request(wf->group->client, req);
+  if (err) {
+    nsdp_client_request_free(req);
+    return err;
+  }
+
+  wf->step = step;
+  wf->waiting = 1;
+  return 0;
+}
+
+int nsdp_workflow_read(nsdp_workflow_t *wf, unsigned step,
+                       const nsdp_tag_t *tags, unsigned count)
+{
+  nsdp_client_request_t *req;
+  nsdp_property_t *prop;
+  unsigned i;
+
+  if (!wf || !tags || count == 0)
+    return -EINVAL;
+
+  req = nsdp_client_request_new(NSDP_OP_READ_REQUEST, wf->mac, NULL,
+                                nsdp_workflow_on_response, wf);
+  if (!req)
+    return -ENOMEM;
+
+  for (i = 0 ; i < count ; i += 1) {
+    prop = nsdp_property_new(tags[i], 0);
+    if (!prop) {
+      nsdp_client_request_free(req);
+      return -ENOMEM;
+    }
+    nsdp_packet_add_property(&req->packet, prop);
+  }
+
+  return nsdp_workflow_send(wf, step, req);
+}
+
+int nsdp_workflow_write(nsdp_workflow_t *wf, unsigned step,
+                        const struct list_head *properties)
+{
+  const nsdp_property_t *prop;
+  nsdp_client_request_t *req;
+  nsdp_property_t *copy;
+
+  if (!wf || !properties || list_empty(properties))
+    return -EINVAL;
+
+  req = nsdp_client_request_new(NSDP_OP_WRITE_REQUEST, wf->mac, NULL,
+                                nsdp_workflow_on_response, wf);
+  if (!req)
+    return -ENOMEM;
+
+  list_for_each_entry(prop, properties, list) {
+    if (prop->tag == NSDP_PROPERTY_TERMINATOR)
+      continue;
+    copy = nsdp_property_from_data(prop->tag, prop->length, prop->data);
+    if (!copy) {
+      nsdp_client_request_free(req);
+      return -ENOMEM;
+    }
+    nsdp_packet_add_property(&req->packet, copy);
+  }
+
+  return nsdp_workflow_send(wf, step, req);
+}
@@ -0,0 +1,76 @@
+#ifndef NSDP_WORKFLOW_H
+#define NSDP_WORKFLOW_H
+
+#include "nsdp_client.h"
+
+// Values returned by the workflow steps, or a negative error
+#define NSDP_WORKFLOW_WAIT		0
+#define NSDP_WORKFLOW_DONE		1
+
+struct nsdp_workflow;
+struct nsdp_workflow_group;
+
+// Run the current step of a workflow. It is called with step 0 and no
+// response when the workflow starts, then with the answer of each
+// request the steps send, or with -ETIMEDOUT. A step that sent a
+// request returns NSDP_WORKFLOW_WAIT, the others end the workflow.
+typedef int (*nsdp_workflow_run_f)(struct nsdp_workflow *wf,
+                                   nsdp_packet_t *response, int err);
+
+typedef void (*nsdp_workflow_on_done_f)(struct nsdp_workflow_group *group,
+                                        void *context);
+
+// Sequence of requests to one device, each one sent once the previous
+// one is answered. The workflows of a group all run at the same time,
+// so the devices only wait for their own answers.
+typedef struct nsdp_workflow {
+  struct list_head			list;
+  struct nsdp_workflow_group		*group;
+  nsdp_mac_t				mac;
+  // Step run with the next answer, set when sending a request
+  unsigned				step;
+  // A request is in flight
+  int					waiting;
+  nsdp_workflow_run_f			run;
+  void					*context;
+} nsdp_workflow_t;
+
+typedef struct nsdp_workflow_group {
+  nsdp_client_t				*client;
+  struct list_head			running;
+  // No more workflows will be started
+  int					closed;
+
+  unsigned				started;
+  unsigned				completed;
+  unsigned				failed;
+
+  nsdp_workflow_on_done_f		on_done;
+  void					*context;
+} nsdp_workflow_group_t;
+
+int nsdp_workflow_group_init(nsdp_workflow_group_t *group,
+                             nsdp_client_t *client,
+                             nsdp_workflow_on_done_f on_done, void *context);
+
+// Free the group, the requests in flight are completed without
+// running their workflows
+void nsdp_workflow_group_uninit(nsdp_workflow_group_t *group);
+
+// Start a workflow, its first step runs right away
+int nsdp_workflow_start(nsdp_workflow_group_t *group, const nsdp_mac_t mac,
+                        nsdp_workflow_run_f run, void *context);
+
+// Tell that all the workflows are started, on_done is called once
+// they are all done, right away if they already are
+void nsdp_workflow_group_close(nsdp_workflow_group_t *group);
+
+// Read some properties of the workflow device, the answer goes to step
+int nsdp_workflow_read(nsdp_workflow_t *wf, unsigned step,
+                       const nsdp_tag_t *tags, unsigned count);
+
+// Write properties to the workflow device, the answer goes to step
+int nsdp_workflow_write(nsdp_workflow_t *wf, unsigned step,
+                        const struct list_head *properties);
+
+#endif /* NSDP_WORKFLOW_H */
@@ -0,0 +1,715 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <event.h>
+#include <event2/listener.h>
+
+#include "nsdp_client.h"
+#include "nsdp_capability.h"
+#include "nsdp_snapshot.h"
+#include "nsdpd_protocol.h"
+
+#define NSDPD_REQUEST_HASH_SIZE		256
+// Output queued for a client before it gets disconnected
+#define NSDPD_MAX_OUTPUT		(1 << 20)
+// Seconds between the snapshot saves
+#define NSDPD_SNAPSHOT_INTERVAL		60
+
+struct nsdpd;
+struct nsdpd_conn;
+struct nsdpd_request;
+
+// Operation of a client waiting for a request or a scan
+typedef struct nsdpd_waiter {
+  struct list_head			list;
+  struct list_head			conn_list;
+  struct nsdpd_conn			*conn;
+  uint32_t				id;
+  // Request waited for, NULL for the scans
+  struct nsdpd_request			*request;
+} nsdpd_waiter_t;
+
+// Request in flight, the identical reads of all the clients share it
+typedef struct nsdpd_request {
+  struct hlist_node			hash;
+  struct nsdpd				*daemon;
+  struct list_head			waiters;
+  // Id of the client request, to cancel it
+  uint32_t				req_id;
+  nsdp_op_t				op;
+  nsdp_mac_t				mac;
+  unsigned				tag_count;
+  nsdp_tag_t				tags[0];
+} nsdpd_request_t;
+
+typedef struct nsdpd_conn {
+  struct list_head			list;
+  struct nsdpd				*daemon;
+  struct bufferevent			*bev;
+  struct list_head			waiters;
+  // Too slow to read its answers, freed from the event loop
+  int					closing;
+} nsdpd_conn_t;
+
+typedef struct nsdpd {
+  struct event_base			*ev_base;
+  nsdp_client_t				client;
+  nsdp_inventory_t			inventory;
+  nsdp_capability_cache_t		capability;
+
+  const char				*path;
+  struct evconnlistener			*listener;
+  struct list_head			conns;
+
+  // Reads in flight, by MAC and tags
+  struct hlist_head			request[NSDPD_REQUEST_HASH_SIZE];
+  struct list_head			scan_waiters;
+  int					scanning;
+
+  uint8_t				*buffer;
+
+  // Snapshot of the inventory and the capabilities, saved when they
+  // changed
+  const char				*snapshot_path;
+  struct event				*snapshot_timer;
+  int					inventory_changed;
+  unsigned				saved_generation;
+} nsdpd_t;
+
+static unsigned nsdpd_request_hash(const nsdp_mac_t mac,
+                                   const nsdp_tag_t *tags, unsigned count)
+{
+  unsigned i, hash = nsdp_mac_hash(mac);
+
+  for (i = 0 ; i < count ; i += 1)
+    hash = (hash ^ tags[i]) * 16777619u;
+
+  return hash % NSDPD_REQUEST_HASH_SIZE;
+}
+
+static nsdpd_request_t *nsdpd_request_find(nsdpd_t *daemon,
+                                           const nsdp_mac_t mac,
+                                           const nsdp_tag_t *tags,
+                                           unsigned count)
+{
+  unsigned hash = nsdpd_request_hash(mac, tags, count);
+  nsdpd_request_t *dreq;
+  struct hlist_node *pos;
+
+  hlist_for_each_entry(dreq, pos, &daemon->request[hash], hash)
+    if (dreq->tag_count == count &&
+        !memcmp(dreq->mac, mac, sizeof(nsdp_mac_t)) &&
+        !memcmp(dreq->tags, tags, count * sizeof(*tags)))
+      return dreq;
+
+  return NULL;
+}
+
+static void nsdpd_waiter_free(nsdpd_waiter_t *waiter)
+{
+  list_del(&waiter->list);
+  list_del(&waiter->conn_list);
+  free(waiter);
+}
+
+// Free a waiter that gave up, and cancel the read it waited for if
+// nobody else waits for it. The writes are left to complete.
+static void nsdpd_waiter_drop(nsdpd_waiter_t *waiter)
+{
+  nsdpd_request_t *dreq = waiter->request;
+
+  nsdpd_waiter_free(waiter);
+  if (!dreq || !list_empty(&dreq->waiters) ||
+      dreq->op != NSDP_OP_READ_REQUEST)
+    return;
+
+  nsdp_client_cancel(&dreq->daemon->client, dreq->req_id);
+  if (!hlist_unhashed(&dreq->hash))
+    hlist_del(&dreq->hash);
+  free(dreq);
+}
+
+static void nsdpd_conn_free(nsdpd_conn_t *conn)
+{
+  while (!list_empty(&conn->waiters))
+    nsdpd_waiter_drop(list_first_entry(&conn->waiters,
+                                       nsdpd_waiter_t, conn_list));
+  list_del(&conn->list);
+  bufferevent_free(conn->bev);
+  free(conn);
+}
+
+static void nsdpd_conn_reap(int fd, short what, void *arg)
+{
+  nsdpd_conn_free(arg);
+}
+
+// Queue a message, the payload is already in the daemon buffer
+static void nsdpd_conn_send(nsdpd_conn_t *conn, unsigned type,
+                            unsigned status, uint32_t id, unsigned length)
+{
+  nsdpd_t *daemon = conn->daemon;
+  struct evbuffer *output = bufferevent_get_output(conn->bev);
+  struct timeval now = {};
+
+  if (conn->closing)
+    return;
+
+  // Never let a client that doesn't read hold the daemon memory
+  if (evbuffer_get_length(output) > NSDPD_MAX_OUTPUT) {
+    fprintf(stderr, "Dropping a client that doesn't read its answers\n");
+    conn->closing = 1;
+    bufferevent_disable(conn->bev, EV_READ | EV_WRITE);
+    event_base_once(daemon->ev_base, -1, EV_TIMEOUT,
+                    nsdpd_conn_reap, conn, &now);
+    return;
+  }
+
+  nsdpd_write_header(daemon->buffer, length, type, status, id);
+  bufferevent_write(conn->bev, daemon->buffer, NSDPD_HEADER_SIZE + length);
+}
+
+static void nsdpd_send_done(nsdpd_conn_t *conn, uint32_t id, int err)
+{
+  nsdpd_conn_send(conn, NSDPD_MSG_DONE, err < 0 ? -err : err, id, 0);
+}
+
+static void nsdpd_send_packet(nsdpd_conn_t *conn, unsigned type, uint32_t id,
+                              const nsdp_packet_t *packet)
+{
+  int len = nsdp_packet_write(packet, conn->daemon->buffer +
+                              NSDPD_HEADER_SIZE, NSDPD_MAX_PAYLOAD);
+
+  if (len < 0)
+    fprintf(stderr, "Failed to write packet: %s\n", strerror(-len));
+  else
+    nsdpd_conn_send(conn, type, 0, id, len);
+}
+
+static void nsdpd_send_device(nsdpd_conn_t *conn, uint32_t id,
+                              const nsdp_device_t *device)
+{
+  uint8_t *data = conn->daemon->buffer + NSDPD_HEADER_SIZE;
+  const nsdp_property_t *prop;
+  nsdp_packet_t header;
+  int pos, len;
+
+  nsdp_packet_init(&header);
+  header.op = NSDP_OP_READ_RESPONSE;
+  memcpy(header.server_mac, device->mac, sizeof(nsdp_mac_t));
+  pos = nsdp_packet_write_header(&header, data, NSDPD_MAX_PAYLOAD);
+
+  nsdp_device_for_each_property(device, prop) {
+    if (pos + NSDP_PROPERTY_HEADER_SIZE + prop->length +
+        NSDP_PROPERTY_HEADER_SIZE > NSDPD_MAX_PAYLOAD)
+      break;
+    len = nsdp_property_write(prop, data + pos, NSDPD_MAX_PAYLOAD - pos);
+    if (len < 0)
+      break;
+    pos += len;
+  }
+
+  nsdp_set_u16be(data + pos, NSDP_PROPERTY_TERMINATOR);
+  nsdp_set_u16be(data + pos + 2, 0);
+  pos += NSDP_PROPERTY_HEADER_SIZE;
+
+  nsdpd_conn_send(conn, NSDPD_MSG_DEVICE, 0, id, pos);
+}
+
+static nsdpd_waiter_t *nsdpd_waiter_new(nsdpd_conn_t *conn, uint32_t id,
+                                        nsdpd_request_t *dreq,
+                                        struct list_head *waiters)
+{
+  nsdpd_waiter_t *waiter = calloc(1, sizeof(*waiter));
+
+  if (!waiter)
+    return NULL;
+
+  waiter->conn = conn;
+  waiter->id = id;
+  waiter->request = dreq;
+  list_add_tail(&waiter->list, waiters);
+  list_add_tail(&waiter->conn_list, &conn->waiters);
+  return waiter;
+}
+
+static int nsdpd_on_response(nsdp_packet_t *response, void *context)
+{
+  nsdpd_request_t *dreq = context;
+  nsdpd_t *daemon = dreq->daemon;
+  nsdpd_waiter_t *waiter;
+
+  if (response && response->op == NSDP_OP_READ_RESPONSE)
+    nsdp_inventory_update_iface(&daemon->inventory, response,
+                                daemon->client.iface);
+
+  while (!list_empty(&dreq->waiters)) {
+    waiter = list_first_entry(&dreq->waiters, nsdpd_waiter_t, list);
+    if (response) {
+      nsdpd_send_packet(waiter->conn, NSDPD_MSG_RESPONSE, waiter->id,
+                        response);
+      nsdpd_send_done(waiter->conn, waiter->id, 0);
+    } else
+      nsdpd_send_done(waiter->conn, waiter->id, -ETIMEDOUT);
+    nsdpd_waiter_free(waiter);
+  }
+
+  if (!hlist_unhashed(&dreq->hash))
+    hlist_del(&dreq->hash);
+  free(dreq);
+  return 1;
+}
+
+static int nsdpd_handle_request(nsdpd_conn_t *conn, uint32_t id,
+                                const uint8_t *payload, unsigned length)
+{
+  nsdpd_t *daemon = conn->daemon;
+  nsdp_client_request_t *req;
+  nsdpd_request_t *dreq;
+  nsdp_property_t *prop;
+  nsdp_packet_t packet;
+  unsigned count = 0;
+  int err;
+
+  nsdp_packet_init(&packet);
+  err = nsdp_packet_read(&packet, payload, length);
+  if (err < 0)
+    goto out;
+
+  if ((packet.op != NSDP_OP_READ_REQUEST &&
+       packet.op != NSDP_OP_WRITE_REQUEST) ||
+      nsdp_mac_is_zero(packet.server_mac)) {
+    err = -EINVAL;
+    goto out;
+  }
+
+  nsdp_packet_for_each_property(&packet, prop)
+    if (prop->tag != NSDP_PROPERTY_TERMINATOR)
+      count += 1;
+
+  dreq = calloc(1, sizeof(*dreq) + count * sizeof(nsdp_tag_t));
+  if (!dreq) {
+    err = -ENOMEM;
+    goto out;
+  }
+  INIT_HLIST_NODE(&dreq->hash);
+  INIT_LIST_HEAD(&dreq->waiters);
+  dreq->daemon = daemon;
+  dreq->op = packet.op;
+  memcpy(dreq->mac, packet.server_mac, sizeof(nsdp_mac_t));
+  nsdp_packet_for_each_property(&packet, prop)
+    if (prop->tag != NSDP_PROPERTY_TERMINATOR)
+      dreq->tags[dreq->tag_count++] = prop->tag;
+
+  // Join an identical read that is already in flight
+  if (dreq->op == NSDP_OP_READ_REQUEST) {
+    nsdpd_request_t *other = nsdpd_request_find(daemon, dreq->mac,
+                                                dreq->tags, count);
+    if (other) {
+      free(dreq);
+      err = nsdpd_waiter_new(conn, id, other, &other->waiters) ?
+        0 : -ENOMEM;
+      goto out;
+    }
+  }
+
+  req = nsdp_client_request_new(dreq->op, dreq->mac, NULL,
+                                nsdpd_on_response, dreq);
+  if (!req || !nsdpd_waiter_new(conn, id, dreq, &dreq->waiters)) {
+    nsdp_client_request_free(req);
+    free(dreq);
+    err = -ENOMEM;
+    goto out;
+  }
+
+  list_splice_init(&packet.properties, &req->packet.properties);
+  if (!nsdp_packet_has_terminator(&req->packet))
+    nsdp_packet_add_properties_terminator(&req->packet);
+
+  if (dreq->op == NSDP_OP_READ_REQUEST)
+    hlist_add_head(&dreq->hash,
+                   &daemon->request[nsdpd_request_hash(dreq->mac, dreq->tags,
+                                                       count)]);
+
+  err = nsdp_client_add_request(&daemon->client, req);
+  if (err) {
+    // The waiter gets its done with the error from the caller
+    nsdpd_waiter_free(list_first_entry(&dreq->waiters, nsdpd_waiter_t,
+                                       list));
+    if (!hlist_unhashed(&dreq->hash))
+      hlist_del(&dreq->hash);
+    nsdp_client_request_free(req);
+    free(dreq);
+    goto out;
+  }
+  dreq->req_id = req->id;
+
+out:
+  nsdp_packet_uninit(&packet);
+  return err < 0 ? err : 0;
+}
+
+static void nsdpd_on_scan_done(nsdp_client_t *client, int err,
+                               void *context)
+{
+  nsdpd_t *daemon = context;
+  nsdpd_waiter_t *waiter;
+  nsdp_device_t *device;
+
+  daemon->scanning = 0;
+  while (!list_empty(&daemon->scan_waiters)) {
+    waiter = list_first_entry(&daemon->scan_waiters, nsdpd_waiter_t, list);
+    nsdp_inventory_for_each(&daemon->inventory, device)
+      if (device->generation == daemon->inventory.generation)
+        nsdpd_send_device(waiter->conn, waiter->id, device);
+    nsdpd_send_done(waiter->conn, waiter->id, err);
+    nsdpd_waiter_free(waiter);
+  }
+}
+
+static int nsdpd_handle_scan(nsdpd_conn_t *conn, uint32_t id)
+{
+  nsdpd_t *daemon = conn->daemon;
+  int err;
+
+  // All the clients asking during a scan get its result
+  if (!daemon->scanning) {
+    err = nsdp_client_scan(&daemon->client, &daemon->inventory,
+                           nsdpd_on_scan_done, daemon);
+    if (err)
+      return err;
+    daemon->scanning = 1;
+  }
+
+  return nsdpd_waiter_new(conn, id, NULL, &daemon->scan_waiters) ?
+    0 : -ENOMEM;
+}
+
+// Give up an operation of the client, it ends with ECANCELED
+static int nsdpd_handle_cancel(nsdpd_conn_t *conn, uint32_t id)
+{
+  nsdpd_waiter_t *waiter;
+
+  list_for_each_entry(waiter, &conn->waiters, conn_list)
+    if (waiter->id == id) {
+      nsdpd_waiter_drop(waiter);
+      return -ECANCELED;
+    }
+
+  return -ENOENT;
+}
+
+static void nsdpd_handle_inventory(nsdpd_conn_t *conn, uint32_t id)
+{
+  nsdp_device_t *device;
+
+  nsdp_inventory_for_each(&conn->daemon->inventory, device)
+    nsdpd_send_device(conn, id, device);
+  nsdpd_send_done(conn, id, 0);
+}
+
+static void nsdpd_conn_on_read(struct bufferevent *bev, void *arg)
+{
+  nsdpd_conn_t *conn = arg;
+  struct evbuffer *input = bufferevent_get_input(bev);
+  uint8_t header[NSDPD_HEADER_SIZE], *payload;
+  unsigned length, type;
+  uint32_t id;
+  int err;
+
+  while (!conn->closing &&
+         evbuffer_copyout(input, header, sizeof(header)) == sizeof(header)) {
+    length = nsdp_get_u16be(header);
+    if (evbuffer_get_length(input) < NSDPD_HEADER_SIZE + length)
+      break;
+
+    type = header[2];
+    id = nsdp_get_u32be(header + 4);
+    evbuffer_drain(input, NSDPD_HEADER_SIZE);
+    payload = evbuffer_pullup(input, length);
+
+    switch (type) {
+    case NSDPD_MSG_REQUEST:
+      err = nsdpd_handle_request(conn, id, payload, length);
+      break;
+    case NSDPD_MSG_SCAN:
+      err = nsdpd_handle_scan(conn, id);
+      break;
+    case NSDPD_MSG_INVENTORY:
+      nsdpd_handle_inventory(conn, id);
+      err = 0;
+      break;
+    case NSDPD_MSG_CANCEL:
+      err = nsdpd_handle_cancel(conn, id);
+      break;
+    default:
+      err = -ENOSYS;
+    }
+    evbuffer_drain(input, length);
+
+    if (err)
+      nsdpd_send_done(conn, id, err);
+  }
+}
+
+static void nsdpd_conn_on_event(struct bufferevent *bev, short what,
+                                void *arg)
+{
+  if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+    nsdpd_conn_free(arg);
+}
+
+static void nsdpd_on_accept(struct evconnlistener *listener,
+                            evutil_socket_t fd, struct sockaddr *addr,
+                            int addr_len, void *arg)
+{
+  nsdpd_t *daemon = arg;
+  nsdpd_conn_t *conn;
+
+  conn = calloc(1, sizeof(*conn));
+  if (conn)
+    conn->bev = bufferevent_socket_new(daemon->ev_base, fd,
+                                       BEV_OPT_CLOSE_ON_FREE);
+  if (!conn || !conn->bev) {
+    fprintf(stderr, "Failed to allocate a new client\n");
+    free(conn);
+    close(fd);
+    return;
+  }
+
+  conn->daemon = daemon;
+  INIT_LIST_HEAD(&conn->waiters);
+  list_add_tail(&conn->list, &daemon->conns);
+  bufferevent_setcb(conn->bev, nsdpd_conn_on_read, NULL,
+                    nsdpd_conn_on_event, conn);
+  bufferevent_enable(conn->bev, EV_READ | EV_WRITE);
+}
+
+static int nsdpd_listen(nsdpd_t *daemon, const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.sun_path, path);
+
+  // Remove the socket left by a previous run
+  unlink(path);
+
+  daemon->listener =
+    evconnlistener_new_bind(daemon->ev_base, nsdpd_on_accept, daemon,
+                            LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC,
+                            -1, (struct sockaddr *)&addr, sizeof(addr));
+  if (!daemon->listener)
+    return -errno;
+
+  daemon->path = path;
+  return 0;
+}
+
+static void nsdpd_save_snapshot(nsdpd_t *daemon)
+{
+  int err;
+
+  if (!daemon->inventory_changed &&
+      daemon->saved_generation == daemon->capability.generation)
+    return;
+
+  err = nsdp_snapshot_save_capabilities(&daemon->inventory,
+                                        &daemon->capability,
+                                        daemon->snapshot_path);
+  if (err) {
+    fprintf(stderr, "Failed to save the snapshot %s: %s\n",
+            daemon->snapshot_path, strerror(-err));
+    return;
+  }
+
+  daemon->inventory_changed = 0;
+  daemon->saved_generation = daemon->capability.generation;
+}
+
+static void nsdpd_on_snapshot_timer(int fd, short what, void *arg)
+{
+  nsdpd_t *daemon = arg;
+  struct timeval tv = { .tv_sec = NSDPD_SNAPSHOT_INTERVAL };
+
+  nsdpd_save_snapshot(daemon);
+  evtimer_add(daemon->snapshot_timer, &tv);
+}
+
+static void nsdpd_on_inventory_change(nsdp_inventory_t *inventory,
+                                      const nsdp_device_t *device,
+                                      int event, void *context)
+{
+  nsdpd_t *daemon = context;
+
+  daemon->inventory_changed = 1;
+}
+
+// Start from the last snapshot, so the known devices are reachable by
+// unicast and their models are not probed again. A snapshot that can't
+// be loaded is replaced by the next save.
+static int nsdpd_load_snapshot(nsdpd_t *daemon, const char *path)
+{
+  int err;
+
+  err = nsdp_snapshot_load_capabilities(&daemon->inventory,
+                                        &daemon->capability, path);
+  if (err < 0 && err != -ENOENT)
+    fprintf(stderr, "Failed to load the snapshot %s: %s\n",
+            path, strerror(-err));
+  nsdp_client_learn_addresses(&daemon->client, &daemon->inventory);
+
+  daemon->snapshot_path = path;
+  daemon->snapshot_timer = evtimer_new(daemon->ev_base,
+                                       nsdpd_on_snapshot_timer, daemon);
+  if (!daemon->snapshot_timer)
+    return -ENOMEM;
+
+  // What was just loaded doesn't need to be saved
+  daemon->saved_generation = daemon->capability.generation;
+  nsdp_inventory_set_on_change(&daemon->inventory,
+                               nsdpd_on_inventory_change, daemon);
+  nsdpd_on_snapshot_timer(-1, EV_TIMEOUT, daemon);
+  return 0;
+}
+
+static void nsdpd_on_signal(int fd, short what, void *arg)
+{
+  nsdpd_t *daemon = arg;
+
+  event_base_loopbreak(daemon->ev_base);
+}
+
+static int nsdp_drop_privileges(void)
+{
+  int err = 0;
+  if (!err && getuid() != geteuid())
+    err = seteuid(getuid());
+  if (!err && getgid() != getegid())
+    err = setegid(getgid());
+  return err;
+}
+
+static void usage(int ret)
+{
+  printf("Usage: nsdpd [OPTS] -i INTERFACE [-S SOCKET] [-f SNAPSHOT]\n");
+  exit(ret);
+}
+
+int main(int argc, char*const* argv)
+{
+  nsdpd_t daemon = {};
+  struct event *sigint, *sigterm;
+  char* mac = NULL;
+  char* iface = NULL;
+  const char *path = NSDPD_DEFAULT_SOCKET;
+  const char *snapshot_path = NULL;
+  unsigned client_port = 0;
+  unsigned server_port = 0;
+  int opt, err;
+
+  while ((opt = getopt(argc, argv, "hm:i:c:s:S:f:")) >= 0) {
+    switch (opt) {
+    case '?':
+    case 'h':
+      usage(opt != 'h');
+      /* no return */
+    case 'm':
+      mac = optarg;
+      break;
+    case 'i':
+      iface = optarg;
+      break;
+    case 'c':
+      client_port = atoi(optarg);
+      break;
+    case 's':
+      server_port = atoi(optarg);
+      break;
+    case 'S':
+      path = optarg;
+      break;
+    case 'f':
+      snapshot_path = optarg;
+      break;
+    }
+  }
+
+  if (optind < argc)
+    usage(1);
+
+  INIT_LIST_HEAD(&daemon.conns);
+  INIT_LIST_HEAD(&daemon.scan_waiters);
+  nsdp_inventory_init(&daemon.inventory);
+
+  daemon.buffer = malloc(NSDPD_HEADER_SIZE + NSDPD_MAX_PAYLOAD);
+  daemon.ev_base = event_base_new();
+  if (!daemon.buffer || !daemon.ev_base) {
+    fprintf(stderr, "Failed to get event base\n");
+    return 1;
+  }
+
+  err = nsdp_client_init(&daemon.client, daemon.ev_base, mac, iface,
+                         client_port, server_port);
+  if (err) {
+    fprintf(stderr, "Failed to init client: %s\n", strerror(-err));
+    return 1;
+  }
+
+  err = nsdp_capability_cache_init(&daemon.capability, &daemon.client,
+                                   &daemon.inventory);
+  if (err) {
+    fprintf(stderr, "Failed to init capability cache: %s\n",
+            strerror(-err));
+    return 1;
+  }
+
+  if (snapshot_path) {
+    err = nsdpd_load_snapshot(&daemon, snapshot_path);
+    if (err) {
+      fprintf(stderr, "Failed to start the snapshot saves: %s\n",
+              strerror(-err));
+      return 1;
+    }
+  }
+
+  err = nsdpd_listen(&daemon, path);
+  if (err) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(-err));
+    return 1;
+  }
+
+  err = nsdp_drop_privileges();
+  if (err) {
+    fprintf(stderr, "Failed to drop privileges: %s\n", strerror(-err));
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  sigint = evsignal_new(daemon.ev_base, SIGINT, nsdpd_on_signal, &daemon);
+  sigterm = evsignal_new(daemon.ev_base, SIGTERM, nsdpd_on_signal, &daemon);
+  evsignal_add(sigint, NULL);
+  evsignal_add(sigterm, NULL);
+
+  nsdp_client_run(&daemon.client, -1);
+
+  while (!list_empty(&daemon.conns))
+    nsdpd_conn_free(list_first_entry(&daemon.conns, nsdpd_conn_t, list));
+  evconnlistener_free(daemon.listener);
+  unlink(daemon.path);
+  if (daemon.snapshot_path) {
+    nsdpd_save_snapshot(&daemon);
+    event_free(daemon.snapshot_timer);
+  }
+  nsdp_capability_cache_uninit(&daemon.capability);
+  event_free(sigint);
+  event_free(sigterm);
+  return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef NSDPD_PROTOCOL_H
+#define NSDPD_PROTOCOL_H
+
+#include "nsdp_types.h"
+
+// Protocol spoken by nsdpd on its UNIX socket. Each message has an 8
+// bytes header in network order followed by its payload:
+//   0: payload length (u16)
+//   2: message type (u8)
+//   3: status, 0 or an errno value (u8)
+//   4: ID chosen by the client, copied in the answers (u32)
+// The NSDP packets in the payloads use the NSDP wire format, the
+// client MAC and seq no of the requests are ignored.
+
+#define NSDPD_DEFAULT_SOCKET		"/var/run/nsdpd.sock"
+
+#define NSDPD_HEADER_SIZE		8
+#define NSDPD_MAX_PAYLOAD		0xFFFF
+
+// NSDP read or write request for a device, answered with a response
+#define NSDPD_MSG_REQUEST		0x01
+// Broadcast scan, answered with the devices that answered it
+#define NSDPD_MSG_SCAN			0x02
+// Answered with the devices in the daemon inventory, without scanning
+#define NSDPD_MSG_INVENTORY		0x03
+// Give up the operation with the same ID, it ends with ECANCELED,
+// or ENOENT if it is already done
+#define NSDPD_MSG_CANCEL		0x04
+
+// NSDP response from a device
+#define NSDPD_MSG_RESPONSE		0x81
+// Device from the inventory, as an NSDP read response
+#define NSDPD_MSG_DEVICE		0x82
+// Last message of every operation, with its status
+#define NSDPD_MSG_DONE			0x83
+
+static inline void nsdpd_write_header(void *buf, unsigned length,
+                                      unsigned type, unsigned status,
+                                      uint32_t id)
+{
+  uint8_t *data = buf;
+
+  nsdp_set_u16be(data, length);
+  data[2] = type;
+  data[3] = status;
+  nsdp_set_u32be(data + 4, id);
+}
+
+#endif /* NSDPD_PROTOCOL_H */
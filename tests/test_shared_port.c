@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nsdp_client.h"
+#include "nsdp_listener.h"
+#include "nsdp_properties.h"
+
+// Use other ports than NSDP, to not clash with the running tools
+#define TEST_CLIENT_PORT	43321
+#define TEST_SERVER_PORT	43322
+
+#define TEST_CLIENT_MAC		"02:aa:00:00:00:01"
+
+static nsdp_mac_t test_device_mac = { 0x02, 0, 0, 0, 0, 0x01 };
+
+typedef struct test_switch {
+  nsdp_socket_t		socket;
+  struct event		*recv_event;
+  uint8_t		buffer[NSDP_CLIENT_DEFAULT_MTU];
+} test_switch_t;
+
+// Answer the read requests with the model, broadcast as the devices do
+static void test_switch_recv(evutil_socket_t fd, short events, void *ctx)
+{
+  test_switch_t *sw = ctx;
+  nsdp_socket_addr_t to = {};
+  nsdp_packet_t packet;
+  nsdp_property_t *model;
+  int len;
+
+  len = nsdp_socket_recvfrom(sw->socket, sw->buffer, sizeof(sw->buffer),
+                             NULL);
+  if (len < 0)
+    return;
+
+  nsdp_packet_init(&packet);
+  if (nsdp_packet_read_header(&packet, sw->buffer, len) < 0 ||
+      packet.op != NSDP_OP_READ_REQUEST)
+    goto out;
+
+  packet.op = NSDP_OP_READ_RESPONSE;
+  memcpy(packet.server_mac, test_device_mac, sizeof(nsdp_mac_t));
+  model = nsdp_property_from_data(NSDP_PROPERTY_MODEL, 6, "GS308E");
+  if (!model || nsdp_packet_add_property(&packet, model)) {
+    nsdp_property_free(model);
+    goto out;
+  }
+  if (nsdp_packet_add_properties_terminator(&packet))
+    goto out;
+
+  len = nsdp_packet_write(&packet, sw->buffer, sizeof(sw->buffer));
+  nsdp_socket_addr_set_broadcast(&to);
+  nsdp_socket_addr_set_port(&to, TEST_CLIENT_PORT);
+  if (len > 0)
+    nsdp_socket_sendto(sw->socket, sw->buffer, len, &to);
+
+out:
+  nsdp_packet_uninit(&packet);
+}
+
+typedef struct test_result {
+  struct event_base	*ev_base;
+  int			answered;
+} test_result_t;
+
+// Leave the listener some time to get the same answer
+static int test_on_response(nsdp_packet_t *response, void *context)
+{
+  test_result_t *result = context;
+  struct timeval delay = { 0, 200000 };
+
+  result->answered = response ? 1 : -1;
+  event_base_loopexit(result->ev_base, &delay);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  struct event_base *ev_base;
+  nsdp_client_t client;
+  nsdp_listener_t listener;
+  nsdp_inventory_t inventory;
+  test_switch_t sw = {};
+  struct timeval timeout = { 5, 0 };
+  test_result_t result = {};
+  int err;
+
+  ev_base = event_base_new();
+  if (!ev_base || nsdp_inventory_init(&inventory)) {
+    fprintf(stderr, "Failed to init\n");
+    return 1;
+  }
+
+  result.ev_base = ev_base;
+
+  err = nsdp_client_init(&client, ev_base, TEST_CLIENT_MAC, NULL,
+                         TEST_CLIENT_PORT, TEST_SERVER_PORT);
+  if (err) {
+    fprintf(stderr, "Failed to init client: %s\n", strerror(-err));
+    return 1;
+  }
+
+  // The listener binds the port the client already holds
+  err = nsdp_listener_init(&listener, ev_base, NULL, TEST_CLIENT_PORT,
+                           &inventory);
+  if (err) {
+    fprintf(stderr, "Failed to init listener: %s\n", strerror(-err));
+    return 1;
+  }
+
+  err = nsdp_socket_open(NULL, NULL, TEST_SERVER_PORT, &sw.socket);
+  if (err) {
+    fprintf(stderr, "Failed to open switch socket: %s\n", strerror(-err));
+    return 1;
+  }
+  sw.recv_event = event_new(ev_base, sw.socket, EV_READ | EV_PERSIST,
+                            test_switch_recv, &sw);
+  event_add(sw.recv_event, NULL);
+
+  err = nsdp_client_read_property(&client, test_device_mac, NULL,
+                                  test_on_response, &result,
+                                  NSDP_PROPERTY_MODEL,
+                                  NSDP_PROPERTY_TERMINATOR);
+  if (err) {
+    fprintf(stderr, "Failed to send read: %s\n", strerror(-err));
+    return 1;
+  }
+
+  event_base_loopexit(ev_base, &timeout);
+  event_base_dispatch(ev_base);
+
+  if (result.answered != 1) {
+    fprintf(stderr, "The client got no answer\n");
+    return 1;
+  }
+  if (nsdp_listener_get_stats(&listener)->responses != 1 ||
+      !nsdp_inventory_find(&inventory, test_device_mac)) {
+    fprintf(stderr, "The listener didn't get the answer\n");
+    return 1;
+  }
+
+  event_free(sw.recv_event);
+  nsdp_socket_close(sw.socket);
+  nsdp_listener_uninit(&listener);
+  nsdp_inventory_uninit(&inventory);
+  event_base_free(ev_base);
+
+  printf("The client and the listener both got the answer\n");
+  return 0;
+}